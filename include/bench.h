@@ -0,0 +1,27 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "common.h"
+
+uint64_t bench_now(void);
+uint64_t bench_random(uint64_t *);
+void     bench_shuffle(int64_t *, size_t, uint64_t *);
+uint64_t bench_arg(int, char *[], int, uint64_t);
+void     bench_report(const char *, const char *, uint64_t, uint64_t);
+size_t   bench_heap_bytes(void);
+void     bench_report_memory(const char *, size_t, uint64_t);
+
+int      bench_trees(int, char *[]);
+int      bench_freeze(int, char *[]);
+int      bench_snapshot(int, char *[]);
+int      bench_typed(int, char *[]);
+int      bench_locks(int, char *[]);
+int      bench_rwlock(int, char *[]);
+int      bench_ring(int, char *[]);
+int      bench_ncurs(int, char *[]);
+int      bench_pool(int, char *[]);
+int      bench_binlog(int, char *[]);
+int      bench_text(int, char *[]);
+int      bench_memory(int, char *[]);
+
+#endif // __BENCH_H__
@@ -0,0 +1,39 @@
+#ifndef __BINLOG_H__
+#define __BINLOG_H__
+
+#include "common.h"
+
+#define BINLOG_MAGIC "SBXLOG1"
+#define BINLOG_TEXT (36)
+
+// Starts every log file, see logdump for reading one back.
+typedef struct binlog_header_t
+{
+  char magic[8];
+  uint32_t record_size;
+  uint32_t reserved;
+} binlog_header;
+
+// One log line as it is written to the file. time_nsec is CLOCK_REALTIME,
+// thread the order in which the thread first logged and text the message,
+// cut to fit and not terminated when it fills the field.
+typedef struct binlog_record_t
+{
+  uint64_t time_nsec;
+  uint64_t values[2];
+  uint32_t thread;
+  char text[BINLOG_TEXT];
+} binlog_record;
+
+// Binary log written in the background. Each thread appends records to a
+// lock-free buffer of its own, which a flusher thread empties into the file
+// a few times a second, so binlog_write costs a copy and no system call.
+// A full buffer drops the record and counts it. While no log is open,
+// binlog_write returns straight away.
+bool     binlog_open(const char *path);
+void     binlog_close(void);
+void     binlog_write(const char *message, uint64_t first, uint64_t second);
+void     binlog_flush(void);
+uint64_t binlog_dropped(void);
+
+#endif // __BINLOG_H__
@@ -0,0 +1,23 @@
+#ifndef __BPT_H__
+#define __BPT_H__
+
+#include "common.h"
+
+// Keys per node. 32 keys keep the key array at four cache lines, which the
+// in-node search scans in a handful of vector compares.
+#define BPTREE_NODE_KEYS (32)
+
+typedef struct bpt_tree_t bpt_tree;
+
+// Same contract as the rbt_* functions: an empty tree is NULL and the
+// modifying calls return the tree to use from then on.
+void *     bpt_get(bpt_tree *, int64_t);
+bpt_tree * bpt_put(bpt_tree *, int64_t, void *, size_t, void **);
+bpt_tree * bpt_remove(bpt_tree *, int64_t, void **);
+size_t     bpt_size(bpt_tree *);
+size_t     bpt_data_size(bpt_tree *, int64_t);
+size_t     bpt_range(bpt_tree *, int64_t, int64_t,
+                     bool (*)(int64_t, void *, Pointer), Pointer);
+void       bpt_free(bpt_tree *, void (*)(void *));
+
+#endif // __BPT_H__
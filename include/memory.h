@@ -15,6 +15,7 @@ typedef enum gc_error_e
 bool     gc_init(uint32_t, uint32_t);
 uint64_t gc_alloc(size_t);
 Pointer  gc_data(uint64_t);
+uint64_t gc_id(Pointer);
 bool     gc_free(uint64_t);
 bool     gc_destroy(void);
 
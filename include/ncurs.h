@@ -2,16 +2,147 @@
 #define __NCURS_H__
 
 #include "common.h"
+#include "pool.h"
 
 #include <ncurses.h>
+#include <wchar.h>
 
-uint32_t ncurs_convert_string(chtype *output, char *input, uint32_t length);
+// ncurs_coalesce flags. Keys drops a key that repeats the one before it in
+// the same batch, resize handles any number of SIGWINCH once per frame.
+#define NCURS_COALESCE_KEYS (1U)
+#define NCURS_COALESCE_RESIZE (2U)
+
+// Frame times in nanoseconds. missed counts frame deadlines that passed
+// before the previous frame was done, dropped_steps the fixed steps that
+// did not fit in a frame's max_steps. Latency runs from a key arriving to
+// the end of the frame that drew after it, inputs counts those frames.
+// Update time is the work of the frame itself, keys, update_f and drawing.
+typedef struct ncurs_frame_stats_t
+{
+  uint64_t frames;
+  uint64_t missed;
+  uint64_t dropped_steps;
+  uint64_t min_nsec;
+  uint64_t max_nsec;
+  uint64_t mean_nsec;
+  uint64_t p99_nsec;
+  uint64_t total_nsec;
+  uint64_t inputs;
+  uint64_t latency_mean_nsec;
+  uint64_t latency_max_nsec;
+  uint64_t latency_total_nsec;
+  uint64_t update_mean_nsec;
+  uint64_t update_max_nsec;
+  uint64_t update_total_nsec;
+} ncurs_frame_stats;
+
+// Both stop at the first NUL or once length characters are out, and end
+// the output with a NUL when there is room for one. ncurs_convert_utf8
+// turns each invalid byte into U+FFFD.
+uint32_t ncurs_convert_string(chtype *output, const char *input,
+                              uint32_t length);
+uint32_t ncurs_convert_utf8(wchar_t *output, const char *input,
+                            uint32_t length);
+
+// Writes at most bytes of UTF-8 text, less if it ends sooner, to the
+// process window at y, x, wrapping at its edge. Only from the loop thread,
+// in update_f or a timer. Returns how many characters went on the window,
+// -1 when none could.
+int32_t  ncurs_write(uint32_t id, int32_t y, int32_t x, const char *text,
+                     size_t bytes);
 void     ncurs_quit(uint32_t id);
+
+// Hands keys to the process as if typed, from one thread other than its
+// own at a time. Returns how many fit, the rest are dropped and counted.
+// Safe to call while the process shuts down, ncurs_wait waits for pushes
+// in progress and later ones return 0.
+uint32_t ncurs_push_keys(uint32_t id, const chtype *keys, uint32_t count);
+uint64_t ncurs_dropped_keys(uint32_t id);
+
+// Hands the keys to handle_keys_f in one call per frame, just before
+// update_f, instead of to handle_key_f as each one arrives. NULL goes back
+// to handle_key_f, and keys already held go to it one at a time.
+bool     ncurs_key_batch(uint32_t id,
+                         void (*handle_keys_f)(const chtype *, uint32_t,
+                                               Pointer),
+                         Pointer keys_data);
+bool     ncurs_coalesce(uint32_t id, uint32_t flags);
+
+// Without damage tracking every frame starts from an erased window. With
+// it the window keeps what the last frame drew and update_f passes what it
+// is about to redraw to ncurs_damage, which blanks it. ncurs_redraw_all
+// tells update_f when it has to draw everything, as on the first frame and
+// after a resize.
+bool     ncurs_track_damage(uint32_t id, bool enabled);
+bool     ncurs_redraw_all(uint32_t id);
+void     ncurs_damage(uint32_t id, int32_t y, int32_t x, int32_t height,
+                      int32_t width);
+
+// Frames run at 60 per second by default, 0 runs them back to back, and
+// update_f gets the time since the last frame. A fixed step of step_nsec
+// makes it get that instead, once per step passed but at most max_steps
+// times a frame. A step of 0 goes back to the variable step.
+bool     ncurs_frame_rate(uint32_t id, uint32_t per_second);
+bool     ncurs_fixed_step(uint32_t id, uint64_t step_nsec, uint32_t max_steps);
+
+// On demand, frames only run after input, a resize, a timer coming due or
+// ncurs_redraw, at most at the frame rate, and an idle process does not
+// wake at all. update_f still gets the time that passed while idle, and
+// calls ncurs_redraw to keep animating. A replay runs frames as usual
+// until it ends.
+bool     ncurs_on_demand(uint32_t id, bool enabled);
+bool     ncurs_redraw(uint32_t id);
+bool     ncurs_frame_stats_get(uint32_t id, ncurs_frame_stats *stats);
+
+// Calls callback_f on the loop thread once delay_nsec has passed, and with
+// ncurs_repeat every period_nsec after that until cancelled. Timers that
+// are due together run in one batch, earliest first, at the start of the
+// next frame that calls update_f, after the window is erased and before
+// update_f, so they may draw like it does. Returns a handle for
+// ncurs_cancel, 0 when the process is not running.
+uint64_t ncurs_schedule(uint32_t id, uint64_t delay_nsec,
+                        void (*callback_f)(Pointer), Pointer data);
+uint64_t ncurs_repeat(uint32_t id, uint64_t delay_nsec, uint64_t period_nsec,
+                      void (*callback_f)(Pointer), Pointer data);
+bool     ncurs_cancel(uint32_t id, uint64_t timer);
+
+// Records every key the process gets from now on to path, with the time
+// and frame it came in, until NULL is passed or the process ends. A replay
+// feeds a recording back in as if typed, speed times as fast as it was
+// recorded or with 0 in the same frames it was, and writes the frame
+// number, update time in nanoseconds and keys of each frame to report_path
+// when there is one, so that two builds' reports can be diffed. It ends
+// with the frame that gets the last key.
+bool     ncurs_record(uint32_t id, const char *path);
+bool     ncurs_replay(uint32_t id, const char *path, uint32_t speed,
+                      const char *report_path);
+bool     ncurs_replaying(uint32_t id);
+
+// Only one process may be live at a time, either kind. Starting another
+// before ncurs_wait has returned for the last one returns 0.
 uint32_t ncurs_start(void (*update_f)(struct timespec *, Pointer),
                      Pointer update_data,
                      void (*handle_key_f)(chtype, Pointer),
                      Pointer keyhandler_data);
+
+// Draws into an in-memory screen of the given size instead of the
+// terminal, for benchmarks and runs without a TTY. Keys only come from
+// ncurs_push_keys, the window reads back with the usual winch calls.
+uint32_t ncurs_start_headless(void (*update_f)(struct timespec *, Pointer),
+                              Pointer update_data,
+                              void (*handle_key_f)(chtype, Pointer),
+                              Pointer keyhandler_data,
+                              int32_t rows, int32_t columns);
+
+// Joins the event loop and frees what the process held. Its frame stats
+// stay readable until its slot goes to a later process.
 void     ncurs_wait(uint32_t id);
 WINDOW * ncurs_window(uint32_t id);
 
+// Threads for update_f to spread a frame's work over with pool_for or
+// pool_submit and pool_wait. The loop thread helps while it waits, so the
+// pool has one worker fewer than there are CPUs. Curses is not thread
+// safe, only the loop thread may draw.
+pool *   ncurs_pool(uint32_t id);
+
 #endif // __NCURS_H__
@@ -0,0 +1,42 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include "common.h"
+
+#include <stdatomic.h>
+
+#define POOL_GROUP_INITIALIZER { 0U }
+
+typedef struct pool_t pool;
+
+// Counts the tasks submitted under it that have not finished yet, for
+// pool_wait to join on.
+typedef struct pool_group_t
+{
+  _Atomic uint32_t pending;
+} pool_group;
+
+// Work-stealing thread pool. Each worker keeps its own deque of tasks and
+// takes from the others' when it runs dry. Tasks submitted from outside the
+// pool go through a shared queue. A pool of 0 workers gets one for every
+// CPU but the caller's, and works even with none: pool_wait runs whatever
+// is left on the waiting thread.
+pool *   pool_create(uint32_t);
+void     pool_destroy(pool *);
+uint32_t pool_workers(pool *);
+
+// Runs the task on some thread of the pool, or right away on this one when
+// the queues are full. The group may be NULL for tasks nobody waits for.
+void     pool_submit(pool *, pool_group *, void (*)(Pointer), Pointer);
+
+// Runs tasks until every one in the group is done, so a task may wait on
+// the tasks it submits.
+void     pool_wait(pool *, pool_group *);
+
+// Calls the function on [begin, end) slices of [0, count) of at most grain
+// indices each and returns once all of them are done. A grain of 0 picks
+// four slices per thread.
+void     pool_for(pool *, size_t, size_t,
+                  void (*)(size_t, size_t, Pointer), Pointer);
+
+#endif // __POOL_H__
@@ -0,0 +1,39 @@
+#ifndef __PRBT_H__
+#define __PRBT_H__
+
+#include "common.h"
+
+// Readers that can be registered with one tree at the same time.
+#define PRBTREE_MAX_READERS (64)
+
+typedef struct prbt_node_t prbt_node;
+typedef struct prbt_tree_t prbt_tree;
+
+// Persistent (path-copying) red-black tree. Updates never touch a node that
+// a published root can reach, they copy the path and swap the root, so
+// readers work on a snapshot without taking any lock. Replaced roots and
+// values are freed once every reader has left the epoch that could see them.
+prbt_tree * prbt_create(void (*)(void *));
+void        prbt_destroy(prbt_tree *);
+
+// Writers, serialised against each other by the tree.
+bool        prbt_put(prbt_tree *, int64_t, void *, size_t);
+bool        prbt_remove(prbt_tree *, int64_t);
+void        prbt_reclaim(prbt_tree *);
+
+// Readers register once per thread and bracket every use of a snapshot
+// with read_begin/read_end. Registering returns -1 when all
+// PRBTREE_MAX_READERS slots are taken, read_begin then returns NULL.
+int32_t     prbt_reader_register(prbt_tree *);
+void        prbt_reader_unregister(prbt_tree *, int32_t);
+prbt_node * prbt_read_begin(prbt_tree *, int32_t);
+void        prbt_read_end(prbt_tree *, int32_t);
+
+// Queries on a snapshot root.
+void *      prbt_get(prbt_node *, int64_t);
+size_t      prbt_data_size(prbt_node *, int64_t);
+size_t      prbt_size(prbt_node *);
+size_t      prbt_range(prbt_node *, int64_t, int64_t,
+                       bool (*)(int64_t, void *, Pointer), Pointer);
+
+#endif // __PRBT_H__
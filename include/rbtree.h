@@ -5,9 +5,36 @@
 
 #define RBTREE_NULL_KEY (INT64_MIN)
 
+// A left-leaning red-black tree is at most 2 * log2(n + 1) deep, so this
+// covers any tree that fits in a 64-bit address space.
+#define RBTREE_MAX_DEPTH (128)
+
 typedef enum colour_e colour;
 typedef struct rbt_node_t rbt_node;
 
+// A tree instance whose nodes live in one growable array and link to each
+// other by 32-bit index, for large trees where rbt_node's pointers and
+// per-node malloc dominate the memory use.
+typedef struct rbt_pool_t rbt_pool;
+
+// Read-only copy of a tree laid out for searching, see rbt_freeze.
+typedef struct rbt_frozen_t rbt_frozen;
+
+// Tree of closed intervals [lo, hi] that keeps the largest endpoint of every
+// subtree, for overlap queries. An empty tree is NULL, as with rbt_node.
+typedef struct rbt_interval_t rbt_interval;
+
+// Walks the keys of [lo, hi] without allocating. The cursor stays valid for
+// as long as the tree is not modified.
+typedef struct rbt_cursor_t
+{
+  rbt_node *stack[RBTREE_MAX_DEPTH];
+  uint32_t depth;
+  bool reverse;
+  int64_t lo;
+  int64_t hi;
+} rbt_cursor;
+
 void *     rbt_get(rbt_node *, int64_t);
 size_t     rbt_get_all(rbt_node *, void ***, int64_t **);
 rbt_node * rbt_get_first(rbt_node *, int64_t *, void **);
@@ -20,4 +47,61 @@ size_t     rbt_size(rbt_node *);
 size_t     rbt_data_size(rbt_node *, int64_t);
 void       rbt_free(rbt_node *, void (*)(void *));
 
+rbt_node * rbt_build_sorted(const int64_t *, void **, const size_t *, size_t);
+size_t     rbt_export(rbt_node *, int64_t *, void **, size_t *, size_t);
+
+// Split and join cost O(log n). rbt_split returns the keys below the given
+// one and stores the rest in the out-parameter. rbt_join expects every key
+// of the first tree below every key of the second and falls back to a union
+// otherwise, which passes the values it drops to data_free.
+rbt_node * rbt_split(rbt_node *, int64_t, rbt_node **);
+rbt_node * rbt_join(rbt_node *, rbt_node *, void (*)(void *));
+
+// Both trees are consumed. Where a key is in both the first tree's value is
+// kept, every value that is dropped goes to data_free, which large inputs
+// may call from several threads at once.
+rbt_node * rbt_union(rbt_node *, rbt_node *, void (*)(void *));
+rbt_node * rbt_intersection(rbt_node *, rbt_node *, void (*)(void *));
+rbt_node * rbt_difference(rbt_node *, rbt_node *, void (*)(void *));
+
+// Removes every key of [lo, hi] in O(log n + k), passing the values to
+// data_free.
+rbt_node * rbt_remove_range(rbt_node *, int64_t, int64_t, void (*)(void *));
+
+rbt_frozen * rbt_freeze(rbt_node *);
+void *       rbt_frozen_get(rbt_frozen *, int64_t);
+size_t       rbt_frozen_data_size(rbt_frozen *, int64_t);
+size_t       rbt_frozen_size(rbt_frozen *);
+void         rbt_frozen_free(rbt_frozen *);
+
+size_t     rbt_range(rbt_node *, int64_t, int64_t,
+                     bool (*)(int64_t, void *, Pointer), Pointer);
+size_t     rbt_range_reverse(rbt_node *, int64_t, int64_t,
+                             bool (*)(int64_t, void *, Pointer), Pointer);
+void       rbt_cursor_init(rbt_cursor *, rbt_node *, int64_t, int64_t);
+void       rbt_cursor_init_reverse(rbt_cursor *, rbt_node *, int64_t, int64_t);
+rbt_node * rbt_cursor_next(rbt_cursor *, int64_t *, void **);
+
+void *         rbt_interval_get(rbt_interval *, int64_t, int64_t);
+rbt_interval * rbt_interval_put(rbt_interval *, int64_t, int64_t, void *,
+                                void **);
+rbt_interval * rbt_interval_remove(rbt_interval *, int64_t, int64_t,
+                                   void **);
+size_t         rbt_interval_size(rbt_interval *);
+size_t         rbt_overlaps(rbt_interval *, int64_t, int64_t,
+                            bool (*)(int64_t, int64_t, void *, Pointer),
+                            Pointer);
+void           rbt_interval_free(rbt_interval *, void (*)(void *));
+
+rbt_pool * rbt_pool_create(uint32_t);
+void *     rbt_pool_get(rbt_pool *, int64_t);
+bool       rbt_pool_put(rbt_pool *, int64_t, void *, size_t, void **);
+bool       rbt_pool_remove(rbt_pool *, int64_t, void **);
+size_t     rbt_pool_size(rbt_pool *);
+size_t     rbt_pool_data_size(rbt_pool *, int64_t);
+size_t     rbt_pool_memory(rbt_pool *);
+size_t     rbt_pool_range(rbt_pool *, int64_t, int64_t,
+                          bool (*)(int64_t, void *, Pointer), Pointer);
+void       rbt_pool_free(rbt_pool *, void (*)(void *));
+
 #endif // __RBT_H__
@@ -0,0 +1,335 @@
+#ifndef __RBTREE_GEN_H__
+#define __RBTREE_GEN_H__
+
+#include "common.h"
+#include "rbtree.h"
+
+// Generates a left-leaning red-black tree for one key and value type. The
+// key comparison and the value are compiled into the nodes instead of going
+// through int64_t keys and void pointers.
+//
+// RBTREE_GEN_DECLARE goes in a header and RBTREE_GEN_DEFINE in exactly one
+// source file. compare(a, b) is a function or macro that returns a negative
+// number, zero or a positive number as a orders before, with or after b.
+// Testing for equality first, as in (a == b ? 0 : (a < b ? -1 : 1)), lets
+// the compiler turn the search into the same loop as rbt_get's for integer
+// keys. The -1/0/1 ternary the other way round costs about twice as much
+// per lookup.
+//
+// put and remove write to their out-parameters only when the key was in the
+// tree. put then keeps the key it already holds and replaces only the
+// value, old_key gets the held key, so a key passed in that did not go in
+// is the caller's again. remove hands back the key and the value it took
+// out. Pointers returned by find stay valid until the next put or remove.
+// The tree does not own its keys, entry_free in free gets each key and
+// value to release.
+
+#define RBTREE_GEN_DECLARE(prefix, key_t, value_t)                            \
+  typedef struct prefix##_node_t prefix##_node;                               \
+                                                                              \
+  bool            prefix##_get(prefix##_node *, key_t, value_t *);            \
+  value_t *       prefix##_find(prefix##_node *, key_t);                      \
+  prefix##_node * prefix##_put(prefix##_node *, key_t, value_t, key_t *,      \
+                               value_t *);                                    \
+  prefix##_node * prefix##_remove(prefix##_node *, key_t, key_t *, value_t *);\
+  size_t          prefix##_size(prefix##_node *);                             \
+  size_t          prefix##_range(prefix##_node *, key_t, key_t,               \
+                                 bool (*)(key_t, value_t *, Pointer),         \
+                                 Pointer);                                    \
+  void            prefix##_free(prefix##_node *, void (*)(key_t, value_t));
+
+#define RBTREE_GEN_DEFINE(prefix, key_t, value_t, compare)                    \
+  struct prefix##_node_t                                                      \
+  {                                                                           \
+    struct prefix##_node_t *left;                                             \
+    struct prefix##_node_t *right;                                            \
+    key_t key;                                                                \
+    value_t value;                                                            \
+    uint64_t size;                                                            \
+    bool red;                                                                 \
+  };                                                                          \
+                                                                              \
+  static inline bool prefix##_is_red(prefix##_node *node)                     \
+  {                                                                           \
+    return (node && node->red);                                               \
+  }                                                                           \
+                                                                              \
+  static inline uint64_t prefix##_count(prefix##_node *node)                  \
+  {                                                                           \
+    return node ? node->size : 0;                                             \
+  }                                                                           \
+                                                                              \
+  static prefix##_node * prefix##_search(prefix##_node *root, key_t key)      \
+  {                                                                           \
+    prefix##_node *n = root;                                                  \
+    int order = 0;                                                            \
+    while (n)                                                                 \
+    {                                                                         \
+      order = compare(key, n->key);                                           \
+      if (order == 0)                                                         \
+        break;                                                                \
+      n = (order < 0 ? n->left : n->right);                                   \
+    }                                                                         \
+    return n;                                                                 \
+  }                                                                           \
+                                                                              \
+  static void prefix##_flip_colours(prefix##_node *node)                      \
+  {                                                                           \
+    node->red = !node->red;                                                   \
+    if (node->left)                                                           \
+      node->left->red = !node->left->red;                                     \
+    if (node->right)                                                          \
+      node->right->red = !node->right->red;                                   \
+  }                                                                           \
+                                                                              \
+  static prefix##_node * prefix##_rotate_left(prefix##_node *node)            \
+  {                                                                           \
+    prefix##_node *old = node->right;                                         \
+    node->right = old->left;                                                  \
+    old->left = node;                                                         \
+    old->red = node->red;                                                     \
+    node->red = true;                                                         \
+    old->size = node->size;                                                   \
+    node->size = prefix##_count(node->left) + prefix##_count(node->right) + 1;\
+    return old;                                                               \
+  }                                                                           \
+                                                                              \
+  static prefix##_node * prefix##_rotate_right(prefix##_node *node)           \
+  {                                                                           \
+    prefix##_node *old = node->left;                                          \
+    node->left = old->right;                                                  \
+    old->right = node;                                                        \
+    old->red = node->red;                                                     \
+    node->red = true;                                                         \
+    old->size = node->size;                                                   \
+    node->size = prefix##_count(node->left) + prefix##_count(node->right) + 1;\
+    return old;                                                               \
+  }                                                                           \
+                                                                              \
+  static prefix##_node * prefix##_balance(prefix##_node *node)                \
+  {                                                                           \
+    if (prefix##_is_red(node->right) && !prefix##_is_red(node->left))         \
+      node = prefix##_rotate_left(node);                                      \
+    if (prefix##_is_red(node->left) && prefix##_is_red(node->left->left))     \
+      node = prefix##_rotate_right(node);                                     \
+    if (prefix##_is_red(node->left) && prefix##_is_red(node->right))          \
+      prefix##_flip_colours(node);                                            \
+    node->size = prefix##_count(node->left) + prefix##_count(node->right) + 1;\
+    return node;                                                              \
+  }                                                                           \
+                                                                              \
+  static prefix##_node * prefix##_move_red_left(prefix##_node *node)          \
+  {                                                                           \
+    prefix##_flip_colours(node);                                              \
+    if (node->right && prefix##_is_red(node->right->left))                    \
+    {                                                                         \
+      node->right = prefix##_rotate_right(node->right);                       \
+      node = prefix##_rotate_left(node);                                      \
+      prefix##_flip_colours(node);                                            \
+    }                                                                         \
+    return node;                                                              \
+  }                                                                           \
+                                                                              \
+  static prefix##_node * prefix##_move_red_right(prefix##_node *node)         \
+  {                                                                           \
+    prefix##_flip_colours(node);                                              \
+    if (node->left && prefix##_is_red(node->left->left))                      \
+    {                                                                         \
+      node = prefix##_rotate_right(node);                                     \
+      prefix##_flip_colours(node);                                            \
+    }                                                                         \
+    return node;                                                              \
+  }                                                                           \
+                                                                              \
+  static prefix##_node * prefix##_put_node(prefix##_node *node, key_t key,    \
+                                           value_t value, key_t *old_key,     \
+                                           value_t *old_value)                \
+  {                                                                           \
+    int order = 0;                                                            \
+    if (!node)                                                                \
+    {                                                                         \
+      node = (prefix##_node *)malloc(sizeof(prefix##_node));                  \
+      node->left = NULL;                                                      \
+      node->right = NULL;                                                     \
+      node->key = key;                                                        \
+      node->value = value;                                                    \
+      node->size = 1;                                                         \
+      node->red = true;                                                       \
+      return node;                                                            \
+    }                                                                         \
+                                                                              \
+    order = compare(key, node->key);                                          \
+    if (order < 0)                                                            \
+    {                                                                         \
+      node->left = prefix##_put_node(node->left, key, value, old_key,         \
+                                     old_value);                              \
+    }                                                                         \
+    else if (0 < order)                                                       \
+    {                                                                         \
+      node->right = prefix##_put_node(node->right, key, value, old_key,       \
+                                      old_value);                             \
+    }                                                                         \
+    else                                                                      \
+    {                                                                         \
+      if (old_key)                                                            \
+        (*old_key) = node->key;                                               \
+      if (old_value)                                                          \
+        (*old_value) = node->value;                                           \
+      node->value = value;                                                    \
+    }                                                                         \
+    return prefix##_balance(node);                                            \
+  }                                                                           \
+                                                                              \
+  static prefix##_node * prefix##_remove_first(prefix##_node *node,           \
+                                               prefix##_node *into)           \
+  {                                                                           \
+    if (!node->left)                                                          \
+    {                                                                         \
+      into->key = node->key;                                                  \
+      into->value = node->value;                                              \
+      free(node);                                                             \
+      return NULL;                                                            \
+    }                                                                         \
+                                                                              \
+    if (!prefix##_is_red(node->left) && !prefix##_is_red(node->left->left))   \
+      node = prefix##_move_red_left(node);                                    \
+    node->left = prefix##_remove_first(node->left, into);                     \
+    return prefix##_balance(node);                                            \
+  }                                                                           \
+                                                                              \
+  static prefix##_node * prefix##_remove_node(prefix##_node *node, key_t key, \
+                                              key_t *old_key, value_t *value) \
+  {                                                                           \
+    if (compare(key, node->key) < 0)                                          \
+    {                                                                         \
+      if (!prefix##_is_red(node->left) && !prefix##_is_red(node->left->left)) \
+        node = prefix##_move_red_left(node);                                  \
+      node->left = prefix##_remove_node(node->left, key, old_key, value);     \
+    }                                                                         \
+    else                                                                      \
+    {                                                                         \
+      if (prefix##_is_red(node->left))                                        \
+        node = prefix##_rotate_right(node);                                   \
+                                                                              \
+      if (compare(key, node->key) == 0 && !node->right)                       \
+      {                                                                       \
+        if (old_key)                                                          \
+          (*old_key) = node->key;                                             \
+        if (value)                                                            \
+          (*value) = node->value;                                             \
+        free(node);                                                           \
+        return NULL;                                                          \
+      }                                                                       \
+                                                                              \
+      if (!prefix##_is_red(node->right) &&                                    \
+        !prefix##_is_red(node->right->left))                                  \
+        node = prefix##_move_red_right(node);                                 \
+                                                                              \
+      if (compare(key, node->key) == 0)                                       \
+      {                                                                       \
+        if (old_key)                                                          \
+          (*old_key) = node->key;                                             \
+        if (value)                                                            \
+          (*value) = node->value;                                             \
+        node->right = prefix##_remove_first(node->right, node);               \
+      }                                                                       \
+      else                                                                    \
+      {                                                                       \
+        node->right = prefix##_remove_node(node->right, key, old_key, value); \
+      }                                                                       \
+    }                                                                         \
+    return prefix##_balance(node);                                            \
+  }                                                                           \
+                                                                              \
+  bool prefix##_get(prefix##_node *root, key_t key, value_t *value)           \
+  {                                                                           \
+    prefix##_node *n = prefix##_search(root, key);                            \
+    if (n && value)                                                           \
+      (*value) = n->value;                                                    \
+    return (n != NULL);                                                       \
+  }                                                                           \
+                                                                              \
+  value_t * prefix##_find(prefix##_node *root, key_t key)                     \
+  {                                                                           \
+    prefix##_node *n = prefix##_search(root, key);                            \
+    return n ? &(n->value) : NULL;                                            \
+  }                                                                           \
+                                                                              \
+  prefix##_node * prefix##_put(prefix##_node *root, key_t key, value_t value, \
+                               key_t *old_key, value_t *old_value)            \
+  {                                                                           \
+    prefix##_node *r = prefix##_put_node(root, key, value, old_key,           \
+                                         old_value);                          \
+    r->red = false;                                                           \
+    return r;                                                                 \
+  }                                                                           \
+                                                                              \
+  prefix##_node * prefix##_remove(prefix##_node *root, key_t key,             \
+                                  key_t *old_key, value_t *value)             \
+  {                                                                           \
+    prefix##_node *r = root;                                                  \
+    if (prefix##_search(root, key))                                           \
+    {                                                                         \
+      if (!prefix##_is_red(r->left) && !prefix##_is_red(r->right))            \
+        r->red = true;                                                        \
+      r = prefix##_remove_node(r, key, old_key, value);                       \
+      if (r)                                                                  \
+        r->red = false;                                                       \
+    }                                                                         \
+    return r;                                                                 \
+  }                                                                           \
+                                                                              \
+  size_t prefix##_size(prefix##_node *root)                                   \
+  {                                                                           \
+    return prefix##_count(root);                                              \
+  }                                                                           \
+                                                                              \
+  size_t prefix##_range(prefix##_node *root, key_t lo, key_t hi,              \
+                        bool (*callback)(key_t, value_t *, Pointer),          \
+                        Pointer ctx)                                          \
+  {                                                                           \
+    prefix##_node *stack[RBTREE_MAX_DEPTH];                                   \
+    prefix##_node *n = root;                                                  \
+    uint32_t depth = 0;                                                       \
+    size_t count = 0;                                                         \
+    if (compare(hi, lo) < 0)                                                  \
+      return 0;                                                               \
+                                                                              \
+    for (;;)                                                                  \
+    {                                                                         \
+      while (n)                                                               \
+      {                                                                       \
+        if (compare(n->key, lo) < 0)                                          \
+        {                                                                     \
+          n = n->right;                                                       \
+          continue;                                                           \
+        }                                                                     \
+        stack[depth++] = n;                                                   \
+        n = n->left;                                                          \
+      }                                                                       \
+      if (depth == 0)                                                         \
+        break;                                                                \
+                                                                              \
+      n = stack[--depth];                                                     \
+      if (compare(hi, n->key) < 0)                                            \
+        break;                                                                \
+      count += 1;                                                             \
+      if (callback && !callback(n->key, &(n->value), ctx))                    \
+        break;                                                                \
+      n = n->right;                                                           \
+    }                                                                         \
+    return count;                                                             \
+  }                                                                           \
+                                                                              \
+  void prefix##_free(prefix##_node *root, void (*entry_free)(key_t, value_t)) \
+  {                                                                           \
+    if (!root)                                                                \
+      return;                                                                 \
+    prefix##_free(root->left, entry_free);                                    \
+    prefix##_free(root->right, entry_free);                                   \
+    if (entry_free)                                                           \
+      entry_free(root->key, root->value);                                     \
+    free(root);                                                               \
+  }
+
+#endif // __RBTREE_GEN_H__
@@ -0,0 +1,22 @@
+#ifndef __RBTREE_TYPED_H__
+#define __RBTREE_TYPED_H__
+
+#include "rbtree_gen.h"
+
+// Composite key ordered by first, then by second.
+typedef struct rbt_pair_t
+{
+  int64_t first;
+  int64_t second;
+} rbt_pair;
+
+// String keys in strcmp order. The tree keeps the caller's pointers.
+RBTREE_GEN_DECLARE(rbs, const char *, void *)
+
+// Double keys in numeric order. NaN has no place in that order, do not use
+// it as a key.
+RBTREE_GEN_DECLARE(rbd, double, void *)
+
+RBTREE_GEN_DECLARE(rbp, rbt_pair, void *)
+
+#endif // __RBTREE_TYPED_H__
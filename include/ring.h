@@ -0,0 +1,29 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include "common.h"
+
+typedef struct ring_t ring;
+
+// Bounded single-producer single-consumer queue of fixed-size elements. One
+// thread may push and one other thread may pop at the same time without any
+// lock. The capacity is rounded up to a power of two.
+ring *   ring_create(uint32_t, size_t);
+void     ring_destroy(ring *);
+
+// Producer side. A push that does not fit is dropped and counted, the batch
+// push returns how many of the elements went in.
+bool     ring_push(ring *, const void *);
+uint32_t ring_push_all(ring *, const void *, uint32_t);
+
+// Consumer side. The batch pop returns how many elements it copied out.
+bool     ring_pop(ring *, void *);
+uint32_t ring_pop_all(ring *, void *, uint32_t);
+
+// Safe from either side, the counts may be stale by the time they return.
+uint32_t ring_count(ring *);
+uint32_t ring_capacity(ring *);
+uint64_t ring_pushed(ring *);
+uint64_t ring_dropped(ring *);
+
+#endif // __RING_H__
@@ -3,8 +3,67 @@
 
 #include "common.h"
 
+#include <stdatomic.h>
+
+#ifdef _SANDBOX_LOCK_STATS
+// Wait and hold times go in buckets of powers of two nanoseconds, bucket i
+// counting [2^i, 2^(i+1)).
+#define LOCK_STATS_BUCKETS (40)
+
+#define LOCK_STATS_INITIALIZER , { 0 }
+
+// Every lock counts, but only the ones given a name are listed by
+// lock_stats_dump, and those have to outlive it. depth_max is the most
+// threads that were inside the lock call at once.
+typedef struct lock_stats_t
+{
+  const char *name;
+  struct lock_stats_t *next;
+  _Atomic bool registered;
+  _Atomic uint32_t depth;
+  _Atomic uint32_t depth_max;
+  _Atomic uint64_t acquired;
+  _Atomic uint64_t contended;
+  _Atomic uint64_t wait_total;
+  _Atomic uint64_t hold_total;
+  _Atomic uint64_t wait[LOCK_STATS_BUCKETS];
+  _Atomic uint64_t hold[LOCK_STATS_BUCKETS];
+  uint64_t held_since;
+} lock_stats;
+#else
+#define LOCK_STATS_INITIALIZER
+#endif // _SANDBOX_LOCK_STATS
+
+// A timed lock that gives up while others queue behind it leaves its ticket
+// here, one past its number, for the unlocker to skip. With the table full
+// it keeps waiting past its deadline instead.
+#define TICKET_ABANDONED (8)
+
+#ifdef __linux__
+
+// Waiters park on the futex word of their ticket's slot, so an unlock only
+// wakes the waiters whose ticket shares the slot with the next one.
+#define TICKET_SLOTS (4)
+
+#define TICKET_MUTEX_INITIALIZER                                \
+  { 0UL, 0UL, 0U, { 0U }, 0U, { 0UL } LOCK_STATS_INITIALIZER }
+
+typedef struct ticket_mutex_t
+{
+  _Atomic uint64_t queue_head;
+  _Atomic uint64_t queue_tail;
+  _Atomic uint32_t parked;
+  _Atomic uint32_t slots[TICKET_SLOTS];
+  _Atomic uint32_t abandoned_count;
+  _Atomic uint64_t abandoned[TICKET_ABANDONED];
+#ifdef _SANDBOX_LOCK_STATS
+  lock_stats stats;
+#endif // _SANDBOX_LOCK_STATS
+} ticket_mutex;
+#else
 #define TICKET_MUTEX_INITIALIZER                                \
-  { PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 0UL, 0UL, 0UL }
+  { PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 0UL, 0UL, 0UL, \
+    { 0UL } LOCK_STATS_INITIALIZER }
 
 typedef struct ticket_mutex_t
 {
@@ -13,10 +72,91 @@ typedef struct ticket_mutex_t
   uint64_t queue_head;
   uint64_t queue_tail;
   uint64_t queue_length;
+  uint64_t abandoned[TICKET_ABANDONED];
+#ifdef _SANDBOX_LOCK_STATS
+  lock_stats stats;
+#endif // _SANDBOX_LOCK_STATS
 } ticket_mutex;
+#endif // __linux__
 
+// Queue lock where every waiter spins on, and then parks on, its own node
+// instead of the shared ticket counters. The nodes come from a small pool
+// per thread, so one thread can hold up to MCS_THREAD_NODES at once.
+#define MCS_THREAD_NODES (8)
+
+#define MCS_MUTEX_INITIALIZER { NULL, NULL LOCK_STATS_INITIALIZER }
+
+typedef struct mcs_node_t mcs_node;
+
+typedef struct mcs_mutex_t
+{
+  _Atomic(mcs_node *) tail;
+  mcs_node *owner;
+#ifdef _SANDBOX_LOCK_STATS
+  lock_stats stats;
+#endif // _SANDBOX_LOCK_STATS
+} mcs_mutex;
+
+// The locks that see heavy contention, memory's and the ncurs work queue's,
+// build against this so they can be switched over with _SANDBOX_MCS_LOCK.
+#ifdef _SANDBOX_MCS_LOCK
+#define SANDBOX_MUTEX_INITIALIZER MCS_MUTEX_INITIALIZER
+#define sandbox_lock              mcs_lock
+#define sandbox_trylock           mcs_trylock
+#define sandbox_unlock            mcs_unlock
+#define sandbox_name              mcs_name
+typedef mcs_mutex sandbox_mutex;
+#else
+#define SANDBOX_MUTEX_INITIALIZER TICKET_MUTEX_INITIALIZER
+#define sandbox_lock              ticket_lock
+#define sandbox_trylock           ticket_trylock
+#define sandbox_unlock            ticket_unlock
+#define sandbox_name              ticket_name
+typedef ticket_mutex sandbox_mutex;
+#endif // _SANDBOX_MCS_LOCK
+
+// Phase-fair reader-writer lock. Readers that arrive while a writer waits
+// run in one batch after it, and a writer only waits for the readers that
+// were already in, so neither side starves. Writers are ordered by their
+// sandbox_mutex. An uncontended read is a single atomic add each way.
+// Only the writers show up in the lock statistics.
+#define RW_TICKET_MUTEX_INITIALIZER                             \
+  { SANDBOX_MUTEX_INITIALIZER, 0U, 0U, 0U, 0U, 0U }
+
+typedef struct rw_ticket_mutex_t
+{
+  sandbox_mutex writers;
+  uint32_t phase;
+  _Atomic uint32_t readers_in;
+  _Atomic uint32_t readers_out;
+  _Atomic uint32_t parked;
+  _Atomic uint32_t wakeups;
+} rw_ticket_mutex;
+
+// Deadlines are absolute CLOCK_MONOTONIC times. The timed lock returns
+// false if the deadline passed first, leaving the queue order of everyone
+// else as it was.
 uint64_t ticket_lock(ticket_mutex *);
+bool     ticket_trylock(ticket_mutex *);
+bool     ticket_lock_until(ticket_mutex *, const struct timespec *);
 uint64_t ticket_unlock(ticket_mutex *);
 uint64_t ticket_locked(ticket_mutex *);
+void     ticket_name(ticket_mutex *, const char *);
+
+uint64_t mcs_lock(mcs_mutex *);
+bool     mcs_trylock(mcs_mutex *);
+uint64_t mcs_unlock(mcs_mutex *);
+uint64_t mcs_locked(mcs_mutex *);
+void     mcs_name(mcs_mutex *, const char *);
+
+void     rw_ticket_read_lock(rw_ticket_mutex *);
+void     rw_ticket_read_unlock(rw_ticket_mutex *);
+void     rw_ticket_write_lock(rw_ticket_mutex *);
+void     rw_ticket_write_unlock(rw_ticket_mutex *);
+void     rw_ticket_name(rw_ticket_mutex *, const char *);
+
+// Prints the named locks, most total wait time first. The naming functions
+// and this do nothing without _SANDBOX_LOCK_STATS.
+void     lock_stats_dump(FILE *);
 
 #endif // __TICKET_H__
@@ -0,0 +1,70 @@
+#include "bench.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif // __GLIBC__
+
+uint64_t bench_now()
+{
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*, deterministic between runs so results can be compared.
+uint64_t bench_random(uint64_t *state)
+{
+  uint64_t x = (*state);
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  (*state) = x;
+  return x * 0x2545F4914F6CDD1DUL;
+}
+
+void bench_shuffle(int64_t *array, size_t count, uint64_t *state)
+{
+  size_t i = 0;
+  for (i = count; 1 < i; i--)
+  {
+    size_t j = bench_random(state) % i;
+    int64_t tmp = array[i - 1];
+    array[i - 1] = array[j];
+    array[j] = tmp;
+  }
+}
+
+uint64_t bench_arg(int argc, char *argv[], int index, uint64_t fallback)
+{
+  if (index < argc)
+    return strtoull(argv[index], NULL, 10);
+  return fallback;
+}
+
+void bench_report(const char *suite, const char *name, uint64_t ops,
+                  uint64_t ns)
+{
+  printf("%-10s %-32s %12" PRIu64 " ops %10.2f ns/op %10.2f Mops/s\n",
+         suite, name, ops,
+         0 < ops ? (double)ns / (double)ops : 0.0,
+         0 < ns ? (double)ops * 1000.0 / (double)ns : 0.0);
+}
+
+// Bytes currently handed out by malloc, headers included. Zero where the
+// allocator cannot tell.
+size_t bench_heap_bytes()
+{
+#ifdef __GLIBC__
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif // __GLIBC__
+}
+
+void bench_report_memory(const char *suite, size_t bytes, uint64_t entries)
+{
+  printf("%-10s %-32s %12" PRIu64 " entries %8.2f bytes/entry\n",
+         suite, "memory", entries,
+         0 < entries ? (double)bytes / (double)entries : 0.0);
+}
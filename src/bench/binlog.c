@@ -0,0 +1,96 @@
+#include "bench.h"
+
+#include "binlog.h"
+
+#define MAX_THREADS (4)
+
+typedef struct binlog_thread_t
+{
+  pthread_t thread;
+  uint64_t count;
+  FILE *file;
+} BinlogThread;
+
+static void * write_binary(void *);
+static void * write_text(void *);
+static void   run(const char *, void * (*)(void *), uint32_t, uint64_t, FILE *);
+
+// --- Private ---
+
+void * write_binary(void *arg)
+{
+  BinlogThread *thread = (BinlogThread *)arg;
+  uint64_t i = 0;
+  for (i = 0; i < thread->count; i++)
+    binlog_write("bench record", i, thread->count);
+  return NULL;
+}
+
+// What ncurs writelog did: format, write and flush every line under a lock.
+void * write_text(void *arg)
+{
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  BinlogThread *thread = (BinlogThread *)arg;
+  char buffer[2048] = {0};
+  uint64_t i = 0;
+  for (i = 0; i < thread->count; i++)
+  {
+    pthread_mutex_lock(&lock);
+    sprintf(buffer, "LOG: bench record %" PRIu64 " %" PRIu64 "\n", i,
+            thread->count);
+    fputs(buffer, thread->file);
+    fflush(thread->file);
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+void run(const char *kind, void * (*writer)(void *), uint32_t threads,
+         uint64_t count, FILE *file)
+{
+  BinlogThread workers[MAX_THREADS];
+  uint64_t start = 0;
+  char name[64] = {0};
+  uint32_t i = 0;
+
+  memset(workers, 0, sizeof(workers));
+  start = bench_now();
+  for (i = 0; i < threads; i++)
+  {
+    workers[i].count = count / threads;
+    workers[i].file = file;
+    pthread_create(&(workers[i].thread), NULL, writer, workers + i);
+  }
+  for (i = 0; i < threads; i++)
+    pthread_join(workers[i].thread, NULL);
+
+  sprintf(name, "%s threads=%" PRIu32, kind, threads);
+  bench_report("binlog", name, count / threads * threads, bench_now() - start);
+}
+
+// --- Public ---
+
+// binlog [records]
+int bench_binlog(int argc, char *argv[])
+{
+  uint64_t count = bench_arg(argc, argv, 1, 200000UL);
+  FILE *text = fopen("/dev/null", "w");
+  uint32_t threads = 0;
+
+  if (!text || !binlog_open("/dev/null"))
+  {
+    if (text)
+      fclose(text);
+    return EXIT_FAILURE;
+  }
+  for (threads = 1; threads <= MAX_THREADS; threads *= 2)
+  {
+    run("binlog_write", &write_binary, threads, count, NULL);
+    run("fputs+fflush", &write_text, threads, count, text);
+  }
+  binlog_flush();
+  printf("binlog     dropped %" PRIu64 " records\n", binlog_dropped());
+  binlog_close();
+  fclose(text);
+  return EXIT_SUCCESS;
+}
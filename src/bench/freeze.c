@@ -0,0 +1,62 @@
+#include "bench.h"
+
+#include "rbtree.h"
+
+// Key counts whose key arrays land roughly in L1, L2, L3 and DRAM.
+static const size_t s_sizes[] = { 1024, 16384, 262144, 4194304, 8388608, 0 };
+
+static void bench_size(size_t, size_t, uint64_t *);
+
+// --- Private ---
+
+void bench_size(size_t count, size_t lookups, uint64_t *seed)
+{
+  int64_t *keys = (int64_t *)calloc(count, sizeof(int64_t));
+  int64_t *queries = (int64_t *)calloc(lookups, sizeof(int64_t));
+  rbt_node *root = NULL;
+  rbt_frozen *frozen = NULL;
+  uint64_t start = 0, sum = 0;
+  char name[64] = {0};
+  size_t i = 0;
+
+  for (i = 0; i < count; i++)
+    keys[i] = (int64_t)(i * 8 + 1);
+  for (i = 0; i < lookups; i++)
+    queries[i] = keys[bench_random(seed) % count];
+
+  root = rbt_build_sorted(keys, NULL, NULL, count);
+  frozen = rbt_freeze(root);
+
+  start = bench_now();
+  for (i = 0; i < lookups; i++)
+    sum += rbt_data_size(root, queries[i]);
+  sprintf(name, "rbtree lookup n=%zu", count);
+  bench_report("freeze", name, lookups, bench_now() - start);
+
+  start = bench_now();
+  for (i = 0; i < lookups; i++)
+    sum += rbt_frozen_data_size(frozen, queries[i]);
+  sprintf(name, "frozen lookup n=%zu", count);
+  bench_report("freeze", name, lookups, bench_now() - start);
+
+  if (sum == 1)
+    printf("(checksum %" PRIu64 ")\n", sum);
+  rbt_frozen_free(frozen);
+  rbt_free(root, NULL);
+  free(keys);
+  free(queries);
+}
+
+// --- Public ---
+
+// freeze [lookups]
+int bench_freeze(int argc, char *argv[])
+{
+  size_t lookups = (size_t)bench_arg(argc, argv, 1, 2000000UL);
+  uint64_t seed = 0xf00d;
+  const size_t *size = NULL;
+
+  for (size = s_sizes; *size; size++)
+    bench_size(*size, lookups, &seed);
+  return EXIT_SUCCESS;
+}
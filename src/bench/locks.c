@@ -0,0 +1,169 @@
+#include "bench.h"
+
+#include "ticket.h"
+
+#include <stdatomic.h>
+
+#define MAX_THREADS (64)
+#define SHARED_WORDS (32)
+
+typedef struct locks_shared_t
+{
+  ticket_mutex ticket;
+  mcs_mutex mcs;
+  pthread_mutex_t mutex;
+  void (*lock)(struct locks_shared_t *);
+  void (*unlock)(struct locks_shared_t *);
+  uint64_t words[SHARED_WORDS];
+  uint64_t duration;
+  _Atomic bool done;
+} LocksShared;
+
+typedef struct locks_thread_t
+{
+  LocksShared *shared;
+  pthread_t thread;
+  uint64_t seed;
+  uint64_t ops;
+  uint64_t sum;
+} LocksThread;
+
+static void   ticket_acquire(LocksShared *);
+static void   ticket_release(LocksShared *);
+static void   mcs_acquire(LocksShared *);
+static void   mcs_release(LocksShared *);
+static void   mutex_acquire(LocksShared *);
+static void   mutex_release(LocksShared *);
+static void * worker(void *);
+static void   run(LocksShared *, const char *, uint32_t);
+
+// --- Private ---
+
+void ticket_acquire(LocksShared *shared)
+{
+  ticket_lock(&(shared->ticket));
+}
+
+void ticket_release(LocksShared *shared)
+{
+  ticket_unlock(&(shared->ticket));
+}
+
+void mcs_acquire(LocksShared *shared)
+{
+  mcs_lock(&(shared->mcs));
+}
+
+void mcs_release(LocksShared *shared)
+{
+  mcs_unlock(&(shared->mcs));
+}
+
+void mutex_acquire(LocksShared *shared)
+{
+  pthread_mutex_lock(&(shared->mutex));
+}
+
+void mutex_release(LocksShared *shared)
+{
+  pthread_mutex_unlock(&(shared->mutex));
+}
+
+// A short critical section over a few shared cache lines, with a little
+// private work between acquisitions as the allocator's callers have.
+void * worker(void *arg)
+{
+  LocksThread *thread = (LocksThread *)arg;
+  LocksShared *shared = thread->shared;
+  uint64_t value = 0;
+  uint32_t i = 0;
+
+  while (!atomic_load(&(shared->done)))
+  {
+    value = bench_random(&(thread->seed));
+    shared->lock(shared);
+    for (i = 0; i < 4; i++)
+      shared->words[(value + i * 8) % SHARED_WORDS] += value;
+    shared->unlock(shared);
+    for (i = 0; i < 16; i++)
+      value = bench_random(&(thread->seed));
+    thread->sum += value;
+    thread->ops += 1;
+  }
+  return NULL;
+}
+
+void run(LocksShared *shared, const char *lock, uint32_t threads)
+{
+  LocksThread *workers = (LocksThread *)calloc(threads, sizeof(LocksThread));
+  uint64_t start = 0, elapsed = 0, ops = 0, sum = 0;
+  struct timespec pause = { 0 };
+  char name[64] = {0};
+  uint32_t i = 0;
+
+  atomic_store(&(shared->done), false);
+  pause.tv_sec = (time_t)(shared->duration / 1000000000UL);
+  pause.tv_nsec = (long)(shared->duration % 1000000000UL);
+
+  start = bench_now();
+  for (i = 0; i < threads; i++)
+  {
+    workers[i].shared = shared;
+    workers[i].seed = 0x10c4 + i;
+    pthread_create(&(workers[i].thread), NULL, &worker, workers + i);
+  }
+  nanosleep(&pause, NULL);
+  atomic_store(&(shared->done), true);
+  for (i = 0; i < threads; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+    ops += workers[i].ops;
+    sum += workers[i].sum;
+  }
+  elapsed = bench_now() - start;
+
+  sprintf(name, "%s threads=%" PRIu32, lock, threads);
+  bench_report("locks", name, ops, elapsed);
+
+  if (sum == 1)
+    printf("(checksum %" PRIu64 ")\n", sum);
+  free(workers);
+}
+
+// --- Public ---
+
+// locks [threads] [milliseconds]
+int bench_locks(int argc, char *argv[])
+{
+  LocksShared shared;
+  ticket_mutex ticket = TICKET_MUTEX_INITIALIZER;
+  mcs_mutex mcs = MCS_MUTEX_INITIALIZER;
+  uint32_t max = (uint32_t)bench_arg(argc, argv, 1, MAX_THREADS);
+  uint32_t threads = 0;
+
+  memset(&shared, 0, sizeof(shared));
+  memcpy(&(shared.ticket), &ticket, sizeof(ticket_mutex));
+  memcpy(&(shared.mcs), &mcs, sizeof(mcs_mutex));
+  ticket_name(&(shared.ticket), "bench ticket");
+  mcs_name(&(shared.mcs), "bench mcs");
+  pthread_mutex_init(&(shared.mutex), NULL);
+  shared.duration = bench_arg(argc, argv, 2, 200UL) * 1000000UL;
+
+  for (threads = 1; threads <= max; threads *= 2)
+  {
+    shared.lock = &ticket_acquire;
+    shared.unlock = &ticket_release;
+    run(&shared, "ticket", threads);
+    shared.lock = &mcs_acquire;
+    shared.unlock = &mcs_release;
+    run(&shared, "mcs", threads);
+    shared.lock = &mutex_acquire;
+    shared.unlock = &mutex_release;
+    run(&shared, "pthread_mutex", threads);
+  }
+
+  // Only prints with _SANDBOX_LOCK_STATS.
+  lock_stats_dump(stdout);
+  pthread_mutex_destroy(&(shared.mutex));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,44 @@
+#include "common.h"
+#include "bench.h"
+
+typedef struct bench_suite_t
+{
+  const char *name;
+  int (*run)(int, char *[]);
+} BenchSuite;
+
+static const BenchSuite s_suites[] = {
+  { "trees", &bench_trees },
+  { "freeze", &bench_freeze },
+  { "snapshot", &bench_snapshot },
+  { "typed", &bench_typed },
+  { "locks", &bench_locks },
+  { "rwlock", &bench_rwlock },
+  { "ring", &bench_ring },
+  { "ncurs", &bench_ncurs },
+  { "pool", &bench_pool },
+  { "binlog", &bench_binlog },
+  { "text", &bench_text },
+  { "memory", &bench_memory },
+  { NULL, NULL }
+};
+
+int main(int argc, char *argv[])
+{
+  const BenchSuite *suite = NULL;
+  if (1 < argc)
+  {
+    for (suite = s_suites; suite->name; suite++)
+    {
+      if (strcmp(suite->name, argv[1]) == 0)
+        return suite->run(argc - 1, argv + 1);
+    }
+  }
+
+  fprintf(stderr, "Usage: %s <suite> [arguments]\nSuites:",
+          0 < argc ? argv[0] : "sandbox");
+  for (suite = s_suites; suite->name; suite++)
+    fprintf(stderr, " %s", suite->name);
+  fprintf(stderr, "\n");
+  return EXIT_FAILURE;
+}
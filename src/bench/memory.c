@@ -0,0 +1,121 @@
+#include "bench.h"
+
+#include "memory.h"
+
+#define LIVE_BLOCKS (256)
+#define BLOCK_BYTES (48)
+
+static bool check_block(uint64_t);
+static void tag_block(uint64_t);
+static bool check_reuse(void);
+static bool run_churn(uint64_t, uint64_t *);
+
+// --- Private ---
+
+// A live block holds its own id in every word, so a block handed out twice
+// shows up as the other one's id.
+void tag_block(uint64_t id)
+{
+  uint64_t *words = (uint64_t *)gc_data(id);
+  size_t i = 0;
+  for (i = 0; i < BLOCK_BYTES / sizeof(uint64_t); i++)
+    words[i] = id;
+}
+
+bool check_block(uint64_t id)
+{
+  uint64_t *words = (uint64_t *)gc_data(id);
+  size_t i = 0;
+
+  if (words == NULL || gc_id(words) != id ||
+      gc_id((uint8_t *)words + BLOCK_BYTES - 1) != id)
+    return false;
+  for (i = 0; i < BLOCK_BYTES / sizeof(uint64_t); i++)
+    if (words[i] != id)
+      return false;
+  return true;
+}
+
+// Alloc, alloc, free, alloc, alloc: the first block's space goes to the
+// third, the fourth has to land somewhere else and freeing the third has to
+// take its range out of gc_id.
+bool check_reuse(void)
+{
+  uint64_t first = gc_alloc(BLOCK_BYTES), second = gc_alloc(BLOCK_BYTES);
+  uint64_t third = 0, fourth = 0;
+  Pointer data = NULL;
+  bool ok = false;
+
+  tag_block(first);
+  tag_block(second);
+  gc_free(first);
+  third = gc_alloc(BLOCK_BYTES);
+  tag_block(third);
+  fourth = gc_alloc(BLOCK_BYTES);
+  tag_block(fourth);
+
+  ok = (0UL < third && 0UL < fourth && gc_data(third) != gc_data(fourth) &&
+        check_block(second) && check_block(third) && check_block(fourth));
+  data = gc_data(third);
+  gc_free(third);
+  ok = ok && gc_id(data) == 0UL && check_block(fourth);
+
+  gc_free(second);
+  gc_free(fourth);
+  return ok;
+}
+
+// Frees and reallocates random blocks out of a fixed set of live ones, so
+// every allocation after the first few reuses freed space.
+bool run_churn(uint64_t count, uint64_t *seed)
+{
+  uint64_t live[LIVE_BLOCKS];
+  uint64_t start = 0, i = 0;
+  size_t slot = 0;
+  bool ok = true;
+
+  for (slot = 0; slot < LIVE_BLOCKS; slot++)
+  {
+    live[slot] = gc_alloc(BLOCK_BYTES);
+    tag_block(live[slot]);
+  }
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+  {
+    slot = (size_t)(bench_random(seed) % LIVE_BLOCKS);
+    gc_free(live[slot]);
+    live[slot] = gc_alloc(BLOCK_BYTES);
+    tag_block(live[slot]);
+  }
+  bench_report("memory", "gc_free+gc_alloc", count, bench_now() - start);
+
+  for (slot = 0; slot < LIVE_BLOCKS; slot++)
+  {
+    ok = ok && check_block(live[slot]);
+    gc_free(live[slot]);
+  }
+  return ok;
+}
+
+// --- Public ---
+
+// memory [count]
+int bench_memory(int argc, char *argv[])
+{
+  uint64_t count = bench_arg(argc, argv, 1, 20000UL);
+  uint64_t seed = 0xbeef;
+  bool reused = false, churned = false;
+
+  if (!gc_init(0, 0))
+    return EXIT_FAILURE;
+  reused = check_reuse();
+  churned = run_churn(count, &seed);
+  gc_destroy();
+
+  if (!reused)
+    printf("(free then reallocate handed out a block twice)\n");
+  if (!churned)
+    printf("(churn left a block overwritten)\n");
+  return (reused && churned ? EXIT_SUCCESS : EXIT_FAILURE);
+}
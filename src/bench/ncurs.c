@@ -0,0 +1,120 @@
+#include "bench.h"
+
+#include "ncurs.h"
+
+#include <stdatomic.h>
+
+#define SCREEN_ROWS (60)
+#define SCREEN_COLUMNS (200)
+
+typedef struct ncurs_bench_t
+{
+  _Atomic uint32_t id;
+  _Atomic bool done;
+  uint64_t frames;
+  uint64_t limit;
+  chtype last_key;
+} NcursBench;
+
+static void update(struct timespec *, Pointer);
+static void handle_key(chtype, Pointer);
+static void run(NcursBench *, bool);
+
+// --- Private ---
+
+// A mostly static screen: everything is drawn when ncurs asks for it, after
+// that only the status line changes.
+void update(struct timespec *delta, Pointer data)
+{
+  NcursBench *bench = (NcursBench *)data;
+  uint32_t id = atomic_load(&(bench->id));
+  WINDOW *win = ncurs_window(id);
+  int32_t y = 0, x = 0;
+
+  (void)delta;
+  if (win == NULL || atomic_load(&(bench->done)))
+    return;
+
+  if (ncurs_redraw_all(id))
+  {
+    for (y = 1; y < SCREEN_ROWS; y++)
+      for (x = 0; x < SCREEN_COLUMNS; x++)
+        mvwaddch(win, y, x, (chtype)('a' + (x * 7 + y * 3) % 26));
+  }
+  ncurs_damage(id, 0, 0, 1, SCREEN_COLUMNS);
+  mvwprintw(win, 0, 0, "frame %" PRIu64 " key %c", bench->frames,
+            (char)bench->last_key);
+
+  bench->frames += 1;
+  if (bench->limit <= bench->frames)
+  {
+    atomic_store(&(bench->done), true);
+    ncurs_quit(id);
+  }
+}
+
+void handle_key(chtype key, Pointer data)
+{
+  NcursBench *bench = (NcursBench *)data;
+  bench->last_key = key;
+}
+
+// Frames run back to back while this thread types a key every millisecond.
+void run(NcursBench *bench, bool damage)
+{
+  struct timespec pause = { 0, 1000000L };
+  ncurs_frame_stats stats;
+  uint64_t start = 0, elapsed = 0, keys = 0;
+  uint32_t id = 0;
+  chtype key = 0;
+  char name[64] = {0};
+
+  memset(&stats, 0, sizeof(stats));
+  atomic_store(&(bench->done), false);
+  bench->frames = 0;
+
+  start = bench_now();
+  id = ncurs_start_headless(&update, bench, &handle_key, bench,
+                            SCREEN_ROWS, SCREEN_COLUMNS);
+  if (id == 0)
+  {
+    printf("ncurs      could not open a headless screen\n");
+    return;
+  }
+  ncurs_frame_rate(id, 0);
+  ncurs_track_damage(id, damage);
+  atomic_store(&(bench->id), id);
+  while (!atomic_load(&(bench->done)))
+  {
+    key = (chtype)('a' + keys % 26);
+    keys += ncurs_push_keys(id, &key, 1);
+    nanosleep(&pause, NULL);
+  }
+  ncurs_wait(id);
+  elapsed = bench_now() - start;
+  ncurs_frame_stats_get(id, &stats);
+
+  sprintf(name, "frames damage=%s", damage ? "on" : "off");
+  bench_report("ncurs", name, bench->frames, elapsed);
+  printf("%-10s %-32s %12" PRIu64 " ops %10.2f us p99 %10.2f us max\n",
+         "ncurs", "frame time", stats.frames,
+         (double)stats.p99_nsec / 1000.0, (double)stats.max_nsec / 1000.0);
+  printf("%-10s %-32s %12" PRIu64 " ops %10.2f us mean %9.2f us max\n",
+         "ncurs", "input to display", stats.inputs,
+         (double)stats.latency_mean_nsec / 1000.0,
+         (double)stats.latency_max_nsec / 1000.0);
+}
+
+// --- Public ---
+
+// ncurs [frames]
+int bench_ncurs(int argc, char *argv[])
+{
+  NcursBench bench;
+
+  memset(&bench, 0, sizeof(bench));
+  bench.limit = bench_arg(argc, argv, 1, 5000UL);
+  run(&bench, false);
+  run(&bench, true);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+#include "bench.h"
+
+#include "pool.h"
+
+#include <stdatomic.h>
+
+typedef struct pool_sum_t
+{
+  const uint64_t *values;
+  _Atomic uint64_t total;
+} PoolSum;
+
+typedef struct pool_fib_t
+{
+  pool *workers;
+  uint32_t n;
+  uint64_t result;
+  uint64_t calls;
+} PoolFib;
+
+static void sum_slice(size_t, size_t, Pointer);
+static void fib(Pointer);
+static void run_for(pool *, const char *, PoolSum *, size_t, size_t);
+
+// --- Private ---
+
+void sum_slice(size_t begin, size_t end, Pointer arg)
+{
+  PoolSum *sum = (PoolSum *)arg;
+  uint64_t total = 0;
+  size_t i = 0;
+  for (i = begin; i < end; i++)
+    total += sum->values[i] * sum->values[i];
+  atomic_fetch_add(&(sum->total), total);
+}
+
+// Nested fork-join with tasks far smaller than any sensible grain, so the
+// time is mostly the pool's own overhead.
+void fib(Pointer arg)
+{
+  PoolFib *task = (PoolFib *)arg;
+  PoolFib left = { task->workers, 0, 0, 0 };
+  PoolFib right = { task->workers, 0, 0, 0 };
+  pool_group group = POOL_GROUP_INITIALIZER;
+
+  if (task->n < 2)
+  {
+    task->result = task->n;
+    task->calls = 1;
+    return;
+  }
+  left.n = task->n - 1;
+  right.n = task->n - 2;
+  pool_submit(task->workers, &group, &fib, &left);
+  fib(&right);
+  pool_wait(task->workers, &group);
+  task->result = left.result + right.result;
+  task->calls = left.calls + right.calls + 1;
+}
+
+void run_for(pool *workers, const char *kind, PoolSum *sum, size_t count,
+             size_t grain)
+{
+  uint64_t start = 0, elapsed = 0;
+  char name[64] = {0};
+
+  atomic_store(&(sum->total), 0);
+  start = bench_now();
+  if (workers)
+    pool_for(workers, count, grain, &sum_slice, sum);
+  else
+    sum_slice(0, count, sum);
+  elapsed = bench_now() - start;
+
+  sprintf(name, "%s grain=%zu", kind, grain);
+  bench_report("pool", name, count, elapsed);
+  if (atomic_load(&(sum->total)) == 1)
+    printf("(checksum %" PRIu64 ")\n", atomic_load(&(sum->total)));
+}
+
+// --- Public ---
+
+// pool [count] [workers]
+int bench_pool(int argc, char *argv[])
+{
+  static const size_t grains[] = { 0, 1024, 65536 };
+  size_t count = (size_t)bench_arg(argc, argv, 1, 16000000UL);
+  pool *workers = pool_create((uint32_t)bench_arg(argc, argv, 2, 0UL));
+  uint64_t *values = (uint64_t *)malloc(count * sizeof(uint64_t));
+  PoolFib task = { workers, 24, 0, 0 };
+  PoolSum sum;
+  uint64_t seed = 0x9001, start = 0;
+  char name[64] = {0};
+  size_t i = 0;
+
+  if (!workers || !values)
+  {
+    pool_destroy(workers);
+    free(values);
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < count; i++)
+    values[i] = bench_random(&seed) & 0xffff;
+  sum.values = values;
+
+  printf("pool       %u workers\n", pool_workers(workers));
+  run_for(NULL, "serial", &sum, count, count);
+  for (i = 0; i < sizeof(grains) / sizeof(grains[0]); i++)
+    run_for(workers, "pool_for", &sum, count, grains[i]);
+
+  start = bench_now();
+  fib(&task);
+  sprintf(name, "fib(%" PRIu32 ") tasks", task.n);
+  bench_report("pool", name, task.calls, bench_now() - start);
+  if (task.result == 1)
+    printf("(checksum %" PRIu64 ")\n", task.result);
+
+  pool_destroy(workers);
+  free(values);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,177 @@
+#include "bench.h"
+
+#include "ring.h"
+#include "ticket.h"
+
+#include <stdatomic.h>
+
+#define QUEUE_SIZE (1024)
+#define MAX_BATCH (256)
+
+// The array the ncurs input thread used to share with the drawing loop:
+// pushes and drains both take the lock, a drain empties the whole array.
+typedef struct locked_queue_t
+{
+  ticket_mutex lock;
+  uint32_t count;
+  uint64_t items[QUEUE_SIZE];
+} LockedQueue;
+
+typedef struct ring_shared_t
+{
+  ring *queue;
+  LockedQueue *locked;
+  uint32_t (*push)(struct ring_shared_t *, const uint64_t *, uint32_t);
+  uint32_t (*pop)(struct ring_shared_t *, uint64_t *, uint32_t);
+  uint64_t count;
+  uint32_t batch;
+  uint64_t sum;
+} RingShared;
+
+static uint32_t ring_push_batch(RingShared *, const uint64_t *, uint32_t);
+static uint32_t ring_pop_batch(RingShared *, uint64_t *, uint32_t);
+static uint32_t locked_push_batch(RingShared *, const uint64_t *, uint32_t);
+static uint32_t locked_pop_batch(RingShared *, uint64_t *, uint32_t);
+static void *   producer(void *);
+static void     run(RingShared *, const char *);
+
+// --- Private ---
+
+uint32_t ring_push_batch(RingShared *shared, const uint64_t *items,
+                         uint32_t count)
+{
+  return ring_push_all(shared->queue, items, count);
+}
+
+uint32_t ring_pop_batch(RingShared *shared, uint64_t *items, uint32_t count)
+{
+  return ring_pop_all(shared->queue, items, count);
+}
+
+uint32_t locked_push_batch(RingShared *shared, const uint64_t *items,
+                           uint32_t count)
+{
+  LockedQueue *queue = shared->locked;
+  uint32_t fits = 0;
+
+  ticket_lock(&(queue->lock));
+  fits = min(count, QUEUE_SIZE - queue->count);
+  memcpy(queue->items + queue->count, items, fits * sizeof(uint64_t));
+  queue->count += fits;
+  ticket_unlock(&(queue->lock));
+  return fits;
+}
+
+uint32_t locked_pop_batch(RingShared *shared, uint64_t *items, uint32_t count)
+{
+  LockedQueue *queue = shared->locked;
+  uint32_t taken = 0;
+
+  ticket_lock(&(queue->lock));
+  taken = min(count, queue->count);
+  memcpy(items, queue->items, taken * sizeof(uint64_t));
+  memmove(queue->items, queue->items + taken,
+          (queue->count - taken) * sizeof(uint64_t));
+  queue->count -= taken;
+  ticket_unlock(&(queue->lock));
+  return taken;
+}
+
+// Pushes the sequence 1..count in batches, retrying what did not fit.
+void * producer(void *arg)
+{
+  RingShared *shared = (RingShared *)arg;
+  uint64_t items[MAX_BATCH];
+  uint64_t next = 1;
+  uint32_t i = 0, ready = 0, pushed = 0;
+
+  while (next <= shared->count || 0 < ready)
+  {
+    while (ready < shared->batch && next <= shared->count)
+      items[ready++] = next++;
+    pushed = shared->push(shared, items, ready);
+    if (pushed == 0)
+    {
+      sched_yield();
+      continue;
+    }
+    for (i = pushed; i < ready; i++)
+      items[i - pushed] = items[i];
+    ready -= pushed;
+  }
+  return NULL;
+}
+
+// Drains on the calling thread until every item has arrived, checking the
+// order on the way.
+void run(RingShared *shared, const char *queue)
+{
+  uint64_t items[MAX_BATCH];
+  uint64_t start = 0, elapsed = 0, received = 0, sum = 0, expected = 1;
+  pthread_t thread;
+  char name[64] = {0};
+  uint32_t i = 0, count = 0;
+  bool ordered = true;
+
+  start = bench_now();
+  pthread_create(&thread, NULL, &producer, shared);
+  while (received < shared->count)
+  {
+    count = shared->pop(shared, items, shared->batch);
+    if (count == 0)
+    {
+      sched_yield();
+      continue;
+    }
+    for (i = 0; i < count; i++)
+    {
+      ordered = ordered && items[i] == expected++;
+      sum += items[i];
+    }
+    received += count;
+  }
+  pthread_join(thread, NULL);
+  elapsed = bench_now() - start;
+
+  sprintf(name, "%s batch=%" PRIu32, queue, shared->batch);
+  bench_report("ring", name, received, elapsed);
+
+  if (!ordered)
+    printf("(%s delivered out of order)\n", queue);
+  shared->sum += sum;
+}
+
+// --- Public ---
+
+// ring [count]
+int bench_ring(int argc, char *argv[])
+{
+  static const uint32_t batches[] = { 1, 16, MAX_BATCH };
+  RingShared shared;
+  ticket_mutex lock = TICKET_MUTEX_INITIALIZER;
+  LockedQueue *locked = (LockedQueue *)calloc(1, sizeof(LockedQueue));
+  size_t i = 0;
+
+  memset(&shared, 0, sizeof(shared));
+  memcpy(&(locked->lock), &lock, sizeof(ticket_mutex));
+  shared.queue = ring_create(QUEUE_SIZE, sizeof(uint64_t));
+  shared.locked = locked;
+  shared.count = bench_arg(argc, argv, 1, 4000000UL);
+
+  for (i = 0; i < sizeof(batches) / sizeof(batches[0]); i++)
+  {
+    shared.batch = batches[i];
+    shared.push = &ring_push_batch;
+    shared.pop = &ring_pop_batch;
+    run(&shared, "spsc ring");
+    shared.push = &locked_push_batch;
+    shared.pop = &locked_pop_batch;
+    run(&shared, "ticket array");
+  }
+
+  if (shared.sum == 1)
+    printf("(checksum %" PRIu64 ")\n", shared.sum);
+  ring_destroy(shared.queue);
+  free(locked);
+  return EXIT_SUCCESS;
+}
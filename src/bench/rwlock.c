@@ -0,0 +1,208 @@
+#include "bench.h"
+
+#include "rbtree.h"
+#include "ticket.h"
+
+#include <stdatomic.h>
+
+#define MAX_THREADS (8)
+
+typedef struct rwlock_shared_t
+{
+  rw_ticket_mutex rw;
+  ticket_mutex ticket;
+  pthread_rwlock_t rwlock;
+  void (*read_lock)(struct rwlock_shared_t *);
+  void (*read_unlock)(struct rwlock_shared_t *);
+  void (*write_lock)(struct rwlock_shared_t *);
+  void (*write_unlock)(struct rwlock_shared_t *);
+  rbt_node *root;
+  size_t count;
+  uint32_t reads;
+  uint64_t duration;
+  _Atomic bool done;
+} RwlockShared;
+
+typedef struct rwlock_thread_t
+{
+  RwlockShared *shared;
+  pthread_t thread;
+  uint64_t seed;
+  uint64_t ops;
+  uint64_t sum;
+} RwlockThread;
+
+static void   rw_read(RwlockShared *);
+static void   rw_read_done(RwlockShared *);
+static void   rw_write(RwlockShared *);
+static void   rw_write_done(RwlockShared *);
+static void   ticket_any(RwlockShared *);
+static void   ticket_any_done(RwlockShared *);
+static void   pthread_read(RwlockShared *);
+static void   pthread_write(RwlockShared *);
+static void   pthread_done(RwlockShared *);
+static void * worker(void *);
+static void   run(RwlockShared *, const char *, uint32_t);
+
+// --- Private ---
+
+void rw_read(RwlockShared *shared)
+{
+  rw_ticket_read_lock(&(shared->rw));
+}
+
+void rw_read_done(RwlockShared *shared)
+{
+  rw_ticket_read_unlock(&(shared->rw));
+}
+
+void rw_write(RwlockShared *shared)
+{
+  rw_ticket_write_lock(&(shared->rw));
+}
+
+void rw_write_done(RwlockShared *shared)
+{
+  rw_ticket_write_unlock(&(shared->rw));
+}
+
+void ticket_any(RwlockShared *shared)
+{
+  ticket_lock(&(shared->ticket));
+}
+
+void ticket_any_done(RwlockShared *shared)
+{
+  ticket_unlock(&(shared->ticket));
+}
+
+void pthread_read(RwlockShared *shared)
+{
+  pthread_rwlock_rdlock(&(shared->rwlock));
+}
+
+void pthread_write(RwlockShared *shared)
+{
+  pthread_rwlock_wrlock(&(shared->rwlock));
+}
+
+void pthread_done(RwlockShared *shared)
+{
+  pthread_rwlock_unlock(&(shared->rwlock));
+}
+
+// Looks keys up, or replaces them, in the shared tree in the configured
+// proportion.
+void * worker(void *arg)
+{
+  RwlockThread *thread = (RwlockThread *)arg;
+  RwlockShared *shared = thread->shared;
+  uint64_t value = 0;
+  int64_t key = 0;
+
+  while (!atomic_load(&(shared->done)))
+  {
+    value = bench_random(&(thread->seed));
+    key = (int64_t)((value >> 8) % shared->count) * 8 + 1;
+    if (value % 100 < shared->reads)
+    {
+      shared->read_lock(shared);
+      thread->sum += (uintptr_t)rbt_get(shared->root, key);
+      shared->read_unlock(shared);
+    }
+    else
+    {
+      shared->write_lock(shared);
+      shared->root = rbt_put(shared->root, key, (void *)(uintptr_t)value,
+                             sizeof(int64_t), NULL);
+      shared->write_unlock(shared);
+    }
+    thread->ops += 1;
+  }
+  return NULL;
+}
+
+void run(RwlockShared *shared, const char *lock, uint32_t threads)
+{
+  RwlockThread workers[MAX_THREADS];
+  uint64_t start = 0, elapsed = 0, ops = 0, sum = 0;
+  struct timespec pause = { 0 };
+  char name[64] = {0};
+  uint32_t i = 0;
+
+  memset(workers, 0, sizeof(workers));
+  atomic_store(&(shared->done), false);
+  pause.tv_sec = (time_t)(shared->duration / 1000000000UL);
+  pause.tv_nsec = (long)(shared->duration % 1000000000UL);
+
+  start = bench_now();
+  for (i = 0; i < threads; i++)
+  {
+    workers[i].shared = shared;
+    workers[i].seed = 0x4ead + i;
+    pthread_create(&(workers[i].thread), NULL, &worker, workers + i);
+  }
+  nanosleep(&pause, NULL);
+  atomic_store(&(shared->done), true);
+  for (i = 0; i < threads; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+    ops += workers[i].ops;
+    sum += workers[i].sum;
+  }
+  elapsed = bench_now() - start;
+
+  sprintf(name, "%s %" PRIu32 "/%" PRIu32 " threads=%" PRIu32,
+          lock, shared->reads, 100 - shared->reads, threads);
+  bench_report("rwlock", name, ops, elapsed);
+
+  if (sum == 1)
+    printf("(checksum %" PRIu64 ")\n", sum);
+}
+
+// --- Public ---
+
+// rwlock [count] [milliseconds]
+int bench_rwlock(int argc, char *argv[])
+{
+  static const uint32_t mixes[] = { 95, 50 };
+  RwlockShared shared;
+  rw_ticket_mutex rw = RW_TICKET_MUTEX_INITIALIZER;
+  ticket_mutex ticket = TICKET_MUTEX_INITIALIZER;
+  uint32_t threads = 0;
+  size_t i = 0;
+
+  memset(&shared, 0, sizeof(shared));
+  memcpy(&(shared.rw), &rw, sizeof(rw_ticket_mutex));
+  memcpy(&(shared.ticket), &ticket, sizeof(ticket_mutex));
+  pthread_rwlock_init(&(shared.rwlock), NULL);
+  shared.count = (size_t)bench_arg(argc, argv, 1, 100000UL);
+  shared.duration = bench_arg(argc, argv, 2, 200UL) * 1000000UL;
+  for (i = 0; i < shared.count; i++)
+    shared.root = rbt_put(shared.root, (int64_t)i * 8 + 1, (void *)i,
+                          sizeof(int64_t), NULL);
+
+  for (i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++)
+  {
+    shared.reads = mixes[i];
+    for (threads = 1; threads <= MAX_THREADS; threads *= 2)
+    {
+      shared.read_lock = &rw_read;
+      shared.read_unlock = &rw_read_done;
+      shared.write_lock = &rw_write;
+      shared.write_unlock = &rw_write_done;
+      run(&shared, "rw_ticket", threads);
+      shared.read_lock = shared.write_lock = &ticket_any;
+      shared.read_unlock = shared.write_unlock = &ticket_any_done;
+      run(&shared, "ticket", threads);
+      shared.read_lock = &pthread_read;
+      shared.write_lock = &pthread_write;
+      shared.read_unlock = shared.write_unlock = &pthread_done;
+      run(&shared, "pthread_rwlock", threads);
+    }
+  }
+
+  pthread_rwlock_destroy(&(shared.rwlock));
+  rbt_free(shared.root, NULL);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,186 @@
+#include "bench.h"
+
+#include "prbtree.h"
+#include "rbtree.h"
+#include "ticket.h"
+
+#include <stdatomic.h>
+
+#define MAX_THREADS (8)
+
+typedef struct snapshot_shared_t
+{
+  prbt_tree *tree;
+  rbt_node *root;
+  ticket_mutex lock;
+  size_t count;
+  uint64_t duration;
+  _Atomic bool done;
+} SnapshotShared;
+
+typedef struct snapshot_thread_t
+{
+  SnapshotShared *shared;
+  pthread_t thread;
+  uint64_t seed;
+  uint64_t ops;
+  uint64_t sum;
+} SnapshotThread;
+
+static void * prbt_reader(void *);
+static void * prbt_writer(void *);
+static void * locked_reader(void *);
+static void * locked_writer(void *);
+static void   run(SnapshotShared *, const char *, uint32_t,
+                  void * (*)(void *), void * (*)(void *));
+
+// --- Private ---
+
+void * prbt_reader(void *arg)
+{
+  SnapshotThread *reader = (SnapshotThread *)arg;
+  SnapshotShared *shared = reader->shared;
+  int32_t id = prbt_reader_register(shared->tree);
+  prbt_node *root = NULL;
+  int64_t key = 0;
+
+  while (!atomic_load(&(shared->done)))
+  {
+    key = (int64_t)(bench_random(&(reader->seed)) % shared->count) * 8 + 1;
+    root = prbt_read_begin(shared->tree, id);
+    reader->sum += (uintptr_t)prbt_get(root, key);
+    prbt_read_end(shared->tree, id);
+    reader->ops += 1;
+  }
+
+  prbt_reader_unregister(shared->tree, id);
+  return NULL;
+}
+
+void * prbt_writer(void *arg)
+{
+  SnapshotThread *writer = (SnapshotThread *)arg;
+  SnapshotShared *shared = writer->shared;
+  int64_t key = 0;
+
+  while (!atomic_load(&(shared->done)))
+  {
+    key = (int64_t)(bench_random(&(writer->seed)) % shared->count) * 8 + 1;
+    prbt_put(shared->tree, key, (void *)(uintptr_t)key, sizeof(int64_t));
+    writer->ops += 1;
+  }
+  return NULL;
+}
+
+void * locked_reader(void *arg)
+{
+  SnapshotThread *reader = (SnapshotThread *)arg;
+  SnapshotShared *shared = reader->shared;
+  int64_t key = 0;
+
+  while (!atomic_load(&(shared->done)))
+  {
+    key = (int64_t)(bench_random(&(reader->seed)) % shared->count) * 8 + 1;
+    ticket_lock(&(shared->lock));
+    reader->sum += (uintptr_t)rbt_get(shared->root, key);
+    ticket_unlock(&(shared->lock));
+    reader->ops += 1;
+  }
+  return NULL;
+}
+
+void * locked_writer(void *arg)
+{
+  SnapshotThread *writer = (SnapshotThread *)arg;
+  SnapshotShared *shared = writer->shared;
+  int64_t key = 0;
+
+  while (!atomic_load(&(shared->done)))
+  {
+    key = (int64_t)(bench_random(&(writer->seed)) % shared->count) * 8 + 1;
+    ticket_lock(&(shared->lock));
+    shared->root = rbt_put(shared->root, key, (void *)(uintptr_t)key,
+                           sizeof(int64_t), NULL);
+    ticket_unlock(&(shared->lock));
+    writer->ops += 1;
+  }
+  return NULL;
+}
+
+// Runs the readers against one writer for the configured duration and
+// reports the reads and the writes they let through.
+void run(SnapshotShared *shared, const char *tree, uint32_t readers,
+         void * (*read)(void *), void * (*write)(void *))
+{
+  SnapshotThread threads[MAX_THREADS + 1];
+  uint64_t start = 0, elapsed = 0, reads = 0, sum = 0;
+  struct timespec pause = { 0 };
+  char name[64] = {0};
+  uint32_t i = 0;
+
+  memset(threads, 0, sizeof(threads));
+  atomic_store(&(shared->done), false);
+  pause.tv_sec = (time_t)(shared->duration / 1000000000UL);
+  pause.tv_nsec = (long)(shared->duration % 1000000000UL);
+
+  start = bench_now();
+  for (i = 0; i <= readers; i++)
+  {
+    threads[i].shared = shared;
+    threads[i].seed = 0x5eed + i;
+    pthread_create(&(threads[i].thread), NULL, i == 0 ? write : read,
+                   threads + i);
+  }
+  nanosleep(&pause, NULL);
+  atomic_store(&(shared->done), true);
+  for (i = 0; i <= readers; i++)
+    pthread_join(threads[i].thread, NULL);
+  elapsed = bench_now() - start;
+
+  for (i = 1; i <= readers; i++)
+  {
+    reads += threads[i].ops;
+    sum += threads[i].sum;
+  }
+  sprintf(name, "%s lookup readers=%" PRIu32, tree, readers);
+  bench_report("snapshot", name, reads, elapsed);
+  sprintf(name, "%s writes readers=%" PRIu32, tree, readers);
+  bench_report("snapshot", name, threads[0].ops, elapsed);
+
+  if (sum == 1)
+    printf("(checksum %" PRIu64 ")\n", sum);
+}
+
+// --- Public ---
+
+// snapshot [count] [milliseconds]
+int bench_snapshot(int argc, char *argv[])
+{
+  SnapshotShared shared;
+  ticket_mutex lock = TICKET_MUTEX_INITIALIZER;
+  uint32_t readers = 0;
+  size_t i = 0;
+
+  memset(&shared, 0, sizeof(shared));
+  memcpy(&(shared.lock), &lock, sizeof(ticket_mutex));
+  shared.count = (size_t)bench_arg(argc, argv, 1, 100000UL);
+  shared.duration = bench_arg(argc, argv, 2, 500UL) * 1000000UL;
+  shared.tree = prbt_create(NULL);
+  for (i = 0; i < shared.count; i++)
+  {
+    int64_t key = (int64_t)i * 8 + 1;
+    prbt_put(shared.tree, key, (void *)(uintptr_t)key, sizeof(int64_t));
+    shared.root = rbt_put(shared.root, key, (void *)(uintptr_t)key,
+                          sizeof(int64_t), NULL);
+  }
+
+  for (readers = 1; readers <= MAX_THREADS; readers *= 2)
+  {
+    run(&shared, "prbtree", readers, &prbt_reader, &prbt_writer);
+    run(&shared, "rbtree+lock", readers, &locked_reader, &locked_writer);
+  }
+
+  prbt_destroy(shared.tree);
+  rbt_free(shared.root, NULL);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+#include "bench.h"
+
+#include "ncurs.h"
+
+#include <locale.h>
+#include <stdatomic.h>
+
+#define SCREEN_ROWS (60)
+#define SCREEN_COLUMNS (200)
+#define ROUNDS (8)
+
+typedef struct text_bench_t
+{
+  _Atomic uint32_t id;
+  _Atomic bool done;
+  const char *ascii;
+  const char *mixed;
+  size_t bytes;
+} TextBench;
+
+static char *   make_log(size_t, bool);
+static uint32_t widen_bytewise(chtype *, const char *, uint32_t);
+static void     run_convert(const char *, const char *, size_t, int);
+static void     run_pane(TextBench *, const char *, const char *);
+static void     update(struct timespec *, Pointer);
+
+// --- Private ---
+
+// Log lines like a busy pane shows, with a check mark, accents and CJK in
+// every fourth one when mixed.
+char * make_log(size_t bytes, bool mixed)
+{
+  char *text = (char *)malloc(bytes + 1);
+  size_t used = 0, line = 0;
+  int written = 0;
+
+  if (!text)
+    return NULL;
+  while (used < bytes)
+  {
+    written = snprintf(text + used, bytes + 1 - used,
+                       "2026-10-19 12:%02zu:%02zu.%03zu [%zu] frame %zu took "
+                       "%zu us%s\n", line / 60 % 60, line % 60, line % 1000,
+                       line % 8, line, line * 37 % 5000,
+                       (mixed && line % 4 == 0 ?
+                        " \xe2\x9c\x93 caf\xc3\xa9 \xe6\x97\xa5\xe6\x9c\xac" :
+                        ""));
+    if (written < 0)
+      break;
+    used += (size_t)written;
+    line += 1;
+  }
+  text[bytes] = '\0';
+  return text;
+}
+
+// What ncurs_convert_string did: one byte at a time, sign extended.
+uint32_t widen_bytewise(chtype *output, const char *input, uint32_t length)
+{
+  uint32_t i = 0;
+  while (i < length && input[i] != '\0')
+  {
+    output[i] = (chtype)input[i];
+    i += 1;
+  }
+  if (i < length)
+    output[i] = '\0';
+  return i;
+}
+
+// The whole text in one call, as a pane that holds the full log converts
+// it, into cells and wide characters that are allocated once.
+void run_convert(const char *kind, const char *text, size_t bytes, int method)
+{
+  chtype *cells = (chtype *)malloc((bytes + 1) * sizeof(chtype));
+  wchar_t *wide = (wchar_t *)malloc((bytes + 1) * sizeof(wchar_t));
+  uint64_t start = 0, total = 0;
+  uint32_t round = 0, length = (uint32_t)bytes + 1;
+  char name[64] = {0};
+
+  if (!cells || !wide)
+  {
+    free(cells);
+    free(wide);
+    return;
+  }
+  memset(cells, 0, (bytes + 1) * sizeof(chtype));
+  memset(wide, 0, (bytes + 1) * sizeof(wchar_t));
+
+  start = bench_now();
+  for (round = 0; round < ROUNDS; round++)
+  {
+    if (method == 0)
+      total += widen_bytewise(cells, text, length);
+    else if (method == 1)
+      total += ncurs_convert_string(cells, text, length);
+    else if (method == 2)
+      total += mbstowcs(wide, text, length);
+    else
+      total += ncurs_convert_utf8(wide, text, length);
+  }
+  free(cells);
+  free(wide);
+
+  sprintf(name, "%s bytes", kind);
+  bench_report("text", name, bytes * ROUNDS, bench_now() - start);
+  if (total == 1)
+    printf("(checksum %" PRIu64 ")\n", total);
+}
+
+// Scrolls the whole text through the pane from the loop thread, then quits.
+void update(struct timespec *delta, Pointer data)
+{
+  TextBench *bench = (TextBench *)data;
+  uint32_t id = atomic_load(&(bench->id)), round = 0;
+  WINDOW *win = ncurs_window(id);
+  uint64_t start = 0;
+
+  (void)delta;
+  if (win == NULL || atomic_load(&(bench->done)))
+    return;
+
+  scrollok(win, true);
+  start = bench_now();
+  for (round = 0; round < ROUNDS; round++)
+    waddnstr(win, bench->ascii, (int)bench->bytes);
+  bench_report("text", "waddnstr ascii bytes", bench->bytes * ROUNDS,
+               bench_now() - start);
+
+  start = bench_now();
+  for (round = 0; round < ROUNDS; round++)
+    ncurs_write(id, SCREEN_ROWS - 1, 0, bench->ascii, bench->bytes);
+  bench_report("text", "ncurs_write ascii bytes", bench->bytes * ROUNDS,
+               bench_now() - start);
+
+  start = bench_now();
+  for (round = 0; round < ROUNDS; round++)
+    waddnstr(win, bench->mixed, (int)bench->bytes);
+  bench_report("text", "waddnstr mixed bytes", bench->bytes * ROUNDS,
+               bench_now() - start);
+
+  start = bench_now();
+  for (round = 0; round < ROUNDS; round++)
+    ncurs_write(id, SCREEN_ROWS - 1, 0, bench->mixed, bench->bytes);
+  bench_report("text", "ncurs_write mixed bytes", bench->bytes * ROUNDS,
+               bench_now() - start);
+
+  atomic_store(&(bench->done), true);
+  ncurs_quit(id);
+}
+
+void run_pane(TextBench *bench, const char *ascii, const char *mixed)
+{
+  uint32_t id = 0;
+
+  bench->ascii = ascii;
+  bench->mixed = mixed;
+  atomic_store(&(bench->done), false);
+  id = ncurs_start_headless(&update, bench, NULL, NULL, SCREEN_ROWS,
+                            SCREEN_COLUMNS);
+  if (id == 0)
+  {
+    printf("text       could not open a headless screen\n");
+    return;
+  }
+  atomic_store(&(bench->id), id);
+  ncurs_wait(id);
+}
+
+// --- Public ---
+
+// text [kilobytes]
+int bench_text(int argc, char *argv[])
+{
+  TextBench bench;
+  size_t bytes = (size_t)bench_arg(argc, argv, 1, 2048UL) * 1024;
+  char *ascii = make_log(bytes, false);
+  char *mixed = make_log(bytes, true);
+
+  if (!ascii || !mixed || !setlocale(LC_CTYPE, "C.UTF-8"))
+  {
+    free(ascii);
+    free(mixed);
+    return EXIT_FAILURE;
+  }
+  memset(&bench, 0, sizeof(bench));
+  bench.bytes = bytes;
+
+  run_convert("widen bytewise ascii", ascii, bytes, 0);
+  run_convert("ncurs_convert_string ascii", ascii, bytes, 1);
+  run_convert("mbstowcs ascii", ascii, bytes, 2);
+  run_convert("ncurs_convert_utf8 ascii", ascii, bytes, 3);
+  run_convert("mbstowcs mixed", mixed, bytes, 2);
+  run_convert("ncurs_convert_utf8 mixed", mixed, bytes, 3);
+  run_pane(&bench, ascii, mixed);
+
+  free(ascii);
+  free(mixed);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+#include "bench.h"
+
+#include "rbtree.h"
+#include "bptree.h"
+
+static bool count_visit(int64_t, void *, Pointer);
+
+static int64_t * make_keys(size_t, uint64_t *);
+static void      bench_rbtree(const int64_t *, const int64_t *, size_t);
+static void      bench_bptree(const int64_t *, const int64_t *, size_t);
+static void      bench_rbpool(const int64_t *, const int64_t *, size_t);
+static void      bench_rbtree_load(size_t);
+
+// --- Private ---
+
+bool count_visit(int64_t key, void *data, Pointer ctx)
+{
+  (*(uint64_t *)ctx) += (uint64_t)key;
+  return true;
+}
+
+int64_t * make_keys(size_t count, uint64_t *seed)
+{
+  int64_t *keys = (int64_t *)calloc(count, sizeof(int64_t));
+  size_t i = 0;
+  for (i = 0; i < count; i++)
+    keys[i] = (int64_t)(i * 8 + 1);
+  bench_shuffle(keys, count, seed);
+  return keys;
+}
+
+void bench_rbtree(const int64_t *keys, const int64_t *lookups, size_t count)
+{
+  rbt_node *root = NULL;
+  uint64_t start = 0, sum = 0;
+  size_t i = 0, heap = bench_heap_bytes();
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    root = rbt_put(root, keys[i], (void *)(keys + i), sizeof(int64_t), NULL);
+  bench_report("rbtree", "insert", count, bench_now() - start);
+  bench_report_memory("rbtree", bench_heap_bytes() - heap, count);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    sum += (uintptr_t)rbt_get(root, lookups[i]);
+  bench_report("rbtree", "lookup", count, bench_now() - start);
+
+  start = bench_now();
+  rbt_range(root, INT64_MIN, INT64_MAX, &count_visit, &sum);
+  bench_report("rbtree", "scan", count, bench_now() - start);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    root = rbt_remove(root, lookups[i], NULL);
+  bench_report("rbtree", "remove", count, bench_now() - start);
+
+  if (sum == 0)
+    printf("(checksum %" PRIu64 ")\n", sum);
+  rbt_free(root, NULL);
+}
+
+void bench_bptree(const int64_t *keys, const int64_t *lookups, size_t count)
+{
+  bpt_tree *tree = NULL;
+  uint64_t start = 0, sum = 0;
+  size_t i = 0, heap = bench_heap_bytes();
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    tree = bpt_put(tree, keys[i], (void *)(keys + i), sizeof(int64_t), NULL);
+  bench_report("bptree", "insert", count, bench_now() - start);
+  bench_report_memory("bptree", bench_heap_bytes() - heap, count);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    sum += (uintptr_t)bpt_get(tree, lookups[i]);
+  bench_report("bptree", "lookup", count, bench_now() - start);
+
+  start = bench_now();
+  bpt_range(tree, INT64_MIN, INT64_MAX, &count_visit, &sum);
+  bench_report("bptree", "scan", count, bench_now() - start);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    tree = bpt_remove(tree, lookups[i], NULL);
+  bench_report("bptree", "remove", count, bench_now() - start);
+
+  if (sum == 0)
+    printf("(checksum %" PRIu64 ")\n", sum);
+  bpt_free(tree, NULL);
+}
+
+void bench_rbpool(const int64_t *keys, const int64_t *lookups, size_t count)
+{
+  rbt_pool *pool = rbt_pool_create((uint32_t)count);
+  uint64_t start = 0, sum = 0;
+  size_t i = 0;
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    rbt_pool_put(pool, keys[i], (void *)(keys + i), sizeof(int64_t), NULL);
+  bench_report("rbpool", "insert", count, bench_now() - start);
+  bench_report_memory("rbpool", rbt_pool_memory(pool), count);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    sum += (uintptr_t)rbt_pool_get(pool, lookups[i]);
+  bench_report("rbpool", "lookup", count, bench_now() - start);
+
+  start = bench_now();
+  rbt_pool_range(pool, INT64_MIN, INT64_MAX, &count_visit, &sum);
+  bench_report("rbpool", "scan", count, bench_now() - start);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    rbt_pool_remove(pool, lookups[i], NULL);
+  bench_report("rbpool", "remove", count, bench_now() - start);
+
+  if (sum == 0)
+    printf("(checksum %" PRIu64 ")\n", sum);
+  rbt_pool_free(pool, NULL);
+}
+
+void bench_rbtree_load(size_t count)
+{
+  int64_t *keys = (int64_t *)calloc(count, sizeof(int64_t));
+  void **values = (void **)calloc(count, sizeof(void *));
+  rbt_node *root = NULL;
+  uint64_t start = 0;
+  size_t i = 0;
+
+  for (i = 0; i < count; i++)
+  {
+    keys[i] = (int64_t)(i * 8 + 1);
+    values[i] = (void *)(keys + i);
+  }
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    root = rbt_put(root, keys[i], values[i], sizeof(int64_t), NULL);
+  bench_report("rbtree", "sorted load (put)", count, bench_now() - start);
+  rbt_free(root, NULL);
+
+  start = bench_now();
+  root = rbt_build_sorted(keys, values, NULL, count);
+  bench_report("rbtree", "sorted load (build)", count, bench_now() - start);
+
+  start = bench_now();
+  rbt_export(root, keys, values, NULL, count);
+  bench_report("rbtree", "export", count, bench_now() - start);
+
+  rbt_free(root, NULL);
+  free(keys);
+  free(values);
+}
+
+// --- Public ---
+
+// trees [count]
+int bench_trees(int argc, char *argv[])
+{
+  size_t count = (size_t)bench_arg(argc, argv, 1, 1000000UL);
+  uint64_t seed = 0x5eed;
+  int64_t *keys = make_keys(count, &seed);
+  int64_t *lookups = make_keys(count, &seed);
+
+  bench_rbtree(keys, lookups, count);
+  bench_rbtree_load(count);
+  bench_rbpool(keys, lookups, count);
+  bench_bptree(keys, lookups, count);
+
+  free(keys);
+  free(lookups);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+#include "bench.h"
+
+#include "rbtree.h"
+#include "rbtree_typed.h"
+
+#define COMPARE_INT(a, b) ((a) == (b) ? 0 : ((a) < (b) ? -1 : 1))
+
+// int64_t keys with the value stored in the node, against rbt_node's
+// void pointer.
+RBTREE_GEN_DECLARE(rbi, int64_t, int64_t)
+RBTREE_GEN_DEFINE(rbi, int64_t, int64_t, COMPARE_INT)
+
+static int64_t hash_string(const char *);
+static int64_t order_double(double);
+static void    bench_int(size_t, uint64_t *);
+static void    bench_string(size_t, uint64_t *);
+static void    bench_double(size_t, uint64_t *);
+static void    bench_pair(size_t, uint64_t *);
+
+// --- Private ---
+
+// What callers do today to put strings in an rbt_node tree. Collisions are
+// ignored here, a real caller has to chain them.
+int64_t hash_string(const char *string)
+{
+  uint64_t hash = 0xcbf29ce484222325UL;
+  const char *c = NULL;
+  for (c = string; *c; c++)
+    hash = (hash ^ (uint8_t)(*c)) * 0x100000001b3UL;
+  return (int64_t)hash;
+}
+
+// Maps a double to an int64_t with the same order.
+int64_t order_double(double value)
+{
+  int64_t bits = 0;
+  memcpy(&bits, &value, sizeof(int64_t));
+  return (bits < 0 ? bits ^ INT64_MAX : bits);
+}
+
+void bench_int(size_t count, uint64_t *seed)
+{
+  int64_t *keys = (int64_t *)calloc(count, sizeof(int64_t));
+  rbt_node *root = NULL;
+  rbi_node *typed = NULL;
+  uint64_t start = 0, sum = 0;
+  int64_t value = 0;
+  size_t i = 0;
+
+  for (i = 0; i < count; i++)
+    keys[i] = (int64_t)(i * 8 + 1);
+  bench_shuffle(keys, count, seed);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    root = rbt_put(root, keys[i], (void *)(keys + i), sizeof(int64_t), NULL);
+  bench_report("typed", "int64 rbtree insert", count, bench_now() - start);
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    sum += *(int64_t *)rbt_get(root, keys[i]);
+  bench_report("typed", "int64 rbtree lookup", count, bench_now() - start);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    typed = rbi_put(typed, keys[i], keys[i], NULL, NULL);
+  bench_report("typed", "int64 generated insert", count, bench_now() - start);
+  start = bench_now();
+  for (i = 0; i < count; i++)
+  {
+    rbi_get(typed, keys[i], &value);
+    sum += value;
+  }
+  bench_report("typed", "int64 generated lookup", count, bench_now() - start);
+
+  if (sum == 1)
+    printf("(checksum %" PRIu64 ")\n", sum);
+  rbt_free(root, NULL);
+  rbi_free(typed, NULL);
+  free(keys);
+}
+
+void bench_string(size_t count, uint64_t *seed)
+{
+  char *buffer = (char *)calloc(count, 24);
+  char **keys = (char **)calloc(count, sizeof(char *));
+  rbt_node *root = NULL;
+  rbs_node *typed = NULL;
+  uint64_t start = 0, sum = 0;
+  void *value = NULL;
+  size_t i = 0, j = 0;
+  char *swap = NULL;
+
+  for (i = 0; i < count; i++)
+  {
+    keys[i] = buffer + i * 24;
+    sprintf(keys[i], "entity/%016" PRIx64, bench_random(seed));
+  }
+  for (i = count; 1 < i; i--)
+  {
+    j = bench_random(seed) % i;
+    swap = keys[i - 1];
+    keys[i - 1] = keys[j];
+    keys[j] = swap;
+  }
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    root = rbt_put(root, hash_string(keys[i]), keys[i], 0, NULL);
+  bench_report("typed", "string rbtree (hashed) insert", count,
+               bench_now() - start);
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    sum += (uintptr_t)rbt_get(root, hash_string(keys[i]));
+  bench_report("typed", "string rbtree (hashed) lookup", count,
+               bench_now() - start);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    typed = rbs_put(typed, keys[i], keys[i], NULL, NULL);
+  bench_report("typed", "string generated insert", count, bench_now() - start);
+  start = bench_now();
+  for (i = 0; i < count; i++)
+  {
+    rbs_get(typed, keys[i], &value);
+    sum += (uintptr_t)value;
+  }
+  bench_report("typed", "string generated lookup", count, bench_now() - start);
+
+  if (sum == 1)
+    printf("(checksum %" PRIu64 ")\n", sum);
+  rbt_free(root, NULL);
+  rbs_free(typed, NULL);
+  free(keys);
+  free(buffer);
+}
+
+void bench_double(size_t count, uint64_t *seed)
+{
+  double *keys = (double *)calloc(count, sizeof(double));
+  rbt_node *root = NULL;
+  rbd_node *typed = NULL;
+  uint64_t start = 0, sum = 0;
+  void *value = NULL;
+  size_t i = 0;
+
+  for (i = 0; i < count; i++)
+    keys[i] = (double)(bench_random(seed) >> 11) / 9007199254740992.0 - 0.5;
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    root = rbt_put(root, order_double(keys[i]), (void *)(keys + i), 0, NULL);
+  bench_report("typed", "double rbtree (mapped) insert", count,
+               bench_now() - start);
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    sum += (uintptr_t)rbt_get(root, order_double(keys[i]));
+  bench_report("typed", "double rbtree (mapped) lookup", count,
+               bench_now() - start);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    typed = rbd_put(typed, keys[i], (void *)(keys + i), NULL, NULL);
+  bench_report("typed", "double generated insert", count, bench_now() - start);
+  start = bench_now();
+  for (i = 0; i < count; i++)
+  {
+    rbd_get(typed, keys[i], &value);
+    sum += (uintptr_t)value;
+  }
+  bench_report("typed", "double generated lookup", count, bench_now() - start);
+
+  if (sum == 1)
+    printf("(checksum %" PRIu64 ")\n", sum);
+  rbt_free(root, NULL);
+  rbd_free(typed, NULL);
+  free(keys);
+}
+
+void bench_pair(size_t count, uint64_t *seed)
+{
+  rbt_pair *keys = (rbt_pair *)calloc(count, sizeof(rbt_pair));
+  rbt_node *root = NULL;
+  rbp_node *typed = NULL;
+  uint64_t start = 0, sum = 0;
+  void *value = NULL;
+  size_t i = 0;
+
+  // Both halves fit in 32 bits so the packed int64_t key stays exact.
+  for (i = 0; i < count; i++)
+  {
+    keys[i].first = (int64_t)(bench_random(seed) & 0xffff);
+    keys[i].second = (int64_t)(bench_random(seed) & 0x7fffffff);
+  }
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    root = rbt_put(root, (keys[i].first << 32) | keys[i].second,
+                   (void *)(keys + i), 0, NULL);
+  bench_report("typed", "pair rbtree (packed) insert", count,
+               bench_now() - start);
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    sum += (uintptr_t)rbt_get(root, (keys[i].first << 32) | keys[i].second);
+  bench_report("typed", "pair rbtree (packed) lookup", count,
+               bench_now() - start);
+
+  start = bench_now();
+  for (i = 0; i < count; i++)
+    typed = rbp_put(typed, keys[i], (void *)(keys + i), NULL, NULL);
+  bench_report("typed", "pair generated insert", count, bench_now() - start);
+  start = bench_now();
+  for (i = 0; i < count; i++)
+  {
+    rbp_get(typed, keys[i], &value);
+    sum += (uintptr_t)value;
+  }
+  bench_report("typed", "pair generated lookup", count, bench_now() - start);
+
+  if (sum == 1)
+    printf("(checksum %" PRIu64 ")\n", sum);
+  rbt_free(root, NULL);
+  rbp_free(typed, NULL);
+  free(keys);
+}
+
+// --- Public ---
+
+// typed [count]
+int bench_typed(int argc, char *argv[])
+{
+  size_t count = (size_t)bench_arg(argc, argv, 1, 1000000UL);
+  uint64_t seed = 0x7e57;
+
+  bench_int(count, &seed);
+  bench_string(count, &seed);
+  bench_double(count, &seed);
+  bench_pair(count, &seed);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,272 @@
+#include "binlog.h"
+
+#include "ring.h"
+#include "ticket.h"
+
+#include <stdatomic.h>
+
+#define BINLOG_RECORDS (1024)
+#define BINLOG_BATCH (64)
+#define BINLOG_PERIOD_NSEC (100000000L) // 1/10 sec
+
+// A buffer is only ever written by the thread that holds it. When that
+// thread exits the buffer goes back for the next thread that logs, with
+// whatever the flusher has not taken yet still in it. The list only grows,
+// so the flusher walks it without the lock.
+typedef struct binlog_buffer_t
+{
+  ring *records;
+  struct binlog_buffer_t *next;
+  uint32_t thread;
+  _Atomic bool used;
+} binlog_buffer;
+
+static _Atomic bool s_open = false;
+static FILE *s_file = NULL;
+static pthread_t s_flusher;
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t s_flushed = PTHREAD_COND_INITIALIZER;
+static uint64_t s_requested = 0;
+static uint64_t s_completed = 0;
+static bool s_stopping = false;
+
+static ticket_mutex s_buffers_lock = TICKET_MUTEX_INITIALIZER;
+static _Atomic(binlog_buffer *) s_buffers = NULL;
+static uint32_t s_threads = 0;
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+static pthread_key_t s_key;
+static _Thread_local binlog_buffer *s_buffer = NULL;
+
+static void            init_once(void);
+static void            retire(void *);
+static binlog_buffer * claim(void);
+static bool            drain(void);
+static Pointer         flush_loop(Pointer);
+
+// --- Private ---
+
+void init_once()
+{
+  pthread_key_create(&s_key, &retire);
+  atexit(&binlog_close);
+}
+
+void retire(void *buffer)
+{
+  atomic_store_explicit(&(((binlog_buffer *)buffer)->used), false,
+                        memory_order_release);
+}
+
+binlog_buffer * claim()
+{
+  binlog_buffer *buffer = NULL;
+  bool unused = false;
+
+  pthread_once(&s_once, &init_once);
+  ticket_lock(&s_buffers_lock);
+  for (buffer = atomic_load(&s_buffers); buffer; buffer = buffer->next)
+  {
+    unused = false;
+    if (atomic_compare_exchange_strong(&(buffer->used), &unused, true))
+      break;
+  }
+
+  if (!buffer && (buffer = (binlog_buffer *)calloc(1, sizeof(binlog_buffer))))
+  {
+    buffer->records = ring_create(BINLOG_RECORDS, sizeof(binlog_record));
+    if (!buffer->records)
+    {
+      free(buffer);
+      buffer = NULL;
+    }
+    else
+    {
+      atomic_store(&(buffer->used), true);
+      buffer->next = atomic_load(&s_buffers);
+      atomic_store(&s_buffers, buffer);
+    }
+  }
+
+  if (buffer)
+  {
+    s_threads += 1;
+    buffer->thread = s_threads;
+    pthread_setspecific(s_key, buffer);
+  }
+  ticket_unlock(&s_buffers_lock);
+  return buffer;
+}
+
+// Writes out everything buffered so far, true when there was anything.
+bool drain()
+{
+  binlog_record batch[BINLOG_BATCH];
+  binlog_buffer *buffer = NULL;
+  uint32_t count = 0;
+  bool written = false;
+
+  for (buffer = atomic_load(&s_buffers); buffer; buffer = buffer->next)
+  {
+    while (0 < (count = ring_pop_all(buffer->records, batch, BINLOG_BATCH)))
+    {
+      fwrite(batch, sizeof(binlog_record), count, s_file);
+      written = true;
+    }
+  }
+  if (written)
+    fflush(s_file);
+  return written;
+}
+
+// Drains every period, or sooner when binlog_flush asks, and once more
+// after binlog_close.
+Pointer flush_loop(Pointer arg)
+{
+  struct timespec deadline = {0};
+  uint64_t round = 0;
+  bool stopping = false;
+
+  (void)arg;
+  pthread_mutex_lock(&s_lock);
+  while (true)
+  {
+    round = s_requested;
+    stopping = s_stopping;
+    pthread_mutex_unlock(&s_lock);
+
+    drain();
+
+    pthread_mutex_lock(&s_lock);
+    s_completed = round;
+    pthread_cond_broadcast(&s_flushed);
+    if (stopping)
+      break;
+    if (s_requested == round && !s_stopping)
+    {
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += BINLOG_PERIOD_NSEC;
+      if (1000000000L <= deadline.tv_nsec)
+      {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&s_wake, &s_lock, &deadline);
+    }
+  }
+  pthread_mutex_unlock(&s_lock);
+  return NULL;
+}
+
+// --- Public ---
+
+// A log that is already open stays as it is, whatever the path.
+bool binlog_open(const char *path)
+{
+  binlog_header header;
+  sigset_t all, old;
+  bool opened = false;
+
+  pthread_once(&s_once, &init_once);
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+  header.record_size = sizeof(binlog_record);
+
+  pthread_mutex_lock(&s_lock);
+  if (atomic_load(&s_open))
+  {
+    pthread_mutex_unlock(&s_lock);
+    return true;
+  }
+
+  s_file = fopen(path, "wb");
+  if (s_file && fwrite(&header, sizeof(header), 1, s_file) == 1)
+  {
+    s_stopping = false;
+    s_requested = s_completed = 0;
+    // The flusher starts with every signal blocked, so that none meant for
+    // the program, or for a signalfd it reads them through, lands on it.
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    opened = (pthread_create(&s_flusher, NULL, &flush_loop, NULL) == 0);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+  }
+  if (!opened && s_file)
+  {
+    fclose(s_file);
+    s_file = NULL;
+  }
+  atomic_store(&s_open, opened);
+  pthread_mutex_unlock(&s_lock);
+  return opened;
+}
+
+// Records written after this are kept for the next log that opens.
+void binlog_close()
+{
+  pthread_mutex_lock(&s_lock);
+  if (!atomic_load(&s_open))
+  {
+    pthread_mutex_unlock(&s_lock);
+    return;
+  }
+  atomic_store(&s_open, false);
+  s_stopping = true;
+  pthread_cond_signal(&s_wake);
+  pthread_mutex_unlock(&s_lock);
+
+  pthread_join(s_flusher, NULL);
+  fclose(s_file);
+  s_file = NULL;
+}
+
+// Allocates the first time a thread logs, after that it only copies the
+// record into the thread's buffer.
+void binlog_write(const char *message, uint64_t first, uint64_t second)
+{
+  binlog_buffer *buffer = s_buffer;
+  binlog_record record;
+  struct timespec now = {0};
+  uint32_t i = 0;
+
+  if (!atomic_load_explicit(&s_open, memory_order_relaxed))
+    return;
+  if (!buffer && !(buffer = s_buffer = claim()))
+    return;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  record.time_nsec = (uint64_t)now.tv_sec * 1000000000UL + (uint64_t)now.tv_nsec;
+  record.values[0] = first;
+  record.values[1] = second;
+  record.thread = buffer->thread;
+  for (i = 0; i < BINLOG_TEXT && message && message[i] != '\0'; i++)
+    record.text[i] = message[i];
+  for (; i < BINLOG_TEXT; i++)
+    record.text[i] = '\0';
+  ring_push(buffer->records, &record);
+}
+
+// Waits until everything written before the call is in the file.
+void binlog_flush()
+{
+  uint64_t round = 0;
+
+  pthread_mutex_lock(&s_lock);
+  if (atomic_load(&s_open))
+  {
+    round = ++s_requested;
+    pthread_cond_signal(&s_wake);
+    while (s_completed < round && atomic_load(&s_open))
+      pthread_cond_wait(&s_flushed, &s_lock);
+  }
+  pthread_mutex_unlock(&s_lock);
+}
+
+uint64_t binlog_dropped()
+{
+  binlog_buffer *buffer = NULL;
+  uint64_t dropped = 0;
+  for (buffer = atomic_load(&s_buffers); buffer; buffer = buffer->next)
+    dropped += ring_dropped(buffer->records);
+  return dropped;
+}
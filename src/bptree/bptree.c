@@ -0,0 +1,545 @@
+#include "bptree.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#define NODE_KEYS BPTREE_NODE_KEYS
+#define MIN_KEYS (BPTREE_NODE_KEYS / 2)
+#define CACHE_LINE (64)
+
+typedef struct bpt_node_t
+{
+  int64_t keys[NODE_KEYS];
+  uint32_t count;
+  bool leaf;
+} bpt_node;
+
+typedef struct bpt_inner_t
+{
+  bpt_node node;
+  bpt_node *children[NODE_KEYS + 1];
+} bpt_inner;
+
+typedef struct bpt_leaf_t
+{
+  bpt_node node;
+  struct bpt_leaf_t *prev;
+  struct bpt_leaf_t *next;
+  void *data[NODE_KEYS];
+  size_t data_size[NODE_KEYS];
+} bpt_leaf;
+
+typedef struct bpt_tree_t
+{
+  bpt_node *root;
+  size_t size;
+} bpt_tree;
+
+
+static uint32_t    count_less(const int64_t *, uint32_t, int64_t);
+static uint32_t    count_less_equal(const int64_t *, uint32_t, int64_t);
+static bpt_node *  node_alloc(bool);
+static bpt_leaf *  find_leaf(bpt_node *, int64_t);
+static bpt_node *  insert(bpt_tree *, bpt_node *, int64_t, void *, size_t,
+                          void **, int64_t *);
+static bool        remove_key(bpt_node *, int64_t, void **);
+static void        fix_child(bpt_inner *, uint32_t);
+static void        node_free(bpt_node *, void (*)(void *));
+
+// --- Private ---
+
+// Number of keys smaller than the given one in a sorted key array. Every
+// lane is compared and the result is a popcount, so there are no branches
+// that depend on the key values.
+uint32_t count_less(const int64_t *keys, uint32_t count, int64_t key)
+{
+  uint64_t mask = 0;
+  uint32_t i = 0;
+#if defined(__AVX2__)
+  __m256i k = _mm256_set1_epi64x(key);
+  for (i = 0; i < count; i += 4)
+  {
+    __m256i v = _mm256_load_si256((const __m256i *)(keys + i));
+    __m256i lt = _mm256_cmpgt_epi64(k, v);
+    mask |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(lt)) << i;
+  }
+#elif defined(__SSE4_2__)
+  __m128i k = _mm_set1_epi64x(key);
+  for (i = 0; i < count; i += 2)
+  {
+    __m128i v = _mm_load_si128((const __m128i *)(keys + i));
+    __m128i lt = _mm_cmpgt_epi64(k, v);
+    mask |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(lt)) << i;
+  }
+#else
+  for (i = 0; i < count; i++)
+    mask |= (uint64_t)(keys[i] < key) << i;
+#endif
+  if (count < 64)
+    mask &= (1UL << count) - 1;
+  return (uint32_t)__builtin_popcountl(mask);
+}
+
+uint32_t count_less_equal(const int64_t *keys, uint32_t count, int64_t key)
+{
+  if (key == INT64_MAX)
+    return count;
+  return count_less(keys, count, key + 1);
+}
+
+bpt_node * node_alloc(bool leaf)
+{
+  size_t bytes = (leaf ? sizeof(bpt_leaf) : sizeof(bpt_inner));
+  bpt_node *node = NULL;
+  uint32_t i = 0;
+
+  bytes = (bytes + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1);
+  node = (bpt_node *)aligned_alloc(CACHE_LINE, bytes);
+  memset(node, 0, bytes);
+  for (i = 0; i < NODE_KEYS; i++)
+    node->keys[i] = INT64_MAX;
+  node->leaf = leaf;
+  return node;
+}
+
+bpt_leaf * find_leaf(bpt_node *root, int64_t key)
+{
+  bpt_node *node = root;
+  while (node && !node->leaf)
+  {
+    bpt_inner *inner = (bpt_inner *)node;
+    node = inner->children[count_less_equal(node->keys, node->count, key)];
+  }
+  return (bpt_leaf *)node;
+}
+
+// Returns the new right sibling when the node had to split, in which case
+// split_key holds the smallest key that went to the right.
+bpt_node * insert(bpt_tree *tree, bpt_node *node, int64_t key, void *data,
+                  size_t data_size, void **old_data, int64_t *split_key)
+{
+  uint32_t pos = 0;
+
+  if (node->leaf)
+  {
+    bpt_leaf *leaf = (bpt_leaf *)node;
+    bpt_leaf *right = NULL;
+    uint32_t i = 0;
+
+    pos = count_less(node->keys, node->count, key);
+    if (pos < node->count && node->keys[pos] == key)
+    {
+      if (leaf->data[pos] != data)
+      {
+        if (old_data)
+          (*old_data) = leaf->data[pos];
+        leaf->data[pos] = data;
+      }
+      leaf->data_size[pos] = data_size;
+      return NULL;
+    }
+
+    if (node->count == NODE_KEYS)
+    {
+      uint32_t half = NODE_KEYS / 2;
+
+      right = (bpt_leaf *)node_alloc(true);
+      memcpy(right->node.keys, node->keys + half,
+             (NODE_KEYS - half) * sizeof(int64_t));
+      memcpy(right->data, leaf->data + half,
+             (NODE_KEYS - half) * sizeof(void *));
+      memcpy(right->data_size, leaf->data_size + half,
+             (NODE_KEYS - half) * sizeof(size_t));
+      right->node.count = NODE_KEYS - half;
+      for (i = half; i < NODE_KEYS; i++)
+        node->keys[i] = INT64_MAX;
+      node->count = half;
+
+      right->next = leaf->next;
+      right->prev = leaf;
+      if (leaf->next)
+        leaf->next->prev = right;
+      leaf->next = right;
+
+      if (half < pos)
+      {
+        leaf = right;
+        pos -= half;
+      }
+    }
+
+    memmove(leaf->node.keys + pos + 1, leaf->node.keys + pos,
+            (leaf->node.count - pos) * sizeof(int64_t));
+    memmove(leaf->data + pos + 1, leaf->data + pos,
+            (leaf->node.count - pos) * sizeof(void *));
+    memmove(leaf->data_size + pos + 1, leaf->data_size + pos,
+            (leaf->node.count - pos) * sizeof(size_t));
+    leaf->node.keys[pos] = key;
+    leaf->data[pos] = data;
+    leaf->data_size[pos] = data_size;
+    leaf->node.count += 1;
+    tree->size += 1;
+
+    if (right)
+      (*split_key) = right->node.keys[0];
+    return (bpt_node *)right;
+  }
+  else
+  {
+    bpt_inner *inner = (bpt_inner *)node;
+    bpt_inner *right = NULL;
+    bpt_node *child = NULL;
+    int64_t child_key = 0;
+    int64_t keys[NODE_KEYS + 1];
+    bpt_node *children[NODE_KEYS + 2];
+    uint32_t mid = (NODE_KEYS + 1) / 2;
+    uint32_t i = 0;
+
+    pos = count_less_equal(node->keys, node->count, key);
+    child = insert(tree, inner->children[pos], key, data, data_size,
+                   old_data, &child_key);
+    if (!child)
+      return NULL;
+
+    if (node->count < NODE_KEYS)
+    {
+      memmove(node->keys + pos + 1, node->keys + pos,
+              (node->count - pos) * sizeof(int64_t));
+      memmove(inner->children + pos + 2, inner->children + pos + 1,
+              (node->count - pos) * sizeof(bpt_node *));
+      node->keys[pos] = child_key;
+      inner->children[pos + 1] = child;
+      node->count += 1;
+      return NULL;
+    }
+
+    // Full, lay the NODE_KEYS + 1 keys out in order and push the middle one
+    // up to the parent.
+    memcpy(keys, node->keys, pos * sizeof(int64_t));
+    keys[pos] = child_key;
+    memcpy(keys + pos + 1, node->keys + pos,
+           (NODE_KEYS - pos) * sizeof(int64_t));
+    memcpy(children, inner->children, (pos + 1) * sizeof(bpt_node *));
+    children[pos + 1] = child;
+    memcpy(children + pos + 2, inner->children + pos + 1,
+           (NODE_KEYS - pos) * sizeof(bpt_node *));
+
+    right = (bpt_inner *)node_alloc(false);
+    right->node.count = NODE_KEYS - mid;
+    memcpy(right->node.keys, keys + mid + 1,
+           right->node.count * sizeof(int64_t));
+    memcpy(right->children, children + mid + 1,
+           (right->node.count + 1) * sizeof(bpt_node *));
+
+    node->count = mid;
+    memcpy(node->keys, keys, mid * sizeof(int64_t));
+    memcpy(inner->children, children, (mid + 1) * sizeof(bpt_node *));
+    for (i = mid; i < NODE_KEYS; i++)
+    {
+      node->keys[i] = INT64_MAX;
+      inner->children[i + 1] = NULL;
+    }
+
+    (*split_key) = keys[mid];
+    return (bpt_node *)right;
+  }
+}
+
+bool remove_key(bpt_node *node, int64_t key, void **data)
+{
+  uint32_t pos = 0;
+  if (node->leaf)
+  {
+    bpt_leaf *leaf = (bpt_leaf *)node;
+    pos = count_less(node->keys, node->count, key);
+    if (node->count <= pos || node->keys[pos] != key)
+      return false;
+
+    if (data)
+      (*data) = leaf->data[pos];
+    memmove(node->keys + pos, node->keys + pos + 1,
+            (node->count - pos - 1) * sizeof(int64_t));
+    memmove(leaf->data + pos, leaf->data + pos + 1,
+            (node->count - pos - 1) * sizeof(void *));
+    memmove(leaf->data_size + pos, leaf->data_size + pos + 1,
+            (node->count - pos - 1) * sizeof(size_t));
+    node->count -= 1;
+    node->keys[node->count] = INT64_MAX;
+    return true;
+  }
+  else
+  {
+    bpt_inner *inner = (bpt_inner *)node;
+    pos = count_less_equal(node->keys, node->count, key);
+    if (!remove_key(inner->children[pos], key, data))
+      return false;
+    if (inner->children[pos]->count < MIN_KEYS)
+      fix_child(inner, pos);
+    return true;
+  }
+}
+
+// Refills an underflowing child from a sibling, merging the two when the
+// sibling has nothing to spare.
+void fix_child(bpt_inner *parent, uint32_t pos)
+{
+  uint32_t sep = (0 < pos ? pos - 1 : pos);
+  bpt_node *l = parent->children[sep];
+  bpt_node *r = parent->children[sep + 1];
+
+  if (l->leaf)
+  {
+    bpt_leaf *ll = (bpt_leaf *)l;
+    bpt_leaf *rl = (bpt_leaf *)r;
+
+    if (l->count + r->count <= NODE_KEYS)
+    {
+      memcpy(l->keys + l->count, r->keys, r->count * sizeof(int64_t));
+      memcpy(ll->data + l->count, rl->data, r->count * sizeof(void *));
+      memcpy(ll->data_size + l->count, rl->data_size,
+             r->count * sizeof(size_t));
+      l->count += r->count;
+      ll->next = rl->next;
+      if (rl->next)
+        rl->next->prev = ll;
+      free(r);
+      r = NULL;
+    }
+    else if (l->count < r->count)
+    {
+      l->keys[l->count] = r->keys[0];
+      ll->data[l->count] = rl->data[0];
+      ll->data_size[l->count] = rl->data_size[0];
+      l->count += 1;
+      memmove(r->keys, r->keys + 1, (r->count - 1) * sizeof(int64_t));
+      memmove(rl->data, rl->data + 1, (r->count - 1) * sizeof(void *));
+      memmove(rl->data_size, rl->data_size + 1,
+              (r->count - 1) * sizeof(size_t));
+      r->count -= 1;
+      r->keys[r->count] = INT64_MAX;
+      parent->node.keys[sep] = r->keys[0];
+    }
+    else
+    {
+      memmove(r->keys + 1, r->keys, r->count * sizeof(int64_t));
+      memmove(rl->data + 1, rl->data, r->count * sizeof(void *));
+      memmove(rl->data_size + 1, rl->data_size, r->count * sizeof(size_t));
+      l->count -= 1;
+      r->keys[0] = l->keys[l->count];
+      rl->data[0] = ll->data[l->count];
+      rl->data_size[0] = ll->data_size[l->count];
+      r->count += 1;
+      l->keys[l->count] = INT64_MAX;
+      parent->node.keys[sep] = r->keys[0];
+    }
+  }
+  else
+  {
+    bpt_inner *li = (bpt_inner *)l;
+    bpt_inner *ri = (bpt_inner *)r;
+
+    if (l->count + r->count + 1 <= NODE_KEYS)
+    {
+      l->keys[l->count] = parent->node.keys[sep];
+      memcpy(l->keys + l->count + 1, r->keys, r->count * sizeof(int64_t));
+      memcpy(li->children + l->count + 1, ri->children,
+             (r->count + 1) * sizeof(bpt_node *));
+      l->count += r->count + 1;
+      free(r);
+      r = NULL;
+    }
+    else if (l->count < r->count)
+    {
+      l->keys[l->count] = parent->node.keys[sep];
+      li->children[l->count + 1] = ri->children[0];
+      l->count += 1;
+      parent->node.keys[sep] = r->keys[0];
+      memmove(r->keys, r->keys + 1, (r->count - 1) * sizeof(int64_t));
+      memmove(ri->children, ri->children + 1, r->count * sizeof(bpt_node *));
+      r->count -= 1;
+      r->keys[r->count] = INT64_MAX;
+      ri->children[r->count + 1] = NULL;
+    }
+    else
+    {
+      memmove(r->keys + 1, r->keys, r->count * sizeof(int64_t));
+      memmove(ri->children + 1, ri->children,
+              (r->count + 1) * sizeof(bpt_node *));
+      r->keys[0] = parent->node.keys[sep];
+      ri->children[0] = li->children[l->count];
+      r->count += 1;
+      parent->node.keys[sep] = l->keys[l->count - 1];
+      li->children[l->count] = NULL;
+      l->count -= 1;
+      l->keys[l->count] = INT64_MAX;
+    }
+  }
+
+  if (!r)
+  {
+    // Merged, drop the separator and the right child from the parent.
+    bpt_node *p = &(parent->node);
+    memmove(p->keys + sep, p->keys + sep + 1,
+            (p->count - sep - 1) * sizeof(int64_t));
+    memmove(parent->children + sep + 1, parent->children + sep + 2,
+            (p->count - sep - 1) * sizeof(bpt_node *));
+    p->count -= 1;
+    p->keys[p->count] = INT64_MAX;
+    parent->children[p->count + 1] = NULL;
+  }
+}
+
+void node_free(bpt_node *node, void (*data_free)(void *))
+{
+  uint32_t i = 0;
+  if (!node)
+    return;
+
+  if (node->leaf)
+  {
+    bpt_leaf *leaf = (bpt_leaf *)node;
+    if (data_free)
+    {
+      for (i = 0; i < node->count; i++)
+      {
+        if (leaf->data[i])
+          data_free(leaf->data[i]);
+      }
+    }
+  }
+  else
+  {
+    bpt_inner *inner = (bpt_inner *)node;
+    for (i = 0; i <= node->count; i++)
+      node_free(inner->children[i], data_free);
+  }
+  free(node);
+}
+
+// --- Public ---
+
+void * bpt_get(bpt_tree *tree, int64_t key)
+{
+  bpt_leaf *leaf = NULL;
+  uint32_t pos = 0;
+  if (!tree)
+    return NULL;
+
+  leaf = find_leaf(tree->root, key);
+  pos = count_less(leaf->node.keys, leaf->node.count, key);
+  if (pos < leaf->node.count && leaf->node.keys[pos] == key)
+    return leaf->data[pos];
+  return NULL;
+}
+
+bpt_tree * bpt_put(bpt_tree *tree, int64_t key, void *data, size_t data_size,
+                   void **old_data)
+{
+  bpt_tree *t = tree;
+  bpt_node *right = NULL;
+  int64_t split_key = 0;
+
+  if (old_data)
+    (*old_data) = NULL;
+
+  if (!t)
+  {
+    t = (bpt_tree *)calloc(1, sizeof(bpt_tree));
+    t->root = node_alloc(true);
+  }
+
+  right = insert(t, t->root, key, data, data_size, old_data, &split_key);
+  if (right)
+  {
+    bpt_inner *root = (bpt_inner *)node_alloc(false);
+    root->node.keys[0] = split_key;
+    root->node.count = 1;
+    root->children[0] = t->root;
+    root->children[1] = right;
+    t->root = &(root->node);
+  }
+  return t;
+}
+
+bpt_tree * bpt_remove(bpt_tree *tree, int64_t key, void **data)
+{
+  if (data)
+    (*data) = NULL;
+  if (!tree || !remove_key(tree->root, key, data))
+    return tree;
+
+  tree->size -= 1;
+  if (!tree->root->leaf && tree->root->count == 0)
+  {
+    bpt_node *old = tree->root;
+    tree->root = ((bpt_inner *)old)->children[0];
+    free(old);
+  }
+  else if (tree->root->leaf && tree->root->count == 0)
+  {
+    free(tree->root);
+    free(tree);
+    return NULL;
+  }
+  return tree;
+}
+
+size_t bpt_size(bpt_tree *tree)
+{
+  return tree ? tree->size : 0;
+}
+
+size_t bpt_data_size(bpt_tree *tree, int64_t key)
+{
+  bpt_leaf *leaf = NULL;
+  uint32_t pos = 0;
+  if (!tree)
+    return -1;
+
+  leaf = find_leaf(tree->root, key);
+  pos = count_less(leaf->node.keys, leaf->node.count, key);
+  if (pos < leaf->node.count && leaf->node.keys[pos] == key)
+    return leaf->data_size[pos];
+  return -1;
+}
+
+size_t bpt_range(bpt_tree *tree, int64_t lo, int64_t hi,
+                 bool (*callback)(int64_t, void *, Pointer), Pointer ctx)
+{
+  size_t count = 0;
+  bpt_leaf *leaf = NULL;
+  uint32_t pos = 0;
+  if (!tree || hi < lo)
+    return 0;
+
+  leaf = find_leaf(tree->root, lo);
+  pos = count_less(leaf->node.keys, leaf->node.count, lo);
+  while (leaf)
+  {
+    for (; pos < leaf->node.count; pos++)
+    {
+      if (hi < leaf->node.keys[pos])
+        return count;
+      count += 1;
+      if (callback && !callback(leaf->node.keys[pos], leaf->data[pos], ctx))
+        return count;
+    }
+    leaf = leaf->next;
+    pos = 0;
+  }
+  return count;
+}
+
+void bpt_free(bpt_tree *tree, void (*data_free)(void *))
+{
+  if (tree)
+  {
+    node_free(tree->root, data_free);
+    tree->root = NULL;
+    tree->size = 0;
+    free(tree);
+  }
+}
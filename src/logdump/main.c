@@ -0,0 +1,75 @@
+#include "common.h"
+#include "binlog.h"
+
+static int compare_records(const void *, const void *);
+
+// Threads flush in batches, so the file is only in order per thread.
+int compare_records(const void *a, const void *b)
+{
+  const binlog_record *left = (const binlog_record *)a;
+  const binlog_record *right = (const binlog_record *)b;
+  if (left->time_nsec != right->time_nsec)
+    return (left->time_nsec < right->time_nsec ? -1 : 1);
+  if (left->thread != right->thread)
+    return (left->thread < right->thread ? -1 : 1);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  binlog_header header;
+  binlog_record *records = NULL, *grown = NULL;
+  size_t count = 0, capacity = 0, i = 0;
+  FILE *file = NULL;
+  struct tm local;
+  time_t seconds = 0;
+  char stamp[32] = {0};
+
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: %s <log file>\n", 0 < argc ? argv[0] : "logdump");
+    return EXIT_FAILURE;
+  }
+
+  file = fopen(argv[1], "rb");
+  if (!file || fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) != 0 ||
+      header.record_size != sizeof(binlog_record))
+  {
+    fprintf(stderr, "%s: not a log this version can read\n", argv[1]);
+    if (file)
+      fclose(file);
+    return EXIT_FAILURE;
+  }
+
+  while (true)
+  {
+    if (count == capacity)
+    {
+      capacity = (capacity ? capacity * 2 : 1024);
+      grown = (binlog_record *)realloc(records, capacity * sizeof(binlog_record));
+      if (!grown)
+        break;
+      records = grown;
+    }
+    if (fread(records + count, sizeof(binlog_record), 1, file) != 1)
+      break;
+    count += 1;
+  }
+  fclose(file);
+
+  qsort(records, count, sizeof(binlog_record), &compare_records);
+  for (i = 0; i < count; i++)
+  {
+    seconds = (time_t)(records[i].time_nsec / 1000000000UL);
+    localtime_r(&seconds, &local);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+    printf("%s.%09" PRIu64 " [%" PRIu32 "] %.*s %" PRIu64 " %" PRIu64 "\n",
+           stamp, records[i].time_nsec % 1000000000UL, records[i].thread,
+           BINLOG_TEXT, records[i].text, records[i].values[0],
+           records[i].values[1]);
+  }
+
+  free(records);
+  return EXIT_SUCCESS;
+}
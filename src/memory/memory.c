@@ -5,6 +5,8 @@
 
 #define BLOCK_HEADER "BLOCK"
 #define BLOCK_HEADER_LENGTH (5)
+#define BLOCK_ALIGN (8)
+#define BLOCK_ALIGNED(x) (((x) + BLOCK_ALIGN - 1) & ~((size_t)BLOCK_ALIGN - 1))
 
 #define DEFAULT_INITIAL_SIZE ((uint32_t)524288)    // 512 kB
 #define DEFAULT_MAX_SIZE     ((uint32_t)536870912) // 512 MB
@@ -26,14 +28,23 @@ static uint8_t *gc_memory = NULL;
 
 static uint32_t  gc_current_size = 0;
 static uint32_t  gc_max_size = 0;
+
+// Block ids mapped to one past the block's offset in gc_memory. Offsets,
+// unlike addresses, survive the memory being grown.
 static rbt_node *gc_blocks = NULL;
 
-static ticket_mutex s_lock = TICKET_MUTEX_INITIALIZER;
+// Data ranges of the live blocks, as offsets, mapped to the block ids.
+static rbt_interval *gc_ranges = NULL;
+
+static rw_ticket_mutex s_lock = RW_TICKET_MUTEX_INITIALIZER;
 
 
 static uint64_t   genid(void);
 static gc_block * alloc_space(size_t);
 static gc_block * get_block(uint64_t);
+static bool       range_id(int64_t, int64_t, void *, Pointer);
+static int64_t    range_start(gc_block *);
+static int64_t    range_end(gc_block *);
 
 
 uint64_t genid()
@@ -54,11 +65,12 @@ gc_block * alloc_space(size_t size)
   uint32_t i = 0;
   uint32_t start = 0;
   size_t block_size = sizeof(gc_block);
-  size_t needed = size + block_size;
+  size_t needed = block_size + BLOCK_ALIGNED(size);
   gc_block *block = NULL;
   gc_block *tmp = NULL;
 
-  for (i = 0; i < gc_current_size; i++)
+  // Blocks start on BLOCK_ALIGN boundaries, so only those can hold a header.
+  for (i = 0; i + block_size <= gc_current_size; i += BLOCK_ALIGN)
   {
     if (needed <= i - start)
     {
@@ -71,45 +83,85 @@ gc_block * alloc_space(size_t size)
       tmp = (gc_block *)(&(gc_memory[i]));
       if (!tmp->marked)
       {
-        i += tmp->size + block_size;
-        start = i;
+        // Step onto the space right after the block, the loop adds one step.
+        start = i + block_size + BLOCK_ALIGNED(tmp->size);
+        i = start - BLOCK_ALIGN;
       }
     }
   }
 
-  if (!block && gc_current_size < gc_max_size &&
-      needed <= gc_max_size - gc_current_size)
+  if (!block && start <= gc_current_size &&
+      needed <= gc_current_size - start)
+    block = (gc_block *)(&(gc_memory[start]));
+
+  start = BLOCK_ALIGNED(gc_current_size);
+  if (!block && start < gc_max_size && needed <= gc_max_size - start)
   {
     uint8_t *tmp_memory = NULL;
     uint32_t new_size = 0;
     new_size =
-      min((gc_current_size * max(needed / gc_current_size, 2)),
+      min(max(gc_current_size * 2, (uint32_t)(start + needed)),
           gc_max_size);
     tmp_memory = gc_memory;
     gc_memory = (uint8_t *)calloc(new_size,sizeof(uint8_t));
     memcpy(gc_memory, tmp_memory, gc_current_size);
     free(tmp_memory);
-    block = (gc_block *)(&(gc_memory[gc_current_size]));
+    block = (gc_block *)(&(gc_memory[start]));
     gc_current_size = new_size;
   }
 
+  // Reused space still holds the freed block's header, so everything in it
+  // has to be set again, marked included, or the scan above would hand the
+  // same space out twice.
   if (block)
   {
     memcpy(block->head, BLOCK_HEADER, BLOCK_HEADER_LENGTH);
     block->id = genid();
+    block->marked = false;
     block->size = size;
+    block->ref_count = 0;
+    block->references = NULL;
     memset(&(block->data), 0, size);
     gc_blocks =
-      rbt_put(gc_blocks, (int64_t)block->id, block,
+      rbt_put(gc_blocks, (int64_t)block->id,
+              (void *)(uintptr_t)((uint8_t *)block - gc_memory + 1),
               sizeof(gc_block) + block->size, NULL);
+    gc_ranges =
+      rbt_interval_put(gc_ranges, range_start(block), range_end(block),
+                       (void *)(uintptr_t)block->id, NULL);
   }
 
   return block;
 }
 
+// The space of a freed block is reused, so the header has to still carry
+// the id for the block to be the one asked for.
 gc_block * get_block(uint64_t id)
 {
-  return (gc_block *)rbt_get(gc_blocks, (int64_t)id);
+  gc_block *block = NULL;
+  uintptr_t offset = (uintptr_t)rbt_get(gc_blocks, (int64_t)id);
+  if (offset == 0)
+    return NULL;
+
+  block = (gc_block *)(&(gc_memory[offset - 1]));
+  return (block->id == id ? block : NULL);
+}
+
+bool range_id(int64_t lo, int64_t hi, void *data, Pointer ctx)
+{
+  (*(uint64_t *)ctx) = (uint64_t)(uintptr_t)data;
+  return false;
+}
+
+int64_t range_start(gc_block *block)
+{
+  return (int64_t)((uint8_t *)(&(block->data)) - gc_memory);
+}
+
+// A block without data still owns the byte its data would start at.
+int64_t range_end(gc_block *block)
+{
+  return range_start(block) + (block->size ? (int64_t)block->size - 1 : 0);
 }
 
 
@@ -128,12 +180,30 @@ Pointer gc_data(uint64_t id)
   gc_block *block = NULL;
   if (id == 0UL)
     return NULL;
+  rw_ticket_read_lock(&s_lock);
   block = get_block(id);
+  rw_ticket_read_unlock(&s_lock);
   if (block == NULL)
     return NULL;
   return (Pointer)(&(block->data));
 }
 
+uint64_t gc_id(Pointer pointer)
+{
+  uint64_t id = 0UL;
+  int64_t offset = 0;
+
+  rw_ticket_read_lock(&s_lock);
+  if (gc_memory && (uint8_t *)pointer >= gc_memory &&
+      (uint8_t *)pointer < gc_memory + gc_current_size)
+  {
+    offset = (int64_t)((uint8_t *)pointer - gc_memory);
+    rbt_overlaps(gc_ranges, offset, offset, &range_id, &id);
+  }
+  rw_ticket_read_unlock(&s_lock);
+  return id;
+}
+
 bool gc_free(uint64_t block_id)
 {
   return gc_free_err(block_id, NULL);
@@ -156,12 +226,13 @@ bool gc_init_err(uint32_t initial_size, uint32_t max_size, gc_error *error)
     if (_max_size == 0)
       _max_size = DEFAULT_MAX_SIZE;
 
-    ticket_lock(&s_lock);
+    rw_ticket_write_lock(&s_lock);
     if (!gc_memory)
     {
       gc_memory = (uint8_t *)calloc(_initial_size,sizeof(uint8_t));
       if (gc_memory)
       {
+        rw_ticket_name(&s_lock, "gc");
         gc_current_size = _initial_size;
         gc_max_size = _max_size;
         
@@ -174,7 +245,7 @@ bool gc_init_err(uint32_t initial_size, uint32_t max_size, gc_error *error)
         (*error) = GC_OUT_OF_MEMORY_ERROR;
       }
     }
-    ticket_unlock(&s_lock);
+    rw_ticket_write_unlock(&s_lock);
   }
   return retval;
 }
@@ -186,11 +257,11 @@ uint64_t gc_alloc_err(size_t size, gc_error *error)
   {
     gc_block *block = NULL;
     
-    ticket_lock(&s_lock);
+    rw_ticket_write_lock(&s_lock);
     block = alloc_space(size);
     if (block)
       id = block->id;
-    ticket_unlock(&s_lock);
+    rw_ticket_write_unlock(&s_lock);
 
     if (error)
       (*error) = (0UL < id ? GC_NO_ERROR : GC_OUT_OF_MEMORY_ERROR);
@@ -208,10 +279,14 @@ bool gc_free_err(uint64_t id, gc_error *error)
   if (gc_memory)
   {
     gc_block *block = NULL;
-    ticket_lock(&s_lock);
+    rw_ticket_write_lock(&s_lock);
     block = get_block(id);
     if (block)
     {
+      if (!block->marked)
+        gc_ranges =
+          rbt_interval_remove(gc_ranges, range_start(block),
+                              range_end(block), NULL);
       block->marked = true;
       retval = true;
       memset(&(block->data), 0, block->size);
@@ -222,7 +297,7 @@ bool gc_free_err(uint64_t id, gc_error *error)
     {
       (*error) = GC_INVALID_INPUT_ERROR;
     }
-    ticket_unlock(&s_lock);
+    rw_ticket_write_unlock(&s_lock);
   }
   else if (error)
   {
@@ -233,7 +308,7 @@ bool gc_free_err(uint64_t id, gc_error *error)
 
 bool gc_destroy_err(gc_error *error)
 {
-  ticket_lock(&s_lock);
+  rw_ticket_write_lock(&s_lock);
   if (gc_memory)
   {
     uint8_t *tmp_mem = gc_memory;
@@ -242,9 +317,13 @@ bool gc_destroy_err(gc_error *error)
     free(tmp_mem);
   }
 
+  rbt_free(gc_blocks, NULL);
+  gc_blocks = NULL;
+  rbt_interval_free(gc_ranges, NULL);
+  gc_ranges = NULL;
   gc_current_size = 0;
   gc_max_size = 0;
-  ticket_unlock(&s_lock);
+  rw_ticket_write_unlock(&s_lock);
 
   return true;
 }
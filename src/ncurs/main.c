@@ -43,7 +43,16 @@ int main(int argc, char *argv[])
 
   state.process = ncurs_start(&update, &state, &handle_key, &state);
   if (0U < state.process)
+  {
+    // record <file> or replay <file> [speed] [report]
+    if (2 < argc && strcmp(argv[1], "record") == 0)
+      ncurs_record(state.process, argv[2]);
+    else if (2 < argc && strcmp(argv[1], "replay") == 0)
+      ncurs_replay(state.process, argv[2],
+                   (3 < argc ? (uint32_t)strtoul(argv[3], NULL, 10) : 1U),
+                   (4 < argc ? argv[4] : NULL));
     ncurs_wait(state.process);
+  }
   else
     ncurs_quit(state.process);
 
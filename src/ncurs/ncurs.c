@@ -2,199 +2,568 @@
 
 #include "ticket.h"
 #include "memory.h"
+#include "ring.h"
+#include "pool.h"
+#include "binlog.h"
+#include "rbtree.h"
+
+#include <locale.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define MAX_MAIN_PROCESSES (8)
-#define MAX_PROCESSES (64)
-#define MAX_CHAR (1024)
+#define MAX_EVENTS (8)
+#define MAX_KEYS (1024)
+#define KEY_BATCH (64)
+#define FRAME_NSEC (16666667UL) // 1/60 sec
+#define FRAME_SAMPLES (1024)
+#define SECOND_NSEC (1000000000UL)
+#define TAPE_MAGIC "SBXKEYS"
+#define WRITE_CHUNK (256)
+#define REPLACEMENT_CHARACTER (0xFFFD)
+#define PUSHERS_CLOSED (0x80000000U)
 
 #define NCURS_PROC_INITIALIZER                                          \
-  { NULL, false, 0U, 0U, 0U, {0}, 0U, {0}, NULL, NULL, NULL, NULL, TICKET_MUTEX_INITIALIZER, TICKET_MUTEX_INITIALIZER, NULL }
+  { NULL, false, 0U, false, 0, NULL, NULL, NULL, NULL, NULL,             \
+    -1, -1, -1, -1, -1,                                                 \
+    NULL, false, FRAME_NSEC, 0UL, 1U, 0UL, 0UL, 0UL, false, false,      \
+    false, false, true, 0, 0,                                           \
+    NULL, NULL, NULL, 0UL, 0UL, {{0}}, TICKET_MUTEX_INITIALIZER, {0},   \
+    {0}, NULL, NULL, TICKET_MUTEX_INITIALIZER, false, 0U, false, 0U,    \
+    {0}, TICKET_MUTEX_INITIALIZER, false, false, NULL, 0UL, 0UL, NULL,  \
+    0U, 0U, 0U, 0UL, 0UL, NULL, TICKET_MUTEX_INITIALIZER, NULL, NULL,   \
+    0UL, false, 0U, false }
+
+// Starts every key recording, one TapeKey per key follows.
+typedef struct tape_header_t
+{
+  char magic[8];
+  uint32_t record_size;
+  uint32_t reserved;
+} TapeHeader;
+
+// nsec and frame count from when the recording started.
+typedef struct tape_key_t
+{
+  uint64_t nsec;
+  uint32_t frame;
+  uint32_t key;
+} TapeKey;
+
+// deadline is when the timer is next due, its key in the deadline tree can
+// be a little later when another timer was already due at the same time.
+typedef struct ncurs_timer_t
+{
+  uint64_t handle;
+  int64_t deadline;
+  uint64_t period_nsec;
+  void (*callback_f)(Pointer);
+  Pointer data;
+} NCursTimer;
 
+// Everything a process does happens on its event loop thread, woken by
+// epoll for terminal input, SIGINT and SIGWINCH through a signalfd, frame
+// ticks from a timerfd and ncurs_quit and ncurs_push_keys through an
+// eventfd. Pushed keys wait in the keys ring until the loop drains it.
+// The only other threads are the workers, which run what update_f hands
+// them.
+//
+// The timer is armed for one absolute deadline at a time, each a frame
+// period after the last, so the rate does not drift with the time a frame
+// takes. A frame that starts past later deadlines counts them as missed and
+// skips to the next one still ahead. With a fixed step, the time that passed
+// is handed to update_f in step-sized pieces, at most max_steps per frame.
+//
+// With on_demand set the timer is only armed while frame_wanted is, which
+// input, a resize, the timer alarm and ncurs_redraw set and each frame
+// clears as it starts. Otherwise it is left disarmed and frame_armed false,
+// so an idle process sleeps until one of them wakes the loop, which then
+// arms it. A wanted frame still waits for its deadline, but one long past
+// is not counted as missed.
+//
+// With damage tracking a frame only starts from a blank screen when
+// redraw_all is set, otherwise update_f clears what it redraws through
+// ncurs_damage and the rest stays as the last frame left it.
+//
+// A headless process has rows and columns set. Its screen writes to
+// /dev/null and is never read, so the window is only the in-memory grid
+// and keys only come in through ncurs_push_keys. input_since is when the
+// oldest key not yet on screen arrived, pushed_at the same for keys still
+// in the ring.
+//
+// With handle_keys_f set, keys collect in held_keys and go out together at
+// the start of the next frame, or sooner when it fills up. handle_keys_f and
+// keys_data change together under keys_lock; batch_keys mirrors whether
+// handle_keys_f is set so handle_input can check it without the lock.
+//
+// pushers counts the threads inside ncurs_push_keys or ncurs_dropped_keys,
+// which use the keys ring and wake_fd from outside the loop. release sets
+// PUSHERS_CLOSED and waits for the count to drain before freeing either.
+//
+// The tape fields belong to ncurs_record and ncurs_replay and are only
+// touched under tape_lock. Replayed keys go in at the start of the frame
+// they are due in and through handle_input like any other key, so they are
+// batched, coalesced and even recorded the same way.
+//
+// Timers sit in two trees under timers_lock, by deadline and by handle.
+// alarm_fd is armed for the earliest deadline only, so with nothing due
+// the loop sleeps until then. When it fires timers_due is set and the batch
+// runs in the next frame that draws, after begin_draw, so what the timers
+// draw is not erased before update_f sees it.
 typedef struct ncurs_process_t {
   WINDOW *main;
   bool running;
   uint32_t id;
-  uint32_t pid;
-  uint32_t current_processes;
-  pthread_t processes[MAX_PROCESSES];
-  uint32_t queue_count;
-  chtype ch_queue[MAX_CHAR];
+  bool started;
+  pthread_t thread;
   void (*update_f)(struct timespec *, Pointer);
   void (*handle_key_f)(chtype, Pointer);
   Pointer update_data;
   Pointer keyhandler_data;
-  ticket_mutex work_lock;
-  ticket_mutex write_lock;
-  FILE *debuglog;
+  pool *workers;
+  int epoll_fd;
+  int signal_fd;
+  int timer_fd;
+  int wake_fd;
+  int alarm_fd;
+  ring *keys;
+  _Atomic bool quitting;
+  _Atomic uint64_t frame_nsec;
+  _Atomic uint64_t step_nsec;
+  _Atomic uint32_t max_steps;
+  uint64_t deadline;
+  uint64_t last_frame;
+  uint64_t pending_nsec;
+  _Atomic bool on_demand;
+  _Atomic bool frame_wanted;
+  bool frame_armed;
+  _Atomic bool track_damage;
+  _Atomic bool redraw_all;
+  int32_t rows;
+  int32_t columns;
+  SCREEN *screen;
+  FILE *screen_out;
+  FILE *screen_in;
+  uint64_t input_since;
+  _Atomic uint64_t pushed_at;
+  sigset_t old_mask;
+  ticket_mutex stats_lock;
+  ncurs_frame_stats stats;
+  uint32_t samples[FRAME_SAMPLES];
+  void (*handle_keys_f)(const chtype *, uint32_t, Pointer);
+  Pointer keys_data;
+  ticket_mutex keys_lock;
+  _Atomic bool batch_keys;
+  _Atomic uint32_t coalesce;
+  bool resize_pending;
+  uint32_t held_count;
+  chtype held_keys[MAX_KEYS];
+  ticket_mutex tape_lock;
+  _Atomic bool recording;
+  _Atomic bool replaying;
+  FILE *record_file;
+  uint64_t record_nsec;
+  uint64_t record_frame;
+  TapeKey *replay_keys;
+  uint32_t replay_count;
+  uint32_t replay_next;
+  uint32_t replay_speed;
+  uint64_t replay_nsec;
+  uint64_t replay_frame;
+  FILE *report_file;
+  ticket_mutex timers_lock;
+  rbt_node *timers;
+  rbt_node *timer_ids;
+  uint64_t timer_count;
+  bool timers_due;
+  _Atomic uint32_t pushers;
+  bool done;
 } NCursProc;
 
 static NCursProc s_ncurs_main_processes[MAX_MAIN_PROCESSES] = {0};
-static uint32_t s_ncurs_main_process_count = 0U;
+static ticket_mutex s_ncurs_slots_lock = TICKET_MUTEX_INITIALIZER;
 
 static void (*ncurs_default_sigint_handler)(int);
 static void (*ncurs_default_sigwinch_handler)(int);
 
-static Pointer queue_input(Pointer);
-static Pointer update(Pointer);
-static Pointer raise_signal(Pointer);
+static Pointer run(Pointer);
+
+static void read_input(NCursProc *);
+static void read_pushed(NCursProc *);
+static void read_signals(NCursProc *);
+static void frame(NCursProc *);
+static void begin_draw(NCursProc *);
+static void end_draw(NCursProc *);
+static bool schedule(NCursProc *, uint64_t);
+static void record(NCursProc *, uint64_t);
+static void record_update(NCursProc *, uint64_t);
+static uint64_t now_nsec(void);
+static void to_timespec(uint64_t, struct timespec *);
+static int compare_samples(const void *, const void *);
 
 static uint32_t genid(void);
 static NCursProc * new_process(void);
+static void finish_process(NCursProc *);
 static NCursProc * get_process(uint32_t id);
 static void default_handler(int32_t);
-static void resize(int32_t);
-static void quit(int32_t);
+static void resize(NCursProc *);
+static void quit(NCursProc *);
 
 static void handle_input(NCursProc *, chtype);
-static bool start_process(NCursProc *, Pointer (*)(Pointer), Pointer);
-static void init(NCursProc *);
+static void deliver_keys(NCursProc *);
+static void tape_record(NCursProc *, chtype);
+static uint32_t tape_replay(NCursProc *, uint64_t);
+static void tape_report(NCursProc *, uint64_t, uint32_t);
+static void tape_close(NCursProc *);
+static void run_timers(NCursProc *);
+static void add_timer(NCursProc *, NCursTimer *);
+static void arm_timers(NCursProc *);
+static uint64_t new_timer(uint32_t, uint64_t, uint64_t, void (*)(Pointer),
+                          Pointer);
+static bool watch(NCursProc *, int);
+static bool init(NCursProc *);
+static bool init_screen(NCursProc *);
+static uint32_t start(NCursProc *, void (*)(struct timespec *, Pointer),
+                      Pointer, void (*)(chtype, Pointer), Pointer);
+static void release(NCursProc *);
+static bool pin(NCursProc *);
+static void unpin(NCursProc *);
 static void clean(NCursProc *);
 static void writelog(NCursProc *,const char *);
 
+static void widen(uint32_t *, const unsigned char *, size_t);
+static size_t ascii_run(const unsigned char *, size_t);
+static uint32_t decode_utf8(const unsigned char *, size_t, wchar_t *);
+static uint32_t convert_utf8(wchar_t *, uint32_t, const unsigned char *,
+                             size_t, size_t *);
+
 // --- Private ---
 // -- Processes --
 
-Pointer queue_input(Pointer params)
+Pointer run(Pointer params)
 {
   NCursProc *proc = (NCursProc *)params;
-  chtype input = 0;
+  struct epoll_event events[MAX_EVENTS];
+  uint64_t count = 0;
+  int32_t i = 0, ready = 0;
+
+  proc->last_frame = now_nsec();
+  if (!schedule(proc, proc->last_frame))
+    writelog(proc, "Failed to arm the frame timer.");
   while (proc->running)
   {
-    if (proc->queue_count < MAX_CHAR &&
-        (input = getch()) != ERR && proc->running)
+    ready = epoll_wait(proc->epoll_fd, events, MAX_EVENTS, -1);
+    for (i = 0; i < ready && proc->running; i++)
     {
-      ticket_lock(&proc->work_lock);
-      if (proc->running)
-        proc->ch_queue[proc->queue_count++] = input;
-      ticket_unlock(&proc->work_lock);
+      if (events[i].data.fd == STDIN_FILENO)
+      {
+        read_input(proc);
+      }
+      else if (events[i].data.fd == proc->signal_fd)
+      {
+        read_signals(proc);
+      }
+      else if (events[i].data.fd == proc->timer_fd)
+      {
+        if (read(proc->timer_fd, &count, sizeof(count)) == sizeof(count))
+          frame(proc);
+      }
+      else if (events[i].data.fd == proc->alarm_fd)
+      {
+        if (read(proc->alarm_fd, &count, sizeof(count)) == sizeof(count))
+        {
+          proc->timers_due = true;
+          atomic_store(&(proc->frame_wanted), true);
+        }
+      }
+      else if (events[i].data.fd == proc->wake_fd)
+      {
+        if (read(proc->wake_fd, &count, sizeof(count)) == sizeof(count))
+        {
+          read_pushed(proc);
+          if (atomic_load(&(proc->quitting)))
+            quit(proc);
+        }
+      }
     }
+    if (proc->running && !proc->frame_armed &&
+        atomic_load(&(proc->frame_wanted)) && !schedule(proc, now_nsec()))
+      writelog(proc, "Failed to arm the frame timer.");
   }
+  erase();
+
   return NULL;
 }
 
-Pointer update(Pointer params)
+// -- Event handlers --
+
+// Everything the terminal has is read at once, so a key reaches the
+// handler as soon as it arrives instead of on the next frame.
+void read_input(NCursProc *proc)
 {
-  static chtype s_chars[MAX_CHAR] = {0};
-  NCursProc *proc = (NCursProc *)params;
-  uint32_t i = 0U;
-  uint64_t fps = 16666667UL; // 1/60 sec
-  struct timespec prev = {0};
-  struct timespec cur = {0};
-  struct timespec delta = {0};
-  struct timespec rem = {0};
-  
-  while (proc->running && rem.tv_sec == 0 && rem.tv_nsec == 0)
+  int input = 0;
+  while (proc->running && (input = getch()) != ERR)
   {
-    uint32_t count = 0U;
-    
-    erase();
-    ticket_lock(&proc->work_lock);
-    if (proc->running)
+    if (proc->input_since == 0UL)
+      proc->input_since = now_nsec();
+    handle_input(proc, (chtype)input);
+  }
+}
+
+void read_pushed(NCursProc *proc)
+{
+  chtype keys[KEY_BATCH] = {0};
+  uint32_t i = 0U, count = 0U;
+  uint64_t since = atomic_exchange(&(proc->pushed_at), 0UL);
+
+  if (since != 0UL && proc->input_since == 0UL)
+    proc->input_since = since;
+  while (proc->running &&
+         0U < (count = ring_pop_all(proc->keys, keys, KEY_BATCH)))
+  {
+    for (i = 0U; i < count && proc->running; i++)
+      handle_input(proc, keys[i]);
+  }
+}
+
+void read_signals(NCursProc *proc)
+{
+  struct signalfd_siginfo info = {0};
+  while (proc->running &&
+         read(proc->signal_fd, &info, sizeof(info)) == sizeof(info))
+  {
+    if (info.ssi_signo == SIGWINCH)
+      atomic_store(&(proc->frame_wanted), true);
+    if (info.ssi_signo == SIGWINCH &&
+        (atomic_load(&(proc->coalesce)) & NCURS_COALESCE_RESIZE))
     {
-      memcpy(s_chars, proc->ch_queue, proc->queue_count);
-      count = proc->queue_count;
+      proc->resize_pending = true;
     }
-    proc->queue_count = 0;
-    ticket_unlock(&proc->work_lock);
-
-    for (i = 0U; i < count; i++)
+    else if (info.ssi_signo == SIGWINCH)
     {
-      if (!proc->running)
-        break;
-      handle_input(proc, s_chars[i]);
+      writelog(proc, "Resizing.");
+      resize(proc);
+      default_handler(SIGWINCH);
     }
+    else if (info.ssi_signo == SIGINT)
+    {
+      writelog(proc, "Received SIGINT.");
+      quit(proc);
+      default_handler(SIGINT);
+    }
+  }
+}
 
-    if (!proc->running)
-      break;
+// Without a fixed step update_f gets the time since the last frame, with
+// one it is called once per whole step that has passed. Steps beyond
+// max_steps are dropped rather than carried into the next frame, so a long
+// stall does not turn into a burst of catching up.
+void frame(NCursProc *proc)
+{
+  uint64_t now = now_nsec();
+  uint64_t step = atomic_load(&(proc->step_nsec)), cost = 0UL;
+  bool replaying = atomic_load(&(proc->replaying));
+  uint32_t steps = 0U, max_steps = atomic_load(&(proc->max_steps));
+  uint32_t replayed = 0U;
+  struct timespec delta = {0};
 
-    timespec_get(&cur, TIME_UTC);
-    delta.tv_sec = (cur.tv_sec - prev.tv_sec);
-    delta.tv_nsec = (cur.tv_nsec - prev.tv_nsec);
-    memcpy(&prev, &cur, sizeof(struct timespec));
+  atomic_store(&(proc->frame_wanted), false);
+  if (proc->resize_pending)
+  {
+    writelog(proc, "Resizing.");
+    proc->resize_pending = false;
+    resize(proc);
+    default_handler(SIGWINCH);
+  }
+  if (replaying)
+    replayed = tape_replay(proc, now);
+  deliver_keys(proc);
 
+  record(proc, now - proc->last_frame);
+  if (step == 0UL)
+  {
+    to_timespec(now - proc->last_frame, &delta);
+    begin_draw(proc);
+    run_timers(proc);
     if (proc->running && proc->update_f != NULL)
       proc->update_f(&delta, proc->update_data);
-    refresh();
-
-    if (proc->running && delta.tv_sec == 0 && delta.tv_nsec < fps)
-      nanosleep(&delta, &rem);
+    end_draw(proc);
   }
-  erase();
+  else
+  {
+    proc->pending_nsec += now - proc->last_frame;
+    if (step <= proc->pending_nsec)
+    {
+      to_timespec(step, &delta);
+      begin_draw(proc);
+      run_timers(proc);
+      while (step <= proc->pending_nsec && steps < max_steps && proc->running)
+      {
+        if (proc->update_f != NULL)
+          proc->update_f(&delta, proc->update_data);
+        proc->pending_nsec -= step;
+        steps += 1;
+      }
+      end_draw(proc);
+      if (step <= proc->pending_nsec)
+      {
+        ticket_lock(&(proc->stats_lock));
+        proc->stats.dropped_steps += proc->pending_nsec / step;
+        ticket_unlock(&(proc->stats_lock));
+        proc->pending_nsec %= step;
+      }
+    }
+    else if (atomic_load(&(proc->on_demand)))
+    {
+      // Nothing was drawn yet, so come back once a step has passed.
+      atomic_store(&(proc->frame_wanted), true);
+    }
+  }
+  proc->last_frame = now;
+  cost = now_nsec() - now;
+  record_update(proc, cost);
+  if (replaying)
+    tape_report(proc, cost, replayed);
 
-  return NULL;
+  if (proc->running && !schedule(proc, now))
+    writelog(proc, "Failed to arm the frame timer.");
+}
+
+void begin_draw(NCursProc *proc)
+{
+  if (!atomic_load(&(proc->track_damage)) || atomic_load(&(proc->redraw_all)))
+    werase(proc->main);
 }
 
-Pointer raise_signal(Pointer params)
+// Only stages the window, so that the terminal gets one write per frame
+// even when the program draws into windows of its own.
+void end_draw(NCursProc *proc)
 {
-  if (params)
+  uint64_t latency = 0UL;
+
+  atomic_store(&(proc->redraw_all), false);
+  wnoutrefresh(proc->main);
+  doupdate();
+
+  if (proc->input_since != 0UL)
   {
-    const char *msg_format = "Raising signal %s.";
-    char buffer[32] = {0};
-    NCursProc *proc = NULL;
-    uint32_t id = 0U;
-    int32_t sig = 0;
-    size_t i = 0;
+    latency = now_nsec() - proc->input_since;
+    proc->input_since = 0UL;
+    ticket_lock(&(proc->stats_lock));
+    proc->stats.inputs += 1;
+    proc->stats.latency_total_nsec += latency;
+    proc->stats.latency_max_nsec = max(proc->stats.latency_max_nsec, latency);
+    ticket_unlock(&(proc->stats_lock));
+  }
+}
 
-    memcpy(&id, params, sizeof(uint32_t));
-    memcpy(&sig, params + sizeof(uint32_t), sizeof(int32_t));
-    proc = get_process(id);
+// Arms the timer for the next deadline that is still ahead of now. Without
+// a frame rate the deadline is now itself, which fires straight away. On
+// demand with no frame wanted it disarms the timer instead.
+bool schedule(NCursProc *proc, uint64_t now)
+{
+  struct itimerspec next = {0};
+  uint64_t period = atomic_load(&(proc->frame_nsec));
+  uint64_t missed = 0UL;
+  bool on_demand = atomic_load(&(proc->on_demand));
 
-    switch(sig)
-    {
-    case SIGINT:
-      i = sprintf(buffer, msg_format, "SIGINT");
-      break;
-    default:
-      i = sprintf(buffer, msg_format, "UNKNOWN_SIGNAL");
-      break;
-    }
-    buffer[i] = '\0';
-    writelog(proc, buffer);
-    
-    raise(sig);
+  proc->frame_armed = (!on_demand || atomic_load(&(proc->replaying)) ||
+                       atomic_load(&(proc->frame_wanted)));
+  if (!proc->frame_armed)
+    return (timerfd_settime(proc->timer_fd, 0, &next, NULL) == 0);
+
+  if (period == 0UL)
+    proc->deadline = now;
+  else if (proc->deadline == 0UL)
+    proc->deadline = now;
+  proc->deadline += period;
+  if (0UL < period && proc->deadline <= now && on_demand)
+  {
+    proc->deadline = now;
   }
-  return NULL;
+  else if (0UL < period && proc->deadline <= now)
+  {
+    missed = (now - proc->deadline) / period + 1;
+    proc->deadline += missed * period;
+    ticket_lock(&(proc->stats_lock));
+    proc->stats.missed += missed;
+    ticket_unlock(&(proc->stats_lock));
+  }
+  to_timespec(proc->deadline, &(next.it_value));
+  return (timerfd_settime(proc->timer_fd, TFD_TIMER_ABSTIME, &next, NULL) == 0);
 }
 
-// -- Event handlers --
+// Frame time is the time from one frame to the next, which is what shows
+// as stutter on the screen.
+void record(NCursProc *proc, uint64_t nsec)
+{
+  ncurs_frame_stats *stats = &(proc->stats);
 
-void resize(int32_t sig)
+  ticket_lock(&(proc->stats_lock));
+  if (stats->frames == 0UL || nsec < stats->min_nsec)
+    stats->min_nsec = nsec;
+  stats->max_nsec = max(stats->max_nsec, nsec);
+  stats->total_nsec += nsec;
+  proc->samples[stats->frames % FRAME_SAMPLES] = (uint32_t)min(nsec, UINT32_MAX);
+  stats->frames += 1;
+  ticket_unlock(&(proc->stats_lock));
+}
+
+// Update time is what the frame itself took, from handing out the keys to
+// writing the screen.
+void record_update(NCursProc *proc, uint64_t nsec)
 {
-  NCursProc *proc = NULL;
-  uint32_t i = 0U;
-  for (i = 0U, proc = s_ncurs_main_processes; i < s_ncurs_main_process_count; i++, proc++)
+  ticket_lock(&(proc->stats_lock));
+  proc->stats.update_total_nsec += nsec;
+  proc->stats.update_max_nsec = max(proc->stats.update_max_nsec, nsec);
+  ticket_unlock(&(proc->stats_lock));
+}
+
+uint64_t now_nsec()
+{
+  struct timespec now = {0};
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * SECOND_NSEC + (uint64_t)now.tv_nsec;
+}
+
+void to_timespec(uint64_t nsec, struct timespec *time)
+{
+  time->tv_sec = (time_t)(nsec / SECOND_NSEC);
+  time->tv_nsec = (long)(nsec % SECOND_NSEC);
+}
+
+int compare_samples(const void *a, const void *b)
+{
+  uint32_t left = *((const uint32_t *)a), right = *((const uint32_t *)b);
+  return (left < right ? -1 : (right < left ? 1 : 0));
+}
+
+void resize(NCursProc *proc)
+{
+  if (proc->running)
   {
-    if (proc && proc->running)
-    {
-      ticket_lock(&proc->work_lock);
-      if (proc->running)
-      {
-        erase();
-        endwin();
-        refresh();
-      }
-      ticket_unlock(&proc->work_lock);
-    }
+    erase();
+    endwin();
+    refresh();
+    atomic_store(&(proc->redraw_all), true);
   }
-  default_handler(sig);
 }
 
-void quit(int32_t sig)
+void quit(NCursProc *proc)
 {
-  NCursProc *proc = NULL;
-  uint32_t i = 0U;
-  for (i = 0U, proc = s_ncurs_main_processes; i < s_ncurs_main_process_count; i++, proc++)
+  if (proc->running)
   {
-    if (proc != NULL && proc->running)
-    {
-      ticket_lock(&proc->work_lock);
-      if (proc->running)
-        proc->running = false;
-      clean(proc);
-      ticket_unlock(&proc->work_lock);
-    }
+    proc->running = false;
+    clean(proc);
   }
-  default_handler(sig);
 }
 
 void default_handler(int32_t sig)
@@ -202,11 +571,13 @@ void default_handler(int32_t sig)
   switch (sig)
   {
   case SIGINT:
-    if (ncurs_default_sigint_handler)
+    if (ncurs_default_sigint_handler != SIG_DFL &&
+        ncurs_default_sigint_handler != SIG_IGN)
       ncurs_default_sigint_handler(sig);
     break;
   case SIGWINCH:
-    if (ncurs_default_sigwinch_handler)
+    if (ncurs_default_sigwinch_handler != SIG_DFL &&
+        ncurs_default_sigwinch_handler != SIG_IGN)
       ncurs_default_sigwinch_handler(sig);
     break;
   default:
@@ -229,35 +600,52 @@ uint32_t genid()
   return retval;
 }
 
+// Curses keeps one current screen and the signal handling is per program,
+// so only one process may be live at a time. Finished processes keep their
+// slots, and their stats, until new ones need them, oldest first.
 NCursProc * new_process()
 {
   NCursProc proc = NCURS_PROC_INITIALIZER;
-  NCursProc *pproc = NULL;
-  uint32_t i = 0U, id = genid();
+  NCursProc *pproc = NULL, *tmp = NULL;
+  uint32_t i = 0U;
 
-  pproc = s_ncurs_main_processes;
-  while (pproc->id != 0U && i < MAX_PROCESSES)
+  ticket_lock(&s_ncurs_slots_lock);
+  for (i = 0U, tmp = s_ncurs_main_processes; i < MAX_MAIN_PROCESSES; i++, tmp++)
   {
-    i++;
-    pproc++;
+    if (tmp->id != 0U && !tmp->done)
+    {
+      ticket_unlock(&s_ncurs_slots_lock);
+      return NULL;
+    }
+    if (pproc == NULL || (pproc->id != 0U && tmp->id < pproc->id))
+      pproc = tmp;
   }
-  if (i == MAX_PROCESSES)
-    return NULL;
 
   memcpy(pproc, &proc, sizeof(NCursProc));
-  s_ncurs_main_process_count += 1U;
-  pproc->id = id;
+  pproc->id = genid();
+  ticket_unlock(&s_ncurs_slots_lock);
+  ticket_name(&(pproc->stats_lock), "ncurs frame stats");
+  ticket_name(&(pproc->tape_lock), "ncurs tape");
+  ticket_name(&(pproc->timers_lock), "ncurs timers");
+  ticket_name(&(pproc->keys_lock), "ncurs keys");
 
   return pproc;
 }
 
+void finish_process(NCursProc *proc)
+{
+  ticket_lock(&s_ncurs_slots_lock);
+  proc->done = true;
+  ticket_unlock(&s_ncurs_slots_lock);
+}
+
 NCursProc * get_process(uint32_t id)
 {
   if (0U < id)
   {
     uint32_t i;
     NCursProc *proc = NULL, *tmp = NULL;
-    for (i = 0U, tmp = s_ncurs_main_processes; i < s_ncurs_main_process_count; i++, tmp++)
+    for (i = 0U, tmp = s_ncurs_main_processes; i < MAX_MAIN_PROCESSES; i++, tmp++)
     {
       if (tmp->id == id)
       {
@@ -273,60 +661,449 @@ NCursProc * get_process(uint32_t id)
 
 void handle_input(NCursProc *proc, chtype input)
 {
-  if (proc->running && proc->handle_key_f != NULL)
-    proc->handle_key_f(input, proc->keyhandler_data);
+  if (!proc->running)
+    return;
+  atomic_store_explicit(&(proc->frame_wanted), true, memory_order_relaxed);
+  if (atomic_load_explicit(&(proc->recording), memory_order_relaxed))
+    tape_record(proc, input);
+
+  if (!atomic_load_explicit(&(proc->batch_keys), memory_order_relaxed))
+  {
+    deliver_keys(proc);
+    if (proc->handle_key_f != NULL)
+      proc->handle_key_f(input, proc->keyhandler_data);
+    return;
+  }
+
+  if (0U < proc->held_count && proc->held_keys[proc->held_count - 1] == input &&
+      (atomic_load(&(proc->coalesce)) & NCURS_COALESCE_KEYS))
+    return;
+  if (proc->held_count == MAX_KEYS)
+    deliver_keys(proc);
+  proc->held_keys[proc->held_count] = input;
+  proc->held_count += 1;
 }
 
-bool start_process(NCursProc *proc, Pointer (*routine)(Pointer), Pointer arg)
+// Keys still held after the batch handler was switched off go to
+// handle_key_f one at a time, in the order they arrived.
+void deliver_keys(NCursProc *proc)
 {
-  pthread_t thread = {0};
-  if (proc->running && proc->current_processes < MAX_PROCESSES &&
-      pthread_create(&thread, NULL, routine, arg) == EXIT_SUCCESS)
+  void (*handle_keys_f)(const chtype *, uint32_t, Pointer) = NULL;
+  Pointer keys_data = NULL;
+  uint32_t i = 0;
+
+  if (proc->held_count == 0U)
+    return;
+  ticket_lock(&(proc->keys_lock));
+  handle_keys_f = proc->handle_keys_f;
+  keys_data = proc->keys_data;
+  ticket_unlock(&(proc->keys_lock));
+
+  if (handle_keys_f != NULL)
   {
-    proc->processes[proc->current_processes] = thread;
-    proc->current_processes += 1;
-    return true;
+    if (proc->running)
+      handle_keys_f(proc->held_keys, proc->held_count, keys_data);
   }
-  return false;
+  else
+  {
+    for (i = 0; i < proc->held_count && proc->running; i++)
+      if (proc->handle_key_f != NULL)
+        proc->handle_key_f(proc->held_keys[i], proc->keyhandler_data);
+  }
+  proc->held_count = 0U;
 }
 
-void init(NCursProc *proc)
+void tape_record(NCursProc *proc, chtype input)
 {
-  writelog(proc, "Initialising...");
+  TapeKey key = {0};
 
-  if (!proc->running)
+  ticket_lock(&(proc->tape_lock));
+  if (proc->record_file != NULL)
   {
-    struct sigaction sa_quit = {0};
-    struct sigaction sa_resize = {0};
-    struct sigaction old = {0};
+    key.nsec = now_nsec() - proc->record_nsec;
+    key.frame = (uint32_t)(proc->stats.frames - proc->record_frame);
+    key.key = (uint32_t)input;
+    fwrite(&key, sizeof(key), 1, proc->record_file);
+  }
+  ticket_unlock(&(proc->tape_lock));
+}
 
-    sigaction(SIGINT, NULL, &old);
-    ncurs_default_sigint_handler = old.sa_handler;
+// Hands over every key due by now, a batch at a time so that the lock is
+// not held while they are handled. A speed of 0 goes by frame count instead
+// of time, which repeats the recording exactly whatever the frame rate.
+uint32_t tape_replay(NCursProc *proc, uint64_t now)
+{
+  chtype keys[KEY_BATCH] = {0};
+  TapeKey *next = NULL;
+  uint64_t elapsed = 0UL, frame = 0UL;
+  uint32_t i = 0U, count = 0U, total = 0U;
+
+  do
+  {
+    count = 0U;
+    ticket_lock(&(proc->tape_lock));
+    frame = proc->stats.frames - proc->replay_frame;
+    elapsed = (proc->replay_nsec < now ? now - proc->replay_nsec : 0UL);
+    elapsed *= proc->replay_speed;
+    while (count < KEY_BATCH && proc->replay_next < proc->replay_count)
+    {
+      next = proc->replay_keys + proc->replay_next;
+      if (proc->replay_speed == 0U ? frame < next->frame : elapsed < next->nsec)
+        break;
+      keys[count] = (chtype)next->key;
+      count += 1;
+      proc->replay_next += 1;
+    }
+    ticket_unlock(&(proc->tape_lock));
 
-    sa_quit.sa_handler = quit;
-    if (sa_quit.sa_flags & SA_RESTART)
-      sa_quit.sa_flags ^= SA_RESTART;
-    sigemptyset(&sa_quit.sa_mask);
-    sigaction(SIGINT, &sa_quit, NULL);
-    
-    sigaction(SIGWINCH, NULL, &old);
-    ncurs_default_sigwinch_handler = old.sa_handler;
+    if (0U < count && proc->input_since == 0UL)
+      proc->input_since = now;
+    for (i = 0U; i < count; i++)
+      handle_input(proc, keys[i]);
+    total += count;
+  } while (count == KEY_BATCH);
+  return total;
+}
 
-    sa_resize.sa_handler = resize;
-    sigemptyset(&sa_resize.sa_mask);
-    sigaction(SIGWINCH, &sa_resize, NULL);
-    writelog(proc, "Signal handling is set.");
+// One line per frame, the frame counted from the start of the replay, its
+// update time in nanoseconds and the keys it got. The replay ends with the
+// frame that gets the last key.
+void tape_report(NCursProc *proc, uint64_t nsec, uint32_t keys)
+{
+  ticket_lock(&(proc->tape_lock));
+  if (proc->report_file != NULL)
+    fprintf(proc->report_file, "%" PRIu64 " %" PRIu64 " %" PRIu32 "\n",
+            proc->stats.frames - 1UL - proc->replay_frame, nsec, keys);
+  if (proc->replay_next == proc->replay_count)
+  {
+    atomic_store(&(proc->replaying), false);
+    free(proc->replay_keys);
+    proc->replay_keys = NULL;
+    proc->replay_count = proc->replay_next = 0U;
+    if (proc->report_file != NULL)
+      fclose(proc->report_file);
+    proc->report_file = NULL;
   }
+  ticket_unlock(&(proc->tape_lock));
+}
 
-  proc->main = initscr();
+// Runs the timers due by the time the batch started, earliest first. Each
+// is taken out before its callback runs and without the lock held, so a
+// callback can cancel or schedule timers, itself included. A repeating
+// timer goes back in for its next deadline still ahead, skipping the ones
+// it missed. Does nothing until alarm_fd has fired.
+void run_timers(NCursProc *proc)
+{
+  NCursTimer *timer = NULL;
+  void (*callback_f)(Pointer) = NULL;
+  Pointer data = NULL;
+  void *value = NULL;
+  int64_t key = 0, now = (int64_t)now_nsec();
+
+  if (!proc->timers_due)
+    return;
+  proc->timers_due = false;
+  while (proc->running)
+  {
+    callback_f = NULL;
+    ticket_lock(&(proc->timers_lock));
+    if (rbt_get_first(proc->timers, &key, &value) != NULL && key <= now)
+    {
+      timer = (NCursTimer *)value;
+      proc->timers = rbt_remove(proc->timers, key, NULL);
+      callback_f = timer->callback_f;
+      data = timer->data;
+      if (0UL < timer->period_nsec)
+      {
+        timer->deadline += (int64_t)timer->period_nsec;
+        if (timer->deadline <= now)
+          timer->deadline += (int64_t)(((uint64_t)(now - timer->deadline) /
+                                        timer->period_nsec + 1UL) *
+                                       timer->period_nsec);
+        add_timer(proc, timer);
+      }
+      else
+      {
+        proc->timer_ids = rbt_remove(proc->timer_ids, (int64_t)timer->handle,
+                                     NULL);
+        free(timer);
+      }
+    }
+    else
+    {
+      arm_timers(proc);
+    }
+    ticket_unlock(&(proc->timers_lock));
+
+    if (callback_f == NULL)
+      break;
+    callback_f(data);
+  }
+}
+
+// Deadlines are tree keys, so a timer due at the same time as another goes
+// in a nanosecond after it, which also keeps them in the order added.
+void add_timer(NCursProc *proc, NCursTimer *timer)
+{
+  int64_t key = timer->deadline;
+  while (rbt_get(proc->timers, key) != NULL)
+    key += 1;
+  proc->timers = rbt_put(proc->timers, key, timer, sizeof(NCursTimer), NULL);
+}
+
+// Expects timers_lock held. With no timers the alarm is disarmed.
+void arm_timers(NCursProc *proc)
+{
+  struct itimerspec next = {0};
+  int64_t key = 0;
+
+  if (rbt_get_first(proc->timers, &key, NULL) != NULL)
+    to_timespec((uint64_t)max(key, 1), &(next.it_value));
+  if (timerfd_settime(proc->alarm_fd, TFD_TIMER_ABSTIME, &next, NULL) != 0)
+    writelog(proc, "Failed to arm the timer alarm.");
+}
+
+uint64_t new_timer(uint32_t id, uint64_t delay_nsec, uint64_t period_nsec,
+                   void (*callback_f)(Pointer), Pointer data)
+{
+  NCursProc *proc = get_process(id);
+  NCursTimer *timer = NULL;
+  uint64_t handle = 0UL;
+
+  if (proc == NULL || !proc->running || callback_f == NULL)
+    return 0UL;
+  timer = (NCursTimer *)malloc(sizeof(NCursTimer));
+  if (timer == NULL)
+    return 0UL;
+  timer->deadline = (int64_t)(now_nsec() + delay_nsec);
+  timer->period_nsec = period_nsec;
+  timer->callback_f = callback_f;
+  timer->data = data;
+
+  ticket_lock(&(proc->timers_lock));
+  proc->timer_count += 1;
+  handle = timer->handle = proc->timer_count;
+  proc->timer_ids = rbt_put(proc->timer_ids, (int64_t)handle, timer,
+                            sizeof(NCursTimer), NULL);
+  add_timer(proc, timer);
+  arm_timers(proc);
+  ticket_unlock(&(proc->timers_lock));
+  return handle;
+}
+
+void tape_close(NCursProc *proc)
+{
+  ticket_lock(&(proc->tape_lock));
+  atomic_store(&(proc->recording), false);
+  atomic_store(&(proc->replaying), false);
+  if (proc->record_file != NULL)
+    fclose(proc->record_file);
+  proc->record_file = NULL;
+  free(proc->replay_keys);
+  proc->replay_keys = NULL;
+  proc->replay_count = proc->replay_next = 0U;
+  if (proc->report_file != NULL)
+    fclose(proc->report_file);
+  proc->report_file = NULL;
+  ticket_unlock(&(proc->tape_lock));
+}
+
+bool watch(NCursProc *proc, int fd)
+{
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  return (0 <= fd && epoll_ctl(proc->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0);
+}
+
+bool init(NCursProc *proc)
+{
+  struct sigaction old = {0};
+  sigset_t signals;
+  const char *locale = NULL;
+
+  // ncursesw only draws wide characters outside of the C locale. A program
+  // that set one of its own keeps it, a headless screen has no terminal to
+  // match so it falls back to UTF-8.
+  if (strcmp(setlocale(LC_CTYPE, NULL), "C") == 0)
+  {
+    locale = setlocale(LC_CTYPE, "");
+    if (proc->rows != 0 && (locale == NULL || strcmp(locale, "C") == 0))
+      setlocale(LC_CTYPE, "C.UTF-8");
+  }
+
+  // The program's own handlers still get called once ncurs has dealt with
+  // the signal.
+  sigaction(SIGINT, NULL, &old);
+  ncurs_default_sigint_handler = old.sa_handler;
+  sigaction(SIGWINCH, NULL, &old);
+  ncurs_default_sigwinch_handler = old.sa_handler;
+
+  // The threads started after this inherit the mask, so the signals only
+  // ever arrive through the signalfd and nothing runs in a handler.
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGWINCH);
+  pthread_sigmask(SIG_BLOCK, &signals, &(proc->old_mask));
+#ifdef _SANDBOX_DEBUG
+  binlog_open("debug.log");
+#endif // _SANDBOX_DEBUG
+  writelog(proc, "Initialising...");
+
+  proc->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  proc->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  proc->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  proc->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  proc->alarm_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  proc->keys = ring_create(MAX_KEYS, sizeof(chtype));
+  proc->workers = pool_create(0);
+  if (!proc->keys || !proc->workers || proc->epoll_fd < 0 ||
+      (proc->rows == 0 && !watch(proc, STDIN_FILENO)) ||
+      !watch(proc, proc->signal_fd) || !watch(proc, proc->timer_fd) ||
+      !watch(proc, proc->wake_fd) || !watch(proc, proc->alarm_fd))
+  {
+    writelog(proc, "Failed to set up the event loop.");
+    release(proc);
+    return false;
+  }
+  writelog(proc, "Signal handling is set.");
+
+  if (!init_screen(proc))
+  {
+    writelog(proc, "Failed to open the screen.");
+    release(proc);
+    return false;
+  }
   keypad(proc->main, true);
   nonl();
   noecho();
   cbreak();
-  halfdelay(5);
+  nodelay(proc->main, true);
   curs_set(0);
   proc->running = true;
   writelog(proc, "Finished initialising.");
+  return true;
+}
+
+// The headless screen still needs a terminal description to work out what
+// it would have written, any one with cursor addressing does.
+bool init_screen(NCursProc *proc)
+{
+  if (proc->rows == 0)
+  {
+    proc->main = initscr();
+    return (proc->main != NULL);
+  }
+
+  proc->screen_out = fopen("/dev/null", "w");
+  proc->screen_in = fopen("/dev/null", "r");
+  if (proc->screen_out != NULL && proc->screen_in != NULL)
+    proc->screen = newterm("xterm", proc->screen_out, proc->screen_in);
+  if (proc->screen == NULL)
+    return false;
+
+  set_term(proc->screen);
+  resizeterm(proc->rows, proc->columns);
+  proc->main = stdscr;
+  return true;
+}
+
+// Closes the event sources, drops any keys still pushed and timers still
+// pending, stops the workers, finishes any recording or replay and gives
+// the starting thread its signals back.
+void release(NCursProc *proc)
+{
+  int *fds[] = { &(proc->alarm_fd), &(proc->wake_fd), &(proc->timer_fd),
+                 &(proc->signal_fd), &(proc->epoll_fd) };
+  uint32_t i = 0U;
+
+  atomic_fetch_or(&(proc->pushers), PUSHERS_CLOSED);
+  while ((atomic_load(&(proc->pushers)) & ~PUSHERS_CLOSED) != 0U)
+    sched_yield();
+
+  for (i = 0U; i < sizeof(fds) / sizeof(fds[0]); i++)
+  {
+    if (0 <= *(fds[i]))
+      close(*(fds[i]));
+    *(fds[i]) = -1;
+  }
+  ring_destroy(proc->keys);
+  proc->keys = NULL;
+  pool_destroy(proc->workers);
+  proc->workers = NULL;
+  tape_close(proc);
+  ticket_lock(&(proc->timers_lock));
+  rbt_free(proc->timers, NULL);
+  rbt_free(proc->timer_ids, &free);
+  proc->timers = proc->timer_ids = NULL;
+  ticket_unlock(&(proc->timers_lock));
+  if (proc->screen != NULL)
+    delscreen(proc->screen);
+  proc->screen = NULL;
+  if (proc->screen_out != NULL)
+    fclose(proc->screen_out);
+  if (proc->screen_in != NULL)
+    fclose(proc->screen_in);
+  proc->screen_out = proc->screen_in = NULL;
+  pthread_sigmask(SIG_SETMASK, &(proc->old_mask), NULL);
+}
+
+// Keeps release from freeing the keys ring and closing wake_fd until unpin,
+// false once it has started.
+bool pin(NCursProc *proc)
+{
+  if (atomic_fetch_add(&(proc->pushers), 1U) & PUSHERS_CLOSED)
+  {
+    atomic_fetch_sub(&(proc->pushers), 1U);
+    return false;
+  }
+  return true;
+}
+
+void unpin(NCursProc *proc)
+{
+  atomic_fetch_sub(&(proc->pushers), 1U);
+}
+
+uint32_t start(NCursProc *proc, void (*update_f)(struct timespec *, Pointer),
+               Pointer update_data, void (*handle_key_f)(chtype, Pointer),
+               Pointer keyhandler_data)
+{
+  uint32_t id = 0U;
+
+  if (proc != NULL && 0U < proc->id)
+  {
+    if (!init(proc))
+    {
+      finish_process(proc);
+      if (proc->rows == 0)
+        raise(SIGINT);
+      return id;
+    }
+    id = proc->id;
+    proc->update_f = update_f;
+    proc->handle_key_f = handle_key_f;
+    proc->update_data = update_data;
+    proc->keyhandler_data = keyhandler_data;
+
+    writelog(proc, "Starting the event loop");
+    proc->started = (pthread_create(&(proc->thread), NULL, &run, proc) == 0);
+    if (proc->started)
+    {
+      writelog(proc, "Start success");
+    }
+    else
+    {
+      writelog(proc, "Start failed");
+      clean(proc);
+      release(proc);
+      finish_process(proc);
+      if (proc->rows == 0)
+        raise(SIGINT);
+      id = 0U;
+    }
+  }  
+  return id;
 }
 
 void clean(NCursProc *proc)
@@ -340,62 +1117,222 @@ void clean(NCursProc *proc)
   endwin();
 }
 
+// Costs a copy into this thread's log buffer, or nothing while no log is
+// open. Debug builds open debug.log, read it with logdump. No message
+// flushes the log.
 void writelog(NCursProc *proc, const char *message)
 {
-#ifdef _SANDBOX_DEBUG
-  ticket_lock(&proc->write_lock);
   if (message)
+    binlog_write(message, proc != NULL ? proc->id : 0U, 0U);
+  else
+    binlog_flush();
+}
+
+// -- Text --
+
+// Zero-extends count bytes to 32 bits each, the way every string ends up
+// as chtype or wchar_t.
+void widen(uint32_t *output, const unsigned char *input, size_t count)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= count; i += 8)
+  {
+    __m128i bytes = _mm_loadl_epi64((const __m128i *)(input + i));
+    _mm256_storeu_si256((__m256i *)(output + i), _mm256_cvtepu8_epi32(bytes));
+  }
+#elif defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(input + i));
+    __m128i low = _mm_unpacklo_epi8(bytes, zero);
+    __m128i high = _mm_unpackhi_epi8(bytes, zero);
+    _mm_storeu_si128((__m128i *)(output + i), _mm_unpacklo_epi16(low, zero));
+    _mm_storeu_si128((__m128i *)(output + i + 4), _mm_unpackhi_epi16(low, zero));
+    _mm_storeu_si128((__m128i *)(output + i + 8), _mm_unpacklo_epi16(high, zero));
+    _mm_storeu_si128((__m128i *)(output + i + 12), _mm_unpackhi_epi16(high, zero));
+  }
+#endif
+  for (; i < count; i++)
+    output[i] = input[i];
+}
+
+// Number of bytes before the first one with the top bit set, which is
+// where ASCII ends and a multibyte UTF-8 sequence starts.
+size_t ascii_run(const unsigned char *input, size_t count)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  uint32_t mask = 0;
+  for (; i + 32 <= count; i += 32)
+  {
+    mask = (uint32_t)_mm256_movemask_epi8(
+      _mm256_loadu_si256((const __m256i *)(input + i)));
+    if (mask != 0)
+      return i + (size_t)__builtin_ctz(mask);
+  }
+#elif defined(__SSE2__)
+  uint32_t mask = 0;
+  for (; i + 16 <= count; i += 16)
+  {
+    mask = (uint32_t)_mm_movemask_epi8(
+      _mm_loadu_si128((const __m128i *)(input + i)));
+    if (mask != 0)
+      return i + (size_t)__builtin_ctz(mask);
+  }
+#endif
+  while (i < count && input[i] < 0x80)
+    i += 1;
+  return i;
+}
+
+// Decodes the sequence at the start of input and returns how many bytes it
+// took. Anything but a complete, shortest form sequence of a Unicode scalar
+// value takes a single byte and comes out as U+FFFD.
+uint32_t decode_utf8(const unsigned char *input, size_t count, wchar_t *output)
+{
+  uint32_t value = input[0], extra = 0U, least = 0U, i = 0U;
+
+  if (value < 0x80)
+  {
+    (*output) = (wchar_t)value;
+    return 1U;
+  }
+  if (0xC2 <= value && value <= 0xDF)
   {
-    if (proc->debuglog == NULL)
+    extra = 1U;
+    least = 0x80;
+    value &= 0x1F;
+  }
+  else if (0xE0 <= value && value <= 0xEF)
+  {
+    extra = 2U;
+    least = 0x800;
+    value &= 0x0F;
+  }
+  else if (0xF0 <= value && value <= 0xF4)
+  {
+    extra = 3U;
+    least = 0x10000;
+    value &= 0x07;
+  }
+
+  for (i = 1U; 0U < extra && i <= extra; i++)
+  {
+    if (count <= i || (input[i] & 0xC0) != 0x80)
+      break;
+    value = (value << 6) | (input[i] & 0x3F);
+  }
+  if (extra == 0U || i <= extra || value < least || 0x10FFFF < value ||
+      (0xD800 <= value && value <= 0xDFFF))
+  {
+    (*output) = (wchar_t)REPLACEMENT_CHARACTER;
+    return 1U;
+  }
+  (*output) = (wchar_t)value;
+  return extra + 1U;
+}
+
+// Decodes at most count bytes into at most length characters, stopping at
+// neither NUL nor anything else. Runs of ASCII are widened in bulk, only
+// the multibyte sequences between them are decoded one at a time.
+uint32_t convert_utf8(wchar_t *output, uint32_t length,
+                      const unsigned char *input, size_t count, size_t *used)
+{
+  size_t i = 0, run = 0, j = 0;
+  uint32_t written = 0U;
+
+  while (written < length && i < count)
+  {
+    run = ascii_run(input + i, min(count - i, (size_t)(length - written)));
+    if (sizeof(wchar_t) == sizeof(uint32_t))
     {
-      char filename[128] = {0};
-      sprintf(filename, "debug.log.%u", proc->pid);
-      remove(filename);
-      proc->debuglog = fopen(filename,"w");
+      widen((uint32_t *)(output + written), input + i, run);
     }
+    else
+    {
+      for (j = 0; j < run; j++)
+        output[written + j] = (wchar_t)input[i + j];
+    }
+    i += run;
+    written += (uint32_t)run;
 
-    if (proc->debuglog != NULL)
+    if (written < length && i < count && 0x80 <= input[i])
     {
-      char buffer[2048] = {0};
-      sprintf(buffer, "LOG: %s\n", message);
-      fputs(buffer, proc->debuglog);
-      fflush(proc->debuglog);
+      i += decode_utf8(input + i, count - i, output + written);
+      written += 1U;
     }
   }
-  else if (proc->debuglog != NULL)
-  {
-    fflush(proc->debuglog);
-    fclose(proc->debuglog);
-    proc->debuglog = NULL;
-  }
-  ticket_unlock(&proc->write_lock);
-#endif // _SANDBOX_DEBUG
+  if (used)
+    (*used) = i;
+  return written;
 }
 
 // --- Public ---
 
-uint32_t ncurs_convert_string(chtype *output, char *input, uint32_t length)
+// Bytes go through as they are, so anything past ASCII is taken as
+// Latin-1. The input is measured first, so no read goes past its end.
+uint32_t ncurs_convert_string(chtype *output, const char *input,
+                              uint32_t length)
 {
-  uint32_t i = 0;
-  if (sizeof(char) == sizeof(chtype))
+  uint32_t i = (uint32_t)strnlen(input, length), j = 0U;
+  if (sizeof(chtype) == sizeof(uint32_t))
   {
-    while (i < length && output[i] != '\0')
-      i += 1;
-    memcpy(output, input, i);
+    widen((uint32_t *)output, (const unsigned char *)input, i);
   }
   else
   {
-    while (i < length && input[i] != '\0')
-    {
-      output[i] = (chtype)input[i];
-      i += 1;
-    }
+    for (j = 0U; j < i; j++)
+      output[j] = (chtype)(unsigned char)input[j];
   }
   if (i < length)
     output[i] = '\0';
   return i;
 }
 
+// No character takes more than four bytes, so the input is never measured
+// further than the output can take.
+uint32_t ncurs_convert_utf8(wchar_t *output, const char *input,
+                            uint32_t length)
+{
+  size_t count = strnlen(input, (size_t)length * 4);
+  uint32_t written = convert_utf8(output, length,
+                                  (const unsigned char *)input, count, NULL);
+  if (written < length)
+    output[written] = L'\0';
+  return written;
+}
+
+// Decodes a chunk at a time into a buffer on the stack and hands each to
+// waddnwstr, which does the wrapping and scrolling.
+int32_t ncurs_write(uint32_t id, int32_t y, int32_t x, const char *text,
+                    size_t bytes)
+{
+  wchar_t chunk[WRITE_CHUNK];
+  NCursProc *proc = get_process(id);
+  const unsigned char *input = (const unsigned char *)text;
+  size_t used = 0;
+  uint32_t count = 0U;
+  int32_t written = 0;
+
+  if (proc == NULL || !proc->running || proc->main == NULL || text == NULL ||
+      wmove(proc->main, y, x) == ERR)
+    return -1;
+
+  bytes = strnlen(text, bytes);
+  while (0 < bytes)
+  {
+    count = convert_utf8(chunk, WRITE_CHUNK, input, bytes, &used);
+    if (waddnwstr(proc->main, chunk, (int)count) == ERR)
+      break;
+    written += (int32_t)count;
+    input += used;
+    bytes -= used;
+  }
+  return written;
+}
+
 void ncurs_quit(uint32_t id)
 {
   NCursProc *proc = NULL;
@@ -406,17 +1343,11 @@ void ncurs_quit(uint32_t id)
 
   if (proc != NULL)
   {
-    Pointer params = NULL;
-    int32_t sig = SIGINT;
-
-    params = calloc(1, sizeof(uint32_t) + sizeof(int32_t));
-    memcpy(params, &id, sizeof(uint32_t));
-    memcpy(params + sizeof(uint32_t), &sig, sizeof(int32_t));
-
-    if (!start_process(proc, &raise_signal, params))
+    // The event loop does the quitting, from whichever thread this is.
+    atomic_store(&(proc->quitting), true);
+    if (proc->wake_fd < 0 || eventfd_write(proc->wake_fd, 1) != 0)
     {
-      writelog(proc,
-               " !!! Failed to raise interrupt signal through a thread !!!");
+      writelog(proc, " !!! Failed to wake the event loop !!!");
       clean(proc);
       raise(SIGINT);
     }
@@ -428,7 +1359,7 @@ void ncurs_quit(uint32_t id)
 
     writelog(proc,
              " !!! Failed to get a process so using the first running process found !!!");
-    for (i = 0U, tmp = s_ncurs_main_processes; i < s_ncurs_main_process_count; i++, tmp++)
+    for (i = 0U, tmp = s_ncurs_main_processes; i < MAX_MAIN_PROCESSES; i++, tmp++)
     {
       if (tmp->running)
       {
@@ -443,61 +1374,372 @@ void ncurs_quit(uint32_t id)
   }
 }
 
+uint32_t ncurs_push_keys(uint32_t id, const chtype *keys, uint32_t count)
+{
+  NCursProc *proc = get_process(id);
+  uint32_t pushed = 0U;
+  uint64_t none = 0UL;
+
+  if (proc == NULL || keys == NULL || !pin(proc))
+    return 0U;
+  if (proc->running)
+  {
+    atomic_compare_exchange_strong(&(proc->pushed_at), &none, now_nsec());
+    pushed = ring_push_all(proc->keys, keys, count);
+    eventfd_write(proc->wake_fd, 1);
+  }
+  unpin(proc);
+  return pushed;
+}
+
+uint64_t ncurs_dropped_keys(uint32_t id)
+{
+  NCursProc *proc = get_process(id);
+  uint64_t dropped = 0UL;
+
+  if (proc == NULL || !pin(proc))
+    return 0UL;
+  if (proc->keys != NULL)
+    dropped = ring_dropped(proc->keys);
+  unpin(proc);
+  return dropped;
+}
+
+bool ncurs_key_batch(uint32_t id,
+                     void (*handle_keys_f)(const chtype *, uint32_t, Pointer),
+                     Pointer keys_data)
+{
+  NCursProc *proc = get_process(id);
+  if (proc == NULL)
+    return false;
+  ticket_lock(&(proc->keys_lock));
+  proc->handle_keys_f = handle_keys_f;
+  proc->keys_data = keys_data;
+  atomic_store(&(proc->batch_keys), handle_keys_f != NULL);
+  ticket_unlock(&(proc->keys_lock));
+  return true;
+}
+
+bool ncurs_coalesce(uint32_t id, uint32_t flags)
+{
+  NCursProc *proc = get_process(id);
+  if (proc == NULL)
+    return false;
+  atomic_store(&(proc->coalesce), flags);
+  return true;
+}
+
+bool ncurs_track_damage(uint32_t id, bool enabled)
+{
+  NCursProc *proc = get_process(id);
+  if (proc == NULL)
+    return false;
+  atomic_store(&(proc->redraw_all), true);
+  atomic_store(&(proc->track_damage), enabled);
+  return true;
+}
+
+bool ncurs_redraw_all(uint32_t id)
+{
+  NCursProc *proc = get_process(id);
+  return (proc != NULL && (!atomic_load(&(proc->track_damage)) ||
+                           atomic_load(&(proc->redraw_all))));
+}
+
+// Blanks the part of the rectangle that is on the window with its
+// background, as erase would.
+void ncurs_damage(uint32_t id, int32_t y, int32_t x, int32_t height,
+                  int32_t width)
+{
+  NCursProc *proc = get_process(id);
+  int32_t rows = 0, columns = 0, row = 0;
+
+  if (proc == NULL || !proc->running || proc->main == NULL)
+    return;
+
+  getmaxyx(proc->main, rows, columns);
+  height = min(y + height, rows) - max(y, 0);
+  width = min(x + width, columns) - max(x, 0);
+  y = max(y, 0);
+  x = max(x, 0);
+  for (row = y; row < y + height && 0 < width; row++)
+    mvwhline(proc->main, row, x, getbkgd(proc->main), width);
+}
+
+bool ncurs_frame_rate(uint32_t id, uint32_t per_second)
+{
+  NCursProc *proc = get_process(id);
+  if (proc == NULL)
+    return false;
+  atomic_store(&(proc->frame_nsec),
+               (0U < per_second ? SECOND_NSEC / per_second : 0UL));
+  return true;
+}
+
+// Switching on takes effect after the next frame, switching off wakes the
+// loop to arm the timer again.
+bool ncurs_on_demand(uint32_t id, bool enabled)
+{
+  NCursProc *proc = get_process(id);
+  if (proc == NULL)
+    return false;
+  atomic_store(&(proc->on_demand), enabled);
+  return ncurs_redraw(id);
+}
+
+bool ncurs_redraw(uint32_t id)
+{
+  NCursProc *proc = get_process(id);
+  bool woken = false;
+
+  if (proc == NULL || !pin(proc))
+    return false;
+  if (proc->running)
+  {
+    atomic_store(&(proc->frame_wanted), true);
+    woken = (eventfd_write(proc->wake_fd, 1) == 0);
+  }
+  unpin(proc);
+  return woken;
+}
+
+bool ncurs_fixed_step(uint32_t id, uint64_t step_nsec, uint32_t max_steps)
+{
+  NCursProc *proc = get_process(id);
+  if (proc == NULL)
+    return false;
+  atomic_store(&(proc->max_steps), max(max_steps, 1U));
+  atomic_store(&(proc->step_nsec), step_nsec);
+  return true;
+}
+
+// The percentile comes from the last FRAME_SAMPLES frames, the rest of the
+// figures cover every frame so far.
+bool ncurs_frame_stats_get(uint32_t id, ncurs_frame_stats *stats)
+{
+  uint32_t samples[FRAME_SAMPLES];
+  NCursProc *proc = get_process(id);
+  uint32_t count = 0U;
+
+  if (proc == NULL || stats == NULL)
+    return false;
+
+  ticket_lock(&(proc->stats_lock));
+  memcpy(stats, &(proc->stats), sizeof(ncurs_frame_stats));
+  count = (uint32_t)min(stats->frames, FRAME_SAMPLES);
+  memcpy(samples, proc->samples, count * sizeof(uint32_t));
+  ticket_unlock(&(proc->stats_lock));
+
+  if (0UL < stats->frames)
+    stats->mean_nsec = stats->total_nsec / stats->frames;
+  if (0UL < stats->frames)
+    stats->update_mean_nsec = stats->update_total_nsec / stats->frames;
+  if (0UL < stats->inputs)
+    stats->latency_mean_nsec = stats->latency_total_nsec / stats->inputs;
+  stats->p99_nsec = 0UL;
+  if (0U < count)
+  {
+    qsort(samples, count, sizeof(uint32_t), &compare_samples);
+    stats->p99_nsec = samples[(count * 99U + 99U) / 100U - 1U];
+  }
+  return true;
+}
+
+uint64_t ncurs_schedule(uint32_t id, uint64_t delay_nsec,
+                        void (*callback_f)(Pointer), Pointer data)
+{
+  return new_timer(id, delay_nsec, 0UL, callback_f, data);
+}
+
+uint64_t ncurs_repeat(uint32_t id, uint64_t delay_nsec, uint64_t period_nsec,
+                      void (*callback_f)(Pointer), Pointer data)
+{
+  if (period_nsec == 0UL)
+    return 0UL;
+  return new_timer(id, delay_nsec, period_nsec, callback_f, data);
+}
+
+// The timer is found by handle and then by its deadline, which is the key
+// it went in under or a little past it.
+bool ncurs_cancel(uint32_t id, uint64_t timer)
+{
+  NCursProc *proc = get_process(id);
+  NCursTimer *found = NULL;
+  void *value = NULL;
+  int64_t key = 0;
+
+  if (proc == NULL || timer == 0UL)
+    return false;
+
+  ticket_lock(&(proc->timers_lock));
+  proc->timer_ids = rbt_remove(proc->timer_ids, (int64_t)timer, &value);
+  found = (NCursTimer *)value;
+  if (found != NULL)
+  {
+    for (key = found->deadline; rbt_get(proc->timers, key) != found; key++)
+      ;
+    proc->timers = rbt_remove(proc->timers, key, NULL);
+    arm_timers(proc);
+  }
+  ticket_unlock(&(proc->timers_lock));
+
+  free(found);
+  return (found != NULL);
+}
+
+bool ncurs_record(uint32_t id, const char *path)
+{
+  NCursProc *proc = get_process(id);
+  TapeHeader header;
+  FILE *file = NULL, *old = NULL;
+  uint64_t frames = 0UL;
+
+  if (proc == NULL)
+    return false;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TAPE_MAGIC, sizeof(TAPE_MAGIC));
+  header.record_size = sizeof(TapeKey);
+  if (path != NULL &&
+      (!(file = fopen(path, "wb")) ||
+       fwrite(&header, sizeof(header), 1, file) != 1))
+  {
+    if (file != NULL)
+      fclose(file);
+    return false;
+  }
+
+  ticket_lock(&(proc->stats_lock));
+  frames = proc->stats.frames;
+  ticket_unlock(&(proc->stats_lock));
+
+  ticket_lock(&(proc->tape_lock));
+  old = proc->record_file;
+  proc->record_file = file;
+  proc->record_nsec = now_nsec();
+  proc->record_frame = frames;
+  atomic_store(&(proc->recording), file != NULL);
+  ticket_unlock(&(proc->tape_lock));
+
+  if (old != NULL)
+    fclose(old);
+  return true;
+}
+
+// The whole recording is read in here, so the loop never waits on the file.
+bool ncurs_replay(uint32_t id, const char *path, uint32_t speed,
+                  const char *report_path)
+{
+  NCursProc *proc = get_process(id);
+  TapeHeader header;
+  TapeKey *keys = NULL;
+  FILE *file = NULL, *report = NULL;
+  long size = 0L;
+  uint32_t count = 0U;
+  uint64_t frames = 0UL;
+
+  if (proc == NULL || path == NULL)
+    return false;
+
+  file = fopen(path, "rb");
+  if (!file || fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, TAPE_MAGIC, sizeof(TAPE_MAGIC)) != 0 ||
+      header.record_size != sizeof(TapeKey) ||
+      fseek(file, 0L, SEEK_END) != 0 || (size = ftell(file)) < 0L ||
+      fseek(file, (long)sizeof(header), SEEK_SET) != 0)
+  {
+    if (file)
+      fclose(file);
+    return false;
+  }
+  count = (uint32_t)(((size_t)size - sizeof(header)) / sizeof(TapeKey));
+  keys = (TapeKey *)malloc(max(count, 1U) * sizeof(TapeKey));
+  if (keys)
+    count = (uint32_t)fread(keys, sizeof(TapeKey), count, file);
+  fclose(file);
+  if (report_path != NULL && keys)
+    report = fopen(report_path, "w");
+  if (!keys || (report_path != NULL && !report))
+  {
+    free(keys);
+    return false;
+  }
+
+  ticket_lock(&(proc->stats_lock));
+  frames = proc->stats.frames;
+  ticket_unlock(&(proc->stats_lock));
+
+  ticket_lock(&(proc->tape_lock));
+  free(proc->replay_keys);
+  if (proc->report_file != NULL)
+    fclose(proc->report_file);
+  proc->replay_keys = keys;
+  proc->replay_count = count;
+  proc->replay_next = 0U;
+  proc->replay_speed = speed;
+  proc->replay_nsec = now_nsec();
+  proc->replay_frame = frames;
+  proc->report_file = report;
+  atomic_store(&(proc->replaying), true);
+  ticket_unlock(&(proc->tape_lock));
+  return true;
+}
+
+bool ncurs_replaying(uint32_t id)
+{
+  NCursProc *proc = get_process(id);
+  return (proc != NULL && atomic_load(&(proc->replaying)));
+}
+
 uint32_t ncurs_start(void (*update_f)(struct timespec *, Pointer),
                      Pointer update_data,
                      void (*handle_key_f)(chtype, Pointer),
                      Pointer keyhandler_data)
 {
-  uint32_t id = 0U;
-  NCursProc *proc = new_process();
-
-  if (0U < proc->id)
-  {
-    init(proc);
-    id = proc->id;
-    proc->update_f = update_f;
-    proc->handle_key_f = handle_key_f;
-    proc->update_data = update_data;
-    proc->keyhandler_data = keyhandler_data;
+  return start(new_process(), update_f, update_data, handle_key_f,
+               keyhandler_data);
+}
 
-    writelog(proc, "Starting threads");
-    if (start_process(proc, &queue_input, proc) &&
-        start_process(proc, &update, proc))
-    {
-      writelog(proc, "Start success");
-    }
-    else
-    {
-      writelog(proc, "Start failed");
-      clean(proc);
-      raise(SIGINT);
-    }
-  }  
-  return id;
+uint32_t ncurs_start_headless(void (*update_f)(struct timespec *, Pointer),
+                              Pointer update_data,
+                              void (*handle_key_f)(chtype, Pointer),
+                              Pointer keyhandler_data,
+                              int32_t rows, int32_t columns)
+{
+  NCursProc *proc = NULL;
+  if (rows <= 0 || columns <= 0 || (proc = new_process()) == NULL)
+    return 0U;
+  proc->rows = rows;
+  proc->columns = columns;
+  return start(proc, update_f, update_data, handle_key_f, keyhandler_data);
 }
 
 void ncurs_wait(uint32_t id)
 {
-  if (0U < id)
+  NCursProc *proc = get_process(id);
+  if (proc != NULL && !proc->done)
   {
-    uint32_t i = 0U;
-    NCursProc *proc = get_process(id);
-    writelog(proc, "Waiting for threads");
-    while (i < proc->current_processes)
-    {
-      writelog(proc, "Thread finished");
-      pthread_join(proc->processes[i], NULL);
-      i += 1;
-    }
+    writelog(proc, "Waiting for the event loop");
+    if (proc->started)
+      pthread_join(proc->thread, NULL);
+    proc->started = false;
+    writelog(proc, "Event loop finished");
+    release(proc);
+    finish_process(proc);
     writelog(proc, "Done");
   }
   else
   {
-    NCursProc *proc = get_process(1U);
     writelog(proc, " !!! Could not get process !!!");
   }
 }
 
+pool * ncurs_pool(uint32_t id)
+{
+  NCursProc *proc = get_process(id);
+  return (proc != NULL && proc->running ? proc->workers : NULL);
+}
+
 WINDOW *ncurs_window(uint32_t id)
 {
   if (0U < id)
@@ -0,0 +1,465 @@
+#include "pool.h"
+
+#include "ticket.h"
+
+#define CACHE_LINE (64)
+#define POOL_DEQUE (1024) // power of two
+#define POOL_QUEUE (4096)
+#define POOL_SPINS (64)
+
+typedef void (*task_f)(Pointer);
+
+typedef struct pool_task_t
+{
+  task_f function;
+  Pointer arg;
+  pool_group *group;
+} pool_task;
+
+// A deque slot is read by thieves while the owner may be writing the one
+// next to it, so its fields are atomics even though each slot only ever
+// has one writer at a time.
+typedef struct task_slot_t
+{
+  _Atomic(task_f) function;
+  _Atomic(Pointer) arg;
+  _Atomic(pool_group *) group;
+} task_slot;
+
+// Chase-Lev deque with a fixed array, following Lê et al., "Correct and
+// Efficient Work-Stealing for Weak Memory Models". The owner pushes and
+// takes at the bottom, thieves take from the top.
+typedef struct pool_deque_t
+{
+  _Alignas(CACHE_LINE) _Atomic int64_t top;
+  _Alignas(CACHE_LINE) _Atomic int64_t bottom;
+  _Alignas(CACHE_LINE) task_slot slots[POOL_DEQUE];
+} pool_deque;
+
+typedef struct pool_worker_t
+{
+  pool_deque deque;
+  pool *owner;
+  pthread_t thread;
+  uint64_t seed;
+  uint32_t index;
+} pool_worker;
+
+// One pool_for call's share of the range.
+typedef struct pool_slice_t
+{
+  void (*function)(size_t, size_t, Pointer);
+  Pointer arg;
+  size_t begin;
+  size_t end;
+} pool_slice;
+
+// Tasks from threads that are not workers of the pool wait in queue, the
+// rest in the submitting worker's deque. Workers with nothing to do sleep
+// on wake once spinning has not found them anything.
+typedef struct pool_t
+{
+  pool_worker *workers;
+  uint32_t count;
+  uint32_t started;
+  _Atomic bool stopping;
+  _Atomic uint32_t sleeping;
+  pthread_mutex_t sleep_lock;
+  pthread_cond_t wake;
+  ticket_mutex queue_lock;
+  _Atomic uint32_t queued;
+  uint32_t queue_head;
+  pool_task queue[POOL_QUEUE];
+} pool;
+
+
+static _Thread_local pool_worker *s_worker = NULL;
+
+static bool     deque_push(pool_deque *, const pool_task *);
+static bool     deque_take(pool_deque *, pool_task *);
+static bool     deque_steal(pool_deque *, pool_task *);
+static bool     queue_push(pool *, const pool_task *);
+static bool     queue_pop(pool *, pool_task *);
+static bool     has_work(pool *);
+static bool     find_task(pool *, pool_worker *, pool_task *);
+static void     run_task(pool_task *);
+static void     wake(pool *);
+static void     sleep_idle(pool *);
+static Pointer  work(Pointer);
+static void     run_slice(Pointer);
+
+static pool_worker * current(pool *);
+
+// --- Private ---
+
+bool deque_push(pool_deque *deque, const pool_task *task)
+{
+  int64_t bottom = atomic_load_explicit(&(deque->bottom), memory_order_relaxed);
+  int64_t top = atomic_load_explicit(&(deque->top), memory_order_acquire);
+  task_slot *slot = deque->slots + (bottom & (POOL_DEQUE - 1));
+
+  if (POOL_DEQUE - 1 < bottom - top)
+    return false;
+  atomic_store_explicit(&(slot->function), task->function, memory_order_relaxed);
+  atomic_store_explicit(&(slot->arg), task->arg, memory_order_relaxed);
+  atomic_store_explicit(&(slot->group), task->group, memory_order_relaxed);
+  atomic_store_explicit(&(deque->bottom), bottom + 1, memory_order_release);
+  return true;
+}
+
+// Takes the newest task. Only the last one left can race with a thief, and
+// the top decides which of them gets it.
+bool deque_take(pool_deque *deque, pool_task *task)
+{
+  int64_t bottom = atomic_load_explicit(&(deque->bottom), memory_order_relaxed) - 1;
+  int64_t top = 0;
+  task_slot *slot = deque->slots + (bottom & (POOL_DEQUE - 1));
+  bool taken = true;
+
+  atomic_store_explicit(&(deque->bottom), bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  top = atomic_load_explicit(&(deque->top), memory_order_relaxed);
+  if (bottom < top)
+  {
+    atomic_store_explicit(&(deque->bottom), bottom + 1, memory_order_relaxed);
+    return false;
+  }
+
+  task->function = atomic_load_explicit(&(slot->function), memory_order_relaxed);
+  task->arg = atomic_load_explicit(&(slot->arg), memory_order_relaxed);
+  task->group = atomic_load_explicit(&(slot->group), memory_order_relaxed);
+  if (top == bottom)
+  {
+    taken = atomic_compare_exchange_strong_explicit(&(deque->top), &top,
+                                                    top + 1,
+                                                    memory_order_seq_cst,
+                                                    memory_order_relaxed);
+    atomic_store_explicit(&(deque->bottom), bottom + 1, memory_order_relaxed);
+  }
+  return taken;
+}
+
+// Takes the oldest task, or gives up when another thread got there first.
+bool deque_steal(pool_deque *deque, pool_task *task)
+{
+  int64_t top = atomic_load_explicit(&(deque->top), memory_order_acquire);
+  int64_t bottom = 0;
+  task_slot *slot = deque->slots + (top & (POOL_DEQUE - 1));
+
+  atomic_thread_fence(memory_order_seq_cst);
+  bottom = atomic_load_explicit(&(deque->bottom), memory_order_acquire);
+  if (bottom <= top)
+    return false;
+
+  task->function = atomic_load_explicit(&(slot->function), memory_order_relaxed);
+  task->arg = atomic_load_explicit(&(slot->arg), memory_order_relaxed);
+  task->group = atomic_load_explicit(&(slot->group), memory_order_relaxed);
+  return atomic_compare_exchange_strong_explicit(&(deque->top), &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed);
+}
+
+bool queue_push(pool *workers, const pool_task *task)
+{
+  uint32_t queued = 0;
+  bool pushed = false;
+
+  ticket_lock(&(workers->queue_lock));
+  queued = atomic_load_explicit(&(workers->queued), memory_order_relaxed);
+  if (queued < POOL_QUEUE)
+  {
+    memcpy(workers->queue + (workers->queue_head + queued) % POOL_QUEUE, task,
+           sizeof(pool_task));
+    atomic_store(&(workers->queued), queued + 1);
+    pushed = true;
+  }
+  ticket_unlock(&(workers->queue_lock));
+  return pushed;
+}
+
+// The count is checked before taking the lock, idle workers poll this.
+bool queue_pop(pool *workers, pool_task *task)
+{
+  uint32_t queued = 0;
+  bool popped = false;
+
+  if (atomic_load_explicit(&(workers->queued), memory_order_relaxed) == 0)
+    return false;
+
+  ticket_lock(&(workers->queue_lock));
+  queued = atomic_load_explicit(&(workers->queued), memory_order_relaxed);
+  if (0 < queued)
+  {
+    memcpy(task, workers->queue + workers->queue_head, sizeof(pool_task));
+    workers->queue_head = (workers->queue_head + 1) % POOL_QUEUE;
+    atomic_store(&(workers->queued), queued - 1);
+    popped = true;
+  }
+  ticket_unlock(&(workers->queue_lock));
+  return popped;
+}
+
+bool has_work(pool *workers)
+{
+  uint32_t i = 0;
+  if (0 < atomic_load(&(workers->queued)))
+    return true;
+  for (i = 0; i < workers->count; i++)
+  {
+    if (atomic_load(&(workers->workers[i].deque.top)) <
+        atomic_load(&(workers->workers[i].deque.bottom)))
+      return true;
+  }
+  return false;
+}
+
+// Own deque first, then the shared queue, then the other workers from a
+// random one on.
+bool find_task(pool *workers, pool_worker *worker, pool_task *task)
+{
+  uint32_t i = 0, start = 0, victim = 0;
+
+  if (worker && deque_take(&(worker->deque), task))
+    return true;
+  if (queue_pop(workers, task))
+    return true;
+  if (workers->count == 0)
+    return false;
+
+  if (worker)
+  {
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 7;
+    worker->seed ^= worker->seed << 17;
+    start = (uint32_t)(worker->seed % workers->count);
+  }
+  for (i = 0; i < workers->count; i++)
+  {
+    victim = (start + i) % workers->count;
+    if (workers->workers + victim != worker &&
+        deque_steal(&(workers->workers[victim].deque), task))
+      return true;
+  }
+  return false;
+}
+
+void run_task(pool_task *task)
+{
+  task->function(task->arg);
+  if (task->group)
+    atomic_fetch_sub_explicit(&(task->group->pending), 1,
+                              memory_order_release);
+}
+
+// The fence pairs with the one in sleep_idle: either the sleeper sees the
+// new task or this sees the sleeper.
+void wake(pool *workers)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (0 < atomic_load_explicit(&(workers->sleeping), memory_order_relaxed))
+  {
+    pthread_mutex_lock(&(workers->sleep_lock));
+    pthread_cond_signal(&(workers->wake));
+    pthread_mutex_unlock(&(workers->sleep_lock));
+  }
+}
+
+void sleep_idle(pool *workers)
+{
+  pthread_mutex_lock(&(workers->sleep_lock));
+  atomic_fetch_add_explicit(&(workers->sleeping), 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load(&(workers->stopping)) && !has_work(workers))
+    pthread_cond_wait(&(workers->wake), &(workers->sleep_lock));
+  atomic_fetch_sub_explicit(&(workers->sleeping), 1, memory_order_relaxed);
+  pthread_mutex_unlock(&(workers->sleep_lock));
+}
+
+Pointer work(Pointer arg)
+{
+  pool_worker *worker = (pool_worker *)arg;
+  pool *workers = worker->owner;
+  pool_task task = {0};
+  uint32_t idle = 0;
+
+  s_worker = worker;
+  while (!atomic_load(&(workers->stopping)))
+  {
+    if (find_task(workers, worker, &task))
+    {
+      run_task(&task);
+      idle = 0;
+    }
+    else if (++idle < POOL_SPINS)
+    {
+      sched_yield();
+    }
+    else
+    {
+      sleep_idle(workers);
+      idle = 0;
+    }
+  }
+  return NULL;
+}
+
+pool_worker * current(pool *workers)
+{
+  return (s_worker && s_worker->owner == workers ? s_worker : NULL);
+}
+
+void run_slice(Pointer arg)
+{
+  pool_slice *slice = (pool_slice *)arg;
+  slice->function(slice->begin, slice->end, slice->arg);
+}
+
+// --- Public ---
+
+pool * pool_create(uint32_t count)
+{
+  size_t size = (sizeof(pool) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  ticket_mutex lock = TICKET_MUTEX_INITIALIZER;
+  pool *workers = NULL;
+  long cpus = 0;
+  uint32_t i = 0;
+
+  if (count == 0)
+  {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    count = (1 < cpus ? (uint32_t)(cpus - 1) : 0);
+  }
+
+  workers = (pool *)aligned_alloc(CACHE_LINE, size);
+  if (!workers)
+    return NULL;
+  memset(workers, 0, sizeof(pool));
+  memcpy(&(workers->queue_lock), &lock, sizeof(ticket_mutex));
+  pthread_mutex_init(&(workers->sleep_lock), NULL);
+  pthread_cond_init(&(workers->wake), NULL);
+
+  size = (count * sizeof(pool_worker) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  if (0 < count)
+  {
+    workers->workers = (pool_worker *)aligned_alloc(CACHE_LINE, size);
+    if (!workers->workers)
+    {
+      pool_destroy(workers);
+      return NULL;
+    }
+    memset(workers->workers, 0, size);
+  }
+
+  workers->count = count;
+  for (i = 0; i < count; i++)
+  {
+    workers->workers[i].owner = workers;
+    workers->workers[i].index = i;
+    workers->workers[i].seed = 0x9e3779b97f4a7c15UL ^ i;
+  }
+  for (i = 0; i < count; i++)
+  {
+    if (pthread_create(&(workers->workers[i].thread), NULL, &work,
+                       workers->workers + i) != 0)
+    {
+      pool_destroy(workers);
+      return NULL;
+    }
+    workers->started += 1;
+  }
+  return workers;
+}
+
+// Tasks still queued are dropped, wait on their groups first.
+void pool_destroy(pool *workers)
+{
+  uint32_t i = 0;
+  if (!workers)
+    return;
+
+  atomic_store(&(workers->stopping), true);
+  pthread_mutex_lock(&(workers->sleep_lock));
+  pthread_cond_broadcast(&(workers->wake));
+  pthread_mutex_unlock(&(workers->sleep_lock));
+  for (i = 0; i < workers->started; i++)
+    pthread_join(workers->workers[i].thread, NULL);
+
+  pthread_cond_destroy(&(workers->wake));
+  pthread_mutex_destroy(&(workers->sleep_lock));
+  free(workers->workers);
+  free(workers);
+}
+
+uint32_t pool_workers(pool *workers)
+{
+  return workers->count;
+}
+
+void pool_submit(pool *workers, pool_group *group, void (*function)(Pointer),
+                 Pointer arg)
+{
+  pool_worker *worker = current(workers);
+  pool_task task = {0};
+  bool queued = false;
+
+  task.function = function;
+  task.arg = arg;
+  task.group = group;
+  if (group)
+    atomic_fetch_add_explicit(&(group->pending), 1, memory_order_relaxed);
+
+  if (worker)
+    queued = deque_push(&(worker->deque), &task);
+  else if (0 < workers->count)
+    queued = queue_push(workers, &task);
+
+  if (queued)
+    wake(workers);
+  else
+    run_task(&task);
+}
+
+void pool_wait(pool *workers, pool_group *group)
+{
+  pool_worker *worker = current(workers);
+  pool_task task = {0};
+
+  while (group &&
+         0 < atomic_load_explicit(&(group->pending), memory_order_acquire))
+  {
+    if (find_task(workers, worker, &task))
+      run_task(&task);
+    else
+      sched_yield();
+  }
+}
+
+void pool_for(pool *workers, size_t count, size_t grain,
+              void (*function)(size_t, size_t, Pointer), Pointer arg)
+{
+  pool_group group = POOL_GROUP_INITIALIZER;
+  pool_slice *slices = NULL;
+  size_t total = 0, i = 0;
+
+  if (count == 0)
+    return;
+  if (grain == 0)
+    grain = max(count / ((workers->count + 1) * 4), 1);
+  total = (count + grain - 1) / grain;
+  if (total == 1 || !(slices = (pool_slice *)calloc(total, sizeof(pool_slice))))
+  {
+    function(0, count, arg);
+    return;
+  }
+
+  for (i = 0; i < total; i++)
+  {
+    slices[i].function = function;
+    slices[i].arg = arg;
+    slices[i].begin = i * grain;
+    slices[i].end = min(count, (i + 1) * grain);
+    pool_submit(workers, &group, &run_slice, slices + i);
+  }
+  pool_wait(workers, &group);
+  free(slices);
+}
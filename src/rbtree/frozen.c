@@ -0,0 +1,137 @@
+#include "rbtree.h"
+
+#define CACHE_LINE (64)
+// Keys per cache line. The descendants of slot k that lie this many levels
+// down sit side by side from k * PREFETCH_STRIDE, so one prefetch covers
+// a whole level well before the search gets there.
+#define PREFETCH_STRIDE (CACHE_LINE / sizeof(int64_t))
+
+// Keys in BFS (Eytzinger) order, slot k has its children at 2k and 2k + 1
+// and slot 0 is unused. The top levels that every search goes through share
+// the first few cache lines.
+typedef struct rbt_frozen_t
+{
+  int64_t *keys;
+  void **values;
+  size_t *sizes;
+  size_t count;
+} rbt_frozen;
+
+
+static size_t layout(rbt_frozen *, const int64_t *, void **, const size_t *,
+                     size_t, size_t);
+static size_t search(rbt_frozen *, int64_t);
+
+// --- Private ---
+
+// Places the sorted entries with an in-order walk of the implicit tree,
+// returns the next sorted index to place.
+size_t layout(rbt_frozen *frozen, const int64_t *keys, void **values,
+              const size_t *sizes, size_t next, size_t slot)
+{
+  if (frozen->count < slot)
+    return next;
+
+  next = layout(frozen, keys, values, sizes, next, 2 * slot);
+  frozen->keys[slot] = keys[next];
+  frozen->values[slot] = values[next];
+  frozen->sizes[slot] = sizes[next];
+  next += 1;
+  return layout(frozen, keys, values, sizes, next, 2 * slot + 1);
+}
+
+// Slot holding the key or 0. The descent has no data dependent branches,
+// every level costs one compare and one add.
+size_t search(rbt_frozen *frozen, int64_t key)
+{
+  const int64_t *keys = frozen->keys;
+  size_t k = 1;
+  while (k <= frozen->count)
+  {
+    __builtin_prefetch(keys + k * PREFETCH_STRIDE);
+    k = 2 * k + (keys[k] < key);
+  }
+  // Undo the right turns taken after the last left one, which lands on the
+  // smallest key not below the searched one.
+  k >>= __builtin_ffsl(~k);
+  return (k != 0 && keys[k] == key) ? k : 0;
+}
+
+// --- Public ---
+
+rbt_frozen * rbt_freeze(rbt_node *root)
+{
+  rbt_frozen *frozen = NULL;
+  int64_t *keys = NULL;
+  void **values = NULL;
+  size_t *sizes = NULL;
+  size_t count = rbt_size(root);
+  size_t bytes = 0;
+
+  frozen = (rbt_frozen *)calloc(1, sizeof(rbt_frozen));
+  if (!frozen)
+    return NULL;
+
+  bytes = ((count + 1) * sizeof(int64_t) + CACHE_LINE - 1) &
+    ~((size_t)CACHE_LINE - 1);
+  frozen->count = count;
+  frozen->keys = (int64_t *)aligned_alloc(CACHE_LINE, bytes);
+  frozen->values = (void **)calloc(count + 1, sizeof(void *));
+  frozen->sizes = (size_t *)calloc(count + 1, sizeof(size_t));
+
+  keys = (int64_t *)calloc(count + 1, sizeof(int64_t));
+  values = (void **)calloc(count + 1, sizeof(void *));
+  sizes = (size_t *)calloc(count + 1, sizeof(size_t));
+
+  if (frozen->keys && frozen->values && frozen->sizes &&
+      keys && values && sizes)
+  {
+    frozen->keys[0] = INT64_MIN;
+    rbt_export(root, keys, values, sizes, count);
+    layout(frozen, keys, values, sizes, 0, 1);
+  }
+  else
+  {
+    rbt_frozen_free(frozen);
+    frozen = NULL;
+  }
+
+  free(keys);
+  free(values);
+  free(sizes);
+  return frozen;
+}
+
+void * rbt_frozen_get(rbt_frozen *frozen, int64_t key)
+{
+  size_t k = 0;
+  if (!frozen)
+    return NULL;
+  k = search(frozen, key);
+  return k ? frozen->values[k] : NULL;
+}
+
+size_t rbt_frozen_data_size(rbt_frozen *frozen, int64_t key)
+{
+  size_t k = 0;
+  if (!frozen)
+    return -1;
+  k = search(frozen, key);
+  return k ? frozen->sizes[k] : (size_t)-1;
+}
+
+size_t rbt_frozen_size(rbt_frozen *frozen)
+{
+  return frozen ? frozen->count : 0;
+}
+
+void rbt_frozen_free(rbt_frozen *frozen)
+{
+  if (frozen)
+  {
+    free(frozen->keys);
+    free(frozen->values);
+    free(frozen->sizes);
+    free(frozen);
+  }
+}
@@ -0,0 +1,340 @@
+#include "rbtree.h"
+
+// Closed interval [lo, hi], ordered by lo and then hi. max is the largest hi
+// in the subtree, which is what lets an overlap query skip whole subtrees.
+typedef struct rbt_interval_t
+{
+  struct rbt_interval_t *left;
+  struct rbt_interval_t *right;
+  int64_t lo;
+  int64_t hi;
+  int64_t max;
+  uint64_t size;
+  void *data;
+  bool red;
+} rbt_interval;
+
+
+static int            compare(rbt_interval *, int64_t, int64_t);
+static bool           is_red(rbt_interval *);
+static uint64_t       size(rbt_interval *);
+static void           update(rbt_interval *);
+static rbt_interval * find(rbt_interval *, int64_t, int64_t);
+static void           flip_colours(rbt_interval *);
+static rbt_interval * rotate_left(rbt_interval *);
+static rbt_interval * rotate_right(rbt_interval *);
+static rbt_interval * move_red_left(rbt_interval *);
+static rbt_interval * move_red_right(rbt_interval *);
+static rbt_interval * balance(rbt_interval *);
+static rbt_interval * put_node(rbt_interval *, int64_t, int64_t, void *,
+                               void **);
+static rbt_interval * remove_node(rbt_interval *, int64_t, int64_t, void **);
+static rbt_interval * remove_first(rbt_interval *, rbt_interval *);
+static bool           overlaps(rbt_interval *, int64_t, int64_t,
+                               bool (*)(int64_t, int64_t, void *, Pointer),
+                               Pointer, size_t *);
+
+// --- Private ---
+
+int compare(rbt_interval *node, int64_t lo, int64_t hi)
+{
+  if (lo == node->lo && hi == node->hi)
+    return 0;
+  if (lo != node->lo)
+    return (lo < node->lo ? -1 : 1);
+  return (hi < node->hi ? -1 : 1);
+}
+
+bool is_red(rbt_interval *node)
+{
+  return (node && node->red);
+}
+
+uint64_t size(rbt_interval *node)
+{
+  return node ? node->size : 0;
+}
+
+// Recomputes the size and the max endpoint from the children, every
+// rotation and rebalance ends with this.
+void update(rbt_interval *node)
+{
+  node->size = size(node->left) + size(node->right) + 1;
+  node->max = node->hi;
+  if (node->left && node->max < node->left->max)
+    node->max = node->left->max;
+  if (node->right && node->max < node->right->max)
+    node->max = node->right->max;
+}
+
+rbt_interval * find(rbt_interval *root, int64_t lo, int64_t hi)
+{
+  rbt_interval *n = root;
+  int order = 0;
+  while (n)
+  {
+    order = compare(n, lo, hi);
+    if (order == 0)
+      break;
+    n = (order < 0 ? n->left : n->right);
+  }
+  return n;
+}
+
+void flip_colours(rbt_interval *node)
+{
+  node->red = !node->red;
+  if (node->left)
+    node->left->red = !node->left->red;
+  if (node->right)
+    node->right->red = !node->right->red;
+}
+
+rbt_interval * rotate_left(rbt_interval *node)
+{
+  rbt_interval *old = node->right;
+  node->right = old->left;
+  old->left = node;
+  old->red = node->red;
+  node->red = true;
+  update(node);
+  update(old);
+  return old;
+}
+
+rbt_interval * rotate_right(rbt_interval *node)
+{
+  rbt_interval *old = node->left;
+  node->left = old->right;
+  old->right = node;
+  old->red = node->red;
+  node->red = true;
+  update(node);
+  update(old);
+  return old;
+}
+
+rbt_interval * move_red_left(rbt_interval *node)
+{
+  flip_colours(node);
+  if (node->right && is_red(node->right->left))
+  {
+    node->right = rotate_right(node->right);
+    node = rotate_left(node);
+    flip_colours(node);
+  }
+  return node;
+}
+
+rbt_interval * move_red_right(rbt_interval *node)
+{
+  flip_colours(node);
+  if (node->left && is_red(node->left->left))
+  {
+    node = rotate_right(node);
+    flip_colours(node);
+  }
+  return node;
+}
+
+rbt_interval * balance(rbt_interval *root)
+{
+  rbt_interval *node = root;
+  if (is_red(node->right) && !is_red(node->left))
+    node = rotate_left(node);
+  if (is_red(node->left) && is_red(node->left->left))
+    node = rotate_right(node);
+  if (is_red(node->left) && is_red(node->right))
+    flip_colours(node);
+
+  update(node);
+  return node;
+}
+
+rbt_interval * put_node(rbt_interval *root, int64_t lo, int64_t hi,
+                        void *data, void **old_data)
+{
+  rbt_interval *node = root;
+  int order = 0;
+  if (!node)
+  {
+    node = (rbt_interval *)calloc(1, sizeof(rbt_interval));
+    node->lo = lo;
+    node->hi = hi;
+    node->max = hi;
+    node->size = 1;
+    node->data = data;
+    node->red = true;
+    return node;
+  }
+
+  order = compare(node, lo, hi);
+  if (order < 0)
+  {
+    node->left = put_node(node->left, lo, hi, data, old_data);
+  }
+  else if (0 < order)
+  {
+    node->right = put_node(node->right, lo, hi, data, old_data);
+  }
+  else
+  {
+    if (old_data && node->data != data)
+      (*old_data) = node->data;
+    node->data = data;
+  }
+  return balance(node);
+}
+
+// Expects the interval to be in the tree.
+rbt_interval * remove_node(rbt_interval *root, int64_t lo, int64_t hi,
+                           void **data)
+{
+  rbt_interval *node = root;
+
+  if (compare(node, lo, hi) < 0)
+  {
+    if (!is_red(node->left) && !is_red(node->left->left))
+      node = move_red_left(node);
+    node->left = remove_node(node->left, lo, hi, data);
+  }
+  else
+  {
+    if (is_red(node->left))
+      node = rotate_right(node);
+
+    if (compare(node, lo, hi) == 0 && !node->right)
+    {
+      if (data)
+        (*data) = node->data;
+      free(node);
+      return NULL;
+    }
+
+    if (!is_red(node->right) && !is_red(node->right->left))
+      node = move_red_right(node);
+
+    if (compare(node, lo, hi) == 0)
+    {
+      if (data)
+        (*data) = node->data;
+      node->right = remove_first(node->right, node);
+    }
+    else
+    {
+      node->right = remove_node(node->right, lo, hi, data);
+    }
+  }
+  return balance(node);
+}
+
+// Removes the smallest interval and moves it into the given node.
+rbt_interval * remove_first(rbt_interval *root, rbt_interval *into)
+{
+  rbt_interval *node = root;
+  if (!node->left)
+  {
+    into->lo = node->lo;
+    into->hi = node->hi;
+    into->data = node->data;
+    free(node);
+    return NULL;
+  }
+
+  if (!is_red(node->left) && !is_red(node->left->left))
+    node = move_red_left(node);
+  node->left = remove_first(node->left, into);
+  return balance(node);
+}
+
+// Visits the overlapping intervals in order. A subtree whose max is below lo
+// holds nothing that reaches the query, and nothing right of a node that
+// starts after hi can overlap either. Every node visited is then on the
+// path to a reported interval or to one of the two query ends.
+bool overlaps(rbt_interval *node, int64_t lo, int64_t hi,
+              bool (*callback)(int64_t, int64_t, void *, Pointer),
+              Pointer ctx, size_t *count)
+{
+  if (!node || node->max < lo)
+    return true;
+
+  if (!overlaps(node->left, lo, hi, callback, ctx, count))
+    return false;
+  if (hi < node->lo)
+    return true;
+
+  if (lo <= node->hi)
+  {
+    (*count) += 1;
+    if (callback && !callback(node->lo, node->hi, node->data, ctx))
+      return false;
+  }
+  return overlaps(node->right, lo, hi, callback, ctx, count);
+}
+
+// --- Public ---
+
+void * rbt_interval_get(rbt_interval *root, int64_t lo, int64_t hi)
+{
+  rbt_interval *n = find(root, lo, hi);
+  return n ? n->data : NULL;
+}
+
+rbt_interval * rbt_interval_put(rbt_interval *root, int64_t lo, int64_t hi,
+                                void *data, void **old_data)
+{
+  rbt_interval *r = NULL;
+  if (old_data)
+    (*old_data) = NULL;
+  if (hi < lo)
+    return root;
+
+  r = put_node(root, lo, hi, data, old_data);
+  r->red = false;
+  return r;
+}
+
+rbt_interval * rbt_interval_remove(rbt_interval *root, int64_t lo, int64_t hi,
+                                   void **data)
+{
+  rbt_interval *r = root;
+  if (data)
+    (*data) = NULL;
+
+  if (find(root, lo, hi))
+  {
+    if (!is_red(r->left) && !is_red(r->right))
+      r->red = true;
+    r = remove_node(r, lo, hi, data);
+    if (r)
+      r->red = false;
+  }
+  return r;
+}
+
+size_t rbt_interval_size(rbt_interval *root)
+{
+  return size(root);
+}
+
+size_t rbt_overlaps(rbt_interval *root, int64_t lo, int64_t hi,
+                    bool (*callback)(int64_t, int64_t, void *, Pointer),
+                    Pointer ctx)
+{
+  size_t count = 0;
+  if (lo <= hi)
+    overlaps(root, lo, hi, callback, ctx, &count);
+  return count;
+}
+
+void rbt_interval_free(rbt_interval *root, void (*data_free)(void *))
+{
+  if (!root)
+    return;
+
+  rbt_interval_free(root->left, data_free);
+  rbt_interval_free(root->right, data_free);
+  if (root->data && data_free)
+    data_free(root->data);
+  free(root);
+}
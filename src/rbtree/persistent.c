@@ -0,0 +1,586 @@
+#include "prbtree.h"
+
+#include "ticket.h"
+#include "rbtree.h"
+
+#include <stdatomic.h>
+
+#define CACHE_LINE (64)
+
+// Nodes are immutable once a published root can reach them. Only the update
+// whose generation matches may still change a node, every other node is
+// copied first.
+typedef struct prbt_node_t
+{
+  struct prbt_node_t *left;
+  struct prbt_node_t *right;
+  int64_t key;
+  void *data;
+  size_t data_size;
+  uint64_t size;
+  uint64_t generation;
+  uint32_t refs;
+  bool red;
+} prbt_node;
+
+// A replaced root, and the value the update dropped, waiting for the
+// readers that may still see them.
+typedef struct prbt_retired_t
+{
+  prbt_node *root;
+  void *data;
+  uint64_t epoch;
+  struct prbt_retired_t *next;
+} prbt_retired;
+
+typedef struct prbt_reader_slot_t
+{
+  _Atomic uint64_t epoch; // 0 while outside a read
+  _Atomic bool used;
+  char padding[CACHE_LINE - sizeof(uint64_t) - sizeof(bool)];
+} prbt_reader_slot;
+
+typedef struct prbt_tree_t
+{
+  prbt_reader_slot readers[PRBTREE_MAX_READERS];
+  _Atomic(prbt_node *) root;
+  _Atomic uint64_t epoch;
+  ticket_mutex write_lock;
+  uint64_t generation;
+  prbt_retired *retired;
+  prbt_retired *retired_tail;
+  void (*data_free)(void *);
+} prbt_tree;
+
+
+static prbt_node * left(prbt_node *);
+static prbt_node * right(prbt_node *);
+static bool        is_red(prbt_node *);
+static uint64_t    size(prbt_node *);
+static prbt_node * find(prbt_node *, int64_t);
+
+static prbt_node * node_new(prbt_tree *, int64_t, void *, size_t);
+static prbt_node * own(prbt_tree *, prbt_node *);
+static void        release(prbt_node *);
+static void        flip_colours(prbt_tree *, prbt_node *);
+static prbt_node * rotate_left(prbt_tree *, prbt_node *);
+static prbt_node * rotate_right(prbt_tree *, prbt_node *);
+static prbt_node * move_red_left(prbt_tree *, prbt_node *);
+static prbt_node * move_red_right(prbt_tree *, prbt_node *);
+static prbt_node * balance(prbt_tree *, prbt_node *);
+static prbt_node * put_node(prbt_tree *, prbt_node *, int64_t, void *, size_t,
+                            void **);
+static prbt_node * remove_node(prbt_tree *, prbt_node *, int64_t, void **);
+static prbt_node * remove_first(prbt_tree *, prbt_node *, prbt_node *);
+static void        publish(prbt_tree *, prbt_node *, prbt_node *, void *);
+static void        reclaim(prbt_tree *);
+static bool        free_visit(int64_t, void *, Pointer);
+
+// --- Private ---
+
+prbt_node * left(prbt_node *node)
+{
+  return node ? node->left : NULL;
+}
+
+prbt_node * right(prbt_node *node)
+{
+  return node ? node->right : NULL;
+}
+
+bool is_red(prbt_node *node)
+{
+  return (node && node->red);
+}
+
+uint64_t size(prbt_node *node)
+{
+  return node ? node->size : 0;
+}
+
+prbt_node * find(prbt_node *root, int64_t key)
+{
+  prbt_node *n = root;
+  while (n)
+  {
+    if (key == n->key)
+      break;
+    if (key < n->key)
+      n = left(n);
+    else
+      n = right(n);
+  }
+  return n;
+}
+
+prbt_node * node_new(prbt_tree *tree, int64_t key, void *data,
+                     size_t data_size)
+{
+  prbt_node *node = (prbt_node *)calloc(1, sizeof(prbt_node));
+  node->key = key;
+  node->data = data;
+  node->data_size = data_size;
+  node->size = 1;
+  node->generation = tree->generation;
+  node->refs = 1;
+  node->red = true;
+  return node;
+}
+
+// Every child pointer holds one reference. Takes over the reference the
+// caller held on the node and returns a node the current update may change,
+// copying it when an older version can still reach it.
+prbt_node * own(prbt_tree *tree, prbt_node *node)
+{
+  prbt_node *copy = NULL;
+  if (!node || node->generation == tree->generation)
+    return node;
+
+  copy = (prbt_node *)malloc(sizeof(prbt_node));
+  memcpy(copy, node, sizeof(prbt_node));
+  copy->generation = tree->generation;
+  copy->refs = 1;
+  if (copy->left)
+    copy->left->refs += 1;
+  if (copy->right)
+    copy->right->refs += 1;
+
+  release(node);
+  return copy;
+}
+
+void release(prbt_node *node)
+{
+  if (!node)
+    return;
+
+  node->refs -= 1;
+  if (node->refs == 0)
+  {
+    release(node->left);
+    release(node->right);
+    free(node);
+  }
+}
+
+void flip_colours(prbt_tree *tree, prbt_node *node)
+{
+  node->left = own(tree, node->left);
+  node->right = own(tree, node->right);
+
+  node->red = !node->red;
+  if (node->left)
+    node->left->red = !node->left->red;
+  if (node->right)
+    node->right->red = !node->right->red;
+}
+
+prbt_node * rotate_left(prbt_tree *tree, prbt_node *node)
+{
+  prbt_node *old = NULL;
+  node->right = own(tree, node->right);
+  old = node->right;
+
+  node->right = old->left;
+  old->left = node;
+  old->red = node->red;
+  node->red = true;
+  old->size = node->size;
+  node->size = size(left(node)) + size(right(node)) + 1;
+  return old;
+}
+
+prbt_node * rotate_right(prbt_tree *tree, prbt_node *node)
+{
+  prbt_node *old = NULL;
+  node->left = own(tree, node->left);
+  old = node->left;
+
+  node->left = old->right;
+  old->right = node;
+  old->red = node->red;
+  node->red = true;
+  old->size = node->size;
+  node->size = size(left(node)) + size(right(node)) + 1;
+  return old;
+}
+
+prbt_node * move_red_left(prbt_tree *tree, prbt_node *node)
+{
+  flip_colours(tree, node);
+  if (is_red(left(right(node))))
+  {
+    node->right = rotate_right(tree, node->right);
+    node = rotate_left(tree, node);
+    flip_colours(tree, node);
+  }
+  return node;
+}
+
+prbt_node * move_red_right(prbt_tree *tree, prbt_node *node)
+{
+  flip_colours(tree, node);
+  if (is_red(left(left(node))))
+  {
+    node = rotate_right(tree, node);
+    flip_colours(tree, node);
+  }
+  return node;
+}
+
+// Only ever called on nodes of the current update. Whatever it rotates or
+// recolours beyond them goes through own() in the helpers.
+prbt_node * balance(prbt_tree *tree, prbt_node *node)
+{
+  if (is_red(right(node)) && !is_red(left(node)))
+    node = rotate_left(tree, node);
+  if (is_red(left(node)) && is_red(left(left(node))))
+    node = rotate_right(tree, node);
+  if (is_red(left(node)) && is_red(right(node)))
+    flip_colours(tree, node);
+
+  node->size = size(left(node)) + size(right(node)) + 1;
+  return node;
+}
+
+prbt_node * put_node(prbt_tree *tree, prbt_node *root, int64_t key,
+                     void *data, size_t data_size, void **old_data)
+{
+  prbt_node *node = NULL;
+  if (!root)
+    return node_new(tree, key, data, data_size);
+
+  node = own(tree, root);
+  if (key < node->key)
+  {
+    node->left = put_node(tree, node->left, key, data, data_size, old_data);
+  }
+  else if (node->key < key)
+  {
+    node->right = put_node(tree, node->right, key, data, data_size,
+                           old_data);
+  }
+  else
+  {
+    if (node->data != data)
+      (*old_data) = node->data;
+    node->data = data;
+    node->data_size = data_size;
+  }
+
+  return balance(tree, node);
+}
+
+// Expects the key to be in the tree.
+prbt_node * remove_node(prbt_tree *tree, prbt_node *root, int64_t key,
+                        void **data)
+{
+  prbt_node *node = own(tree, root);
+
+  if (key < node->key)
+  {
+    if (!is_red(left(node)) && !is_red(left(left(node))))
+      node = move_red_left(tree, node);
+    node->left = remove_node(tree, node->left, key, data);
+  }
+  else
+  {
+    if (is_red(left(node)))
+      node = rotate_right(tree, node);
+
+    if (key == node->key && !right(node))
+    {
+      (*data) = node->data;
+      release(node);
+      return NULL;
+    }
+
+    if (!is_red(right(node)) && !is_red(left(right(node))))
+      node = move_red_right(tree, node);
+
+    if (key == node->key)
+    {
+      // The node is a private copy by now, so it can take over the smallest
+      // entry of its right subtree in place.
+      (*data) = node->data;
+      node->right = remove_first(tree, node->right, node);
+    }
+    else
+    {
+      node->right = remove_node(tree, node->right, key, data);
+    }
+  }
+
+  return balance(tree, node);
+}
+
+// Removes the smallest entry and moves it into the given node.
+prbt_node * remove_first(prbt_tree *tree, prbt_node *root, prbt_node *into)
+{
+  prbt_node *node = NULL;
+  if (!left(root))
+  {
+    into->key = root->key;
+    into->data = root->data;
+    into->data_size = root->data_size;
+    release(root);
+    return NULL;
+  }
+
+  node = own(tree, root);
+  if (!is_red(left(node)) && !is_red(left(left(node))))
+    node = move_red_left(tree, node);
+  node->left = remove_first(tree, node->left, into);
+
+  return balance(tree, node);
+}
+
+// Swaps in the new root and queues the old one, with the value the update
+// dropped, until no reader can see them any more.
+void publish(prbt_tree *tree, prbt_node *old_root, prbt_node *new_root,
+             void *old_data)
+{
+  prbt_retired *retired = NULL;
+
+  if (new_root)
+    new_root->red = false;
+  atomic_store(&(tree->root), new_root);
+
+  retired = (prbt_retired *)calloc(1, sizeof(prbt_retired));
+  retired->root = old_root;
+  retired->data = old_data;
+  retired->epoch = atomic_fetch_add(&(tree->epoch), 1);
+  if (tree->retired_tail)
+    tree->retired_tail->next = retired;
+  else
+    tree->retired = retired;
+  tree->retired_tail = retired;
+
+  reclaim(tree);
+}
+
+// Expects write_lock held, the retired list belongs to the writers.
+void reclaim(prbt_tree *tree)
+{
+  uint64_t oldest = UINT64_MAX;
+  uint64_t epoch = 0;
+  prbt_retired *retired = NULL;
+  uint32_t i = 0;
+
+  for (i = 0; i < PRBTREE_MAX_READERS; i++)
+  {
+    epoch = atomic_load(&(tree->readers[i].epoch));
+    if (epoch != 0 && epoch < oldest)
+      oldest = epoch;
+  }
+
+  // A reader that entered at epoch e may hold any root retired at e or
+  // later. The list is in epoch order.
+  while ((retired = tree->retired) && retired->epoch < oldest)
+  {
+    tree->retired = retired->next;
+    if (!tree->retired)
+      tree->retired_tail = NULL;
+    release(retired->root);
+    if (retired->data && tree->data_free)
+      tree->data_free(retired->data);
+    free(retired);
+  }
+}
+
+bool free_visit(int64_t key, void *data, Pointer ctx)
+{
+  void (*data_free)(void *) = *(void (**)(void *))ctx;
+  if (data)
+    data_free(data);
+  return true;
+}
+
+// --- Public ---
+
+prbt_tree * prbt_create(void (*data_free)(void *))
+{
+  prbt_tree *tree = NULL;
+  ticket_mutex lock = TICKET_MUTEX_INITIALIZER;
+  size_t bytes = (sizeof(prbt_tree) + CACHE_LINE - 1) &
+    ~((size_t)CACHE_LINE - 1);
+
+  tree = (prbt_tree *)aligned_alloc(CACHE_LINE, bytes);
+  if (!tree)
+    return NULL;
+  memset(tree, 0, bytes);
+  memcpy(&(tree->write_lock), &lock, sizeof(ticket_mutex));
+  atomic_store(&(tree->epoch), 1);
+  tree->data_free = data_free;
+  return tree;
+}
+
+void prbt_destroy(prbt_tree *tree)
+{
+  prbt_node *root = NULL;
+  prbt_retired *retired = NULL;
+  if (!tree)
+    return;
+
+  // No reader may be left at this point, so everything goes.
+  root = atomic_load(&(tree->root));
+  if (tree->data_free)
+    prbt_range(root, INT64_MIN, INT64_MAX, &free_visit, &(tree->data_free));
+  release(root);
+
+  while ((retired = tree->retired))
+  {
+    tree->retired = retired->next;
+    release(retired->root);
+    if (retired->data && tree->data_free)
+      tree->data_free(retired->data);
+    free(retired);
+  }
+  free(tree);
+}
+
+bool prbt_put(prbt_tree *tree, int64_t key, void *data, size_t data_size)
+{
+  prbt_node *root = NULL;
+  prbt_node *new_root = NULL;
+  void *old_data = NULL;
+
+  ticket_lock(&(tree->write_lock));
+  tree->generation += 1;
+  root = atomic_load(&(tree->root));
+
+  // The old root keeps the tree's reference until it is reclaimed, the
+  // update works on a reference of its own.
+  if (root)
+    root->refs += 1;
+  new_root = put_node(tree, root, key, data, data_size, &old_data);
+  publish(tree, root, new_root, old_data);
+  ticket_unlock(&(tree->write_lock));
+  return true;
+}
+
+bool prbt_remove(prbt_tree *tree, int64_t key)
+{
+  prbt_node *root = NULL;
+  prbt_node *new_root = NULL;
+  void *old_data = NULL;
+  bool found = false;
+
+  ticket_lock(&(tree->write_lock));
+  root = atomic_load(&(tree->root));
+  if (find(root, key))
+  {
+    tree->generation += 1;
+    root->refs += 1;
+    new_root = own(tree, root);
+    if (!is_red(left(new_root)) && !is_red(right(new_root)))
+      new_root->red = true;
+    new_root = remove_node(tree, new_root, key, &old_data);
+    publish(tree, root, new_root, old_data);
+    found = true;
+  }
+  ticket_unlock(&(tree->write_lock));
+  return found;
+}
+
+void prbt_reclaim(prbt_tree *tree)
+{
+  ticket_lock(&(tree->write_lock));
+  reclaim(tree);
+  ticket_unlock(&(tree->write_lock));
+}
+
+int32_t prbt_reader_register(prbt_tree *tree)
+{
+  int32_t i = 0;
+  for (i = 0; i < PRBTREE_MAX_READERS; i++)
+  {
+    bool expected = false;
+    if (atomic_compare_exchange_strong(&(tree->readers[i].used), &expected,
+                                       true))
+      return i;
+  }
+  return -1;
+}
+
+void prbt_reader_unregister(prbt_tree *tree, int32_t reader)
+{
+  if (0 <= reader && reader < PRBTREE_MAX_READERS)
+  {
+    atomic_store(&(tree->readers[reader].epoch), 0);
+    atomic_store(&(tree->readers[reader].used), false);
+  }
+}
+
+// A reader that did not get a slot gets no snapshot.
+prbt_node * prbt_read_begin(prbt_tree *tree, int32_t reader)
+{
+  if (reader < 0 || PRBTREE_MAX_READERS <= reader)
+    return NULL;
+
+  // Announcing the epoch before loading the root is what keeps the writer
+  // from freeing that root, both are sequentially consistent.
+  atomic_store(&(tree->readers[reader].epoch), atomic_load(&(tree->epoch)));
+  return atomic_load(&(tree->root));
+}
+
+void prbt_read_end(prbt_tree *tree, int32_t reader)
+{
+  if (0 <= reader && reader < PRBTREE_MAX_READERS)
+    atomic_store(&(tree->readers[reader].epoch), 0);
+}
+
+void * prbt_get(prbt_node *root, int64_t key)
+{
+  prbt_node *n = find(root, key);
+  return n ? n->data : NULL;
+}
+
+size_t prbt_data_size(prbt_node *root, int64_t key)
+{
+  prbt_node *n = find(root, key);
+  if (!n)
+    return -1;
+  return n->data_size;
+}
+
+size_t prbt_size(prbt_node *root)
+{
+  return size(root);
+}
+
+size_t prbt_range(prbt_node *root, int64_t lo, int64_t hi,
+                  bool (*callback)(int64_t, void *, Pointer), Pointer ctx)
+{
+  prbt_node *stack[RBTREE_MAX_DEPTH];
+  uint32_t depth = 0;
+  prbt_node *n = root;
+  size_t count = 0;
+  if (hi < lo)
+    return 0;
+
+  for (;;)
+  {
+    while (n)
+    {
+      if (n->key < lo)
+      {
+        n = n->right;
+        continue;
+      }
+      stack[depth++] = n;
+      n = n->left;
+    }
+    if (depth == 0)
+      break;
+
+    n = stack[--depth];
+    if (hi < n->key)
+      break;
+    count += 1;
+    if (callback && !callback(n->key, n->data, ctx))
+      break;
+    n = n->right;
+  }
+  return count;
+}
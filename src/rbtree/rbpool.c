@@ -0,0 +1,461 @@
+#include "rbtree.h"
+
+// Index 0 is never handed out and stands in for NULL.
+#define NIL (0U)
+#define RED_BIT (0x80000000U)
+#define INDEX_MASK (0x7fffffffU)
+#define DEFAULT_CAPACITY (64U)
+
+#define RIGHT_SHIFT (32)
+
+// 32 bytes against the 64 of rbt_node plus its malloc header. Both child
+// indices share one word, the left one in the low half with the colour in
+// its top bit and the right one in the high half.
+typedef struct rbt_pool_node_t
+{
+  int64_t key;
+  void *data;
+  size_t data_size;
+  uint64_t links;
+} pool_node;
+
+typedef struct rbt_pool_t
+{
+  pool_node *nodes;
+  uint32_t capacity;
+  uint32_t used;
+  uint32_t free_list;
+  uint32_t root;
+  size_t size;
+} rbt_pool;
+
+
+static uint32_t left(rbt_pool *, uint32_t);
+static uint32_t right(rbt_pool *, uint32_t);
+static void     set_left(rbt_pool *, uint32_t, uint32_t);
+static void     set_right(rbt_pool *, uint32_t, uint32_t);
+static bool     is_red(rbt_pool *, uint32_t);
+static void     set_red(rbt_pool *, uint32_t, bool);
+static uint32_t find(rbt_pool *, int64_t);
+
+static void     flip_colours(rbt_pool *, uint32_t);
+static uint32_t rotate_left(rbt_pool *, uint32_t);
+static uint32_t rotate_right(rbt_pool *, uint32_t);
+static uint32_t move_red_left(rbt_pool *, uint32_t);
+static uint32_t move_red_right(rbt_pool *, uint32_t);
+static uint32_t balance(rbt_pool *, uint32_t);
+static uint32_t put_node(rbt_pool *, uint32_t, uint32_t, void **);
+static uint32_t remove_node(rbt_pool *, uint32_t, int64_t, void **);
+static uint32_t remove_first(rbt_pool *, uint32_t, uint32_t *);
+static uint32_t node_alloc(rbt_pool *);
+static void     node_release(rbt_pool *, uint32_t);
+
+// --- Private ---
+
+uint32_t left(rbt_pool *pool, uint32_t node)
+{
+  return (uint32_t)pool->nodes[node].links & INDEX_MASK;
+}
+
+uint32_t right(rbt_pool *pool, uint32_t node)
+{
+  return (uint32_t)(pool->nodes[node].links >> RIGHT_SHIFT);
+}
+
+void set_left(rbt_pool *pool, uint32_t node, uint32_t child)
+{
+  pool->nodes[node].links =
+    (pool->nodes[node].links & ~(uint64_t)INDEX_MASK) | child;
+}
+
+void set_right(rbt_pool *pool, uint32_t node, uint32_t child)
+{
+  pool->nodes[node].links =
+    (pool->nodes[node].links & UINT32_MAX) | ((uint64_t)child << RIGHT_SHIFT);
+}
+
+bool is_red(rbt_pool *pool, uint32_t node)
+{
+  return (node != NIL && (pool->nodes[node].links & RED_BIT));
+}
+
+void set_red(rbt_pool *pool, uint32_t node, bool red)
+{
+  if (red)
+    pool->nodes[node].links |= RED_BIT;
+  else
+    pool->nodes[node].links &= ~(uint64_t)RED_BIT;
+}
+
+uint32_t find(rbt_pool *pool, int64_t key)
+{
+  const pool_node *node = NULL;
+  uint32_t n = pool->root;
+  while (n != NIL)
+  {
+    node = &(pool->nodes[n]);
+    if (key == node->key)
+      break;
+    // Both links come in with the key and the comparison only picks a
+    // shift, so there is one dependent load per level and no branch for
+    // random keys to mispredict.
+    n = (uint32_t)(node->links >> (RIGHT_SHIFT * (node->key < key)));
+    n &= INDEX_MASK;
+  }
+  return n;
+}
+
+void flip_colours(rbt_pool *pool, uint32_t node)
+{
+  set_red(pool, node, !is_red(pool, node));
+  if (left(pool, node) != NIL)
+    set_red(pool, left(pool, node), !is_red(pool, left(pool, node)));
+  if (right(pool, node) != NIL)
+    set_red(pool, right(pool, node), !is_red(pool, right(pool, node)));
+}
+
+uint32_t rotate_left(rbt_pool *pool, uint32_t node)
+{
+  uint32_t old = right(pool, node);
+  if (old == NIL)
+    return node;
+
+  set_right(pool, node, left(pool, old));
+  set_left(pool, old, node);
+  set_red(pool, old, is_red(pool, node));
+  set_red(pool, node, true);
+  return old;
+}
+
+uint32_t rotate_right(rbt_pool *pool, uint32_t node)
+{
+  uint32_t old = left(pool, node);
+  if (old == NIL)
+    return node;
+
+  set_left(pool, node, right(pool, old));
+  set_right(pool, old, node);
+  set_red(pool, old, is_red(pool, node));
+  set_red(pool, node, true);
+  return old;
+}
+
+uint32_t move_red_left(rbt_pool *pool, uint32_t node)
+{
+  flip_colours(pool, node);
+  if (is_red(pool, left(pool, right(pool, node))))
+  {
+    set_right(pool, node, rotate_right(pool, right(pool, node)));
+    node = rotate_left(pool, node);
+    flip_colours(pool, node);
+  }
+  return node;
+}
+
+uint32_t move_red_right(rbt_pool *pool, uint32_t node)
+{
+  flip_colours(pool, node);
+  if (is_red(pool, left(pool, left(pool, node))))
+  {
+    node = rotate_right(pool, node);
+    flip_colours(pool, node);
+  }
+  return node;
+}
+
+uint32_t balance(rbt_pool *pool, uint32_t root)
+{
+  uint32_t node = root;
+  if (is_red(pool, right(pool, node)) && !is_red(pool, left(pool, node)))
+    node = rotate_left(pool, node);
+  if (is_red(pool, left(pool, node)) &&
+      is_red(pool, left(pool, left(pool, node))))
+    node = rotate_right(pool, node);
+  if (is_red(pool, left(pool, node)) && is_red(pool, right(pool, node)))
+    flip_colours(pool, node);
+  return node;
+}
+
+uint32_t put_node(rbt_pool *pool, uint32_t root, uint32_t node,
+                  void **old_data)
+{
+  pool_node *r = NULL;
+  pool_node *n = NULL;
+  if (root == NIL)
+  {
+    set_red(pool, node, true);
+    pool->size += 1;
+    return node;
+  }
+
+  r = &(pool->nodes[root]);
+  n = &(pool->nodes[node]);
+  if (r->key < n->key)
+  {
+    set_right(pool, root, put_node(pool, right(pool, root), node, old_data));
+  }
+  else if (n->key < r->key)
+  {
+    set_left(pool, root, put_node(pool, left(pool, root), node, old_data));
+  }
+  else
+  {
+    if (r->data != n->data)
+    {
+      if (old_data)
+        (*old_data) = r->data;
+      r->data = n->data;
+    }
+    r->data_size = n->data_size;
+    node_release(pool, node);
+  }
+
+  return balance(pool, root);
+}
+
+uint32_t remove_node(rbt_pool *pool, uint32_t root, int64_t key, void **data)
+{
+  uint32_t node = root;
+
+  if (key < pool->nodes[node].key)
+  {
+    if (!is_red(pool, left(pool, node)) &&
+        !is_red(pool, left(pool, left(pool, node))))
+      node = move_red_left(pool, node);
+    set_left(pool, node, remove_node(pool, left(pool, node), key, data));
+  }
+  else
+  {
+    if (is_red(pool, left(pool, node)))
+      node = rotate_right(pool, node);
+
+    if (key == pool->nodes[node].key && right(pool, node) == NIL)
+    {
+      if (data)
+        (*data) = pool->nodes[node].data;
+      node_release(pool, node);
+      pool->size -= 1;
+      return NIL;
+    }
+
+    if (!is_red(pool, right(pool, node)) &&
+        !is_red(pool, left(pool, right(pool, node))))
+      node = move_red_right(pool, node);
+
+    if (key == pool->nodes[node].key)
+    {
+      uint32_t smallest = NIL;
+      uint32_t _right = remove_first(pool, right(pool, node), &smallest);
+
+      pool->nodes[smallest].links = pool->nodes[node].links;
+      set_right(pool, smallest, _right);
+
+      if (data)
+        (*data) = pool->nodes[node].data;
+      node_release(pool, node);
+      pool->size -= 1;
+      node = smallest;
+    }
+    else
+    {
+      set_right(pool, node, remove_node(pool, right(pool, node), key, data));
+    }
+  }
+
+  return balance(pool, node);
+}
+
+uint32_t remove_first(rbt_pool *pool, uint32_t root, uint32_t *first)
+{
+  uint32_t node = root;
+  if (left(pool, node) == NIL)
+  {
+    (*first) = node;
+    return NIL;
+  }
+
+  if (!is_red(pool, left(pool, node)) &&
+      !is_red(pool, left(pool, left(pool, node))))
+    node = move_red_left(pool, node);
+
+  set_left(pool, node, remove_first(pool, left(pool, node), first));
+  return balance(pool, node);
+}
+
+// May move the node array, so callers must not hold node pointers over it.
+uint32_t node_alloc(rbt_pool *pool)
+{
+  uint32_t node = pool->free_list;
+  if (node != NIL)
+  {
+    pool->free_list = right(pool, node);
+  }
+  else
+  {
+    if (pool->used == pool->capacity)
+    {
+      uint32_t capacity = pool->capacity * 2;
+      pool_node *nodes = NULL;
+      if (INDEX_MASK < capacity)
+        capacity = INDEX_MASK;
+      if (capacity <= pool->used)
+        return NIL;
+
+      nodes = (pool_node *)realloc(pool->nodes, capacity * sizeof(pool_node));
+      if (!nodes)
+        return NIL;
+      pool->nodes = nodes;
+      pool->capacity = capacity;
+    }
+    node = pool->used;
+    pool->used += 1;
+  }
+
+  memset(&(pool->nodes[node]), 0, sizeof(pool_node));
+  return node;
+}
+
+void node_release(rbt_pool *pool, uint32_t node)
+{
+  memset(&(pool->nodes[node]), 0, sizeof(pool_node));
+  set_right(pool, node, pool->free_list);
+  pool->free_list = node;
+}
+
+// --- Public ---
+
+rbt_pool * rbt_pool_create(uint32_t capacity)
+{
+  rbt_pool *pool = (rbt_pool *)calloc(1, sizeof(rbt_pool));
+  if (!pool)
+    return NULL;
+
+  pool->capacity = max(capacity + 1, DEFAULT_CAPACITY);
+  if (INDEX_MASK < pool->capacity)
+    pool->capacity = INDEX_MASK;
+  pool->nodes = (pool_node *)calloc(pool->capacity, sizeof(pool_node));
+  if (!pool->nodes)
+  {
+    free(pool);
+    return NULL;
+  }
+  pool->used = 1; // NIL
+  return pool;
+}
+
+void * rbt_pool_get(rbt_pool *pool, int64_t key)
+{
+  uint32_t n = find(pool, key);
+  return n != NIL ? pool->nodes[n].data : NULL;
+}
+
+bool rbt_pool_put(rbt_pool *pool, int64_t key, void *data, size_t data_size,
+                  void **old_data)
+{
+  uint32_t node = NIL;
+
+  if (old_data)
+    (*old_data) = NULL;
+
+  node = node_alloc(pool);
+  if (node == NIL)
+    return false;
+
+  pool->nodes[node].key = key;
+  pool->nodes[node].data = data;
+  pool->nodes[node].data_size = data_size;
+
+  pool->root = put_node(pool, pool->root, node, old_data);
+  set_red(pool, pool->root, false);
+  return true;
+}
+
+bool rbt_pool_remove(rbt_pool *pool, int64_t key, void **data)
+{
+  if (data)
+    (*data) = NULL;
+  if (find(pool, key) == NIL)
+    return false;
+
+  if (!is_red(pool, left(pool, pool->root)) &&
+      !is_red(pool, right(pool, pool->root)))
+    set_red(pool, pool->root, true);
+
+  pool->root = remove_node(pool, pool->root, key, data);
+  if (pool->root != NIL)
+    set_red(pool, pool->root, false);
+  return true;
+}
+
+size_t rbt_pool_size(rbt_pool *pool)
+{
+  return pool ? pool->size : 0;
+}
+
+size_t rbt_pool_data_size(rbt_pool *pool, int64_t key)
+{
+  uint32_t n = find(pool, key);
+  if (n == NIL)
+    return -1;
+  return pool->nodes[n].data_size;
+}
+
+size_t rbt_pool_memory(rbt_pool *pool)
+{
+  return pool ? sizeof(rbt_pool) + pool->capacity * sizeof(pool_node) : 0;
+}
+
+size_t rbt_pool_range(rbt_pool *pool, int64_t lo, int64_t hi,
+                      bool (*callback)(int64_t, void *, Pointer), Pointer ctx)
+{
+  uint32_t stack[RBTREE_MAX_DEPTH];
+  uint32_t depth = 0;
+  uint32_t n = pool->root;
+  size_t count = 0;
+  if (hi < lo)
+    return 0;
+
+  for (;;)
+  {
+    while (n != NIL)
+    {
+      if (pool->nodes[n].key < lo)
+      {
+        n = right(pool, n);
+        continue;
+      }
+      stack[depth++] = n;
+      n = left(pool, n);
+    }
+    if (depth == 0)
+      break;
+
+    n = stack[--depth];
+    if (hi < pool->nodes[n].key)
+      break;
+    count += 1;
+    if (callback && !callback(pool->nodes[n].key, pool->nodes[n].data, ctx))
+      break;
+    n = right(pool, n);
+  }
+  return count;
+}
+
+void rbt_pool_free(rbt_pool *pool, void (*data_free)(void *))
+{
+  uint32_t i = 0;
+  if (!pool)
+    return;
+
+  if (data_free)
+  {
+    // Released nodes are zeroed, so only live entries have data.
+    for (i = 1; i < pool->used; i++)
+    {
+      if (pool->nodes[i].data)
+        data_free(pool->nodes[i].data);
+    }
+  }
+  free(pool->nodes);
+  free(pool);
+}
@@ -6,6 +6,13 @@ typedef enum colour_e
   BLACK = 1
 } colour;
 
+typedef enum set_op_e
+{
+  SET_UNION,
+  SET_INTERSECTION,
+  SET_DIFFERENCE
+} set_op;
+
 typedef struct rbt_node_t
 {
   struct rbt_node_t *parent;
@@ -18,13 +25,29 @@ typedef struct rbt_node_t
   void * data;
 } rbt_node;
 
+// One half of a set operation handed to another thread.
+typedef struct set_task_t
+{
+  set_op op;
+  rbt_node *a;
+  rbt_node *b;
+  rbt_node *result;
+  void (*data_free)(void *);
+  uint32_t forks;
+} set_task;
+
+// Set operations hand one half of the work to a new thread while both trees
+// together hold at least this many entries, at most this many levels deep.
+#define SET_FORK_SIZE (1 << 16)
+#define SET_FORK_DEPTH (3)
+
 
 static rbt_node * left(rbt_node *);
 static rbt_node * right(rbt_node *);
 static rbt_node * parent(rbt_node *);
+static rbt_node * find(rbt_node *, int64_t);
 
-static bool    has_children(rbt_node *);
-static bool    is_red(rbt_node *);
+static bool       is_red(rbt_node *);
 static uint64_t   size(rbt_node *);
 static void       flip_colours(rbt_node *);
 static rbt_node * rotate_left(rbt_node *);
@@ -34,7 +57,29 @@ static rbt_node * move_red_right(rbt_node *);
 static rbt_node * balance(rbt_node *);
 static rbt_node * put_node(rbt_node *, rbt_node *, void **);
 static rbt_node * remove_node(rbt_node *, int64_t, void **);
-static rbt_node * remove_first(rbt_node *);
+static rbt_node * remove_first(rbt_node *, rbt_node **);
+static rbt_node * build_node(const int64_t *, void **, const size_t *,
+                             size_t, size_t, uint32_t);
+static size_t     max_keys(uint32_t);
+static uint32_t   black_height(rbt_node *);
+static rbt_node * make_root(rbt_node *, uint32_t *);
+static rbt_node * join_node(rbt_node *, rbt_node *, rbt_node *);
+static rbt_node * join_right(rbt_node *, uint32_t, rbt_node *, rbt_node *,
+                             uint32_t);
+static rbt_node * join_left(rbt_node *, uint32_t, rbt_node *, rbt_node *,
+                            uint32_t);
+static rbt_node * join(rbt_node *, uint32_t, rbt_node *, rbt_node *, uint32_t,
+                       uint32_t *);
+static rbt_node * join_trees(rbt_node *, rbt_node *, rbt_node *);
+static rbt_node * join_pair(rbt_node *, rbt_node *);
+static void       split_node(rbt_node *, uint32_t, int64_t, rbt_node **,
+                             uint32_t *, rbt_node **, rbt_node **,
+                             uint32_t *);
+static rbt_node * set_node(set_op, rbt_node *, rbt_node *, void (*)(void *),
+                           uint32_t);
+static void *     set_thread(void *);
+static rbt_node * output(rbt_node *, int64_t *, void **);
+static void       cursor_push(rbt_cursor *, rbt_node *);
 static void       node_free(rbt_node *, void (*)(void *));
 
 // --- Private ---
@@ -69,11 +114,6 @@ rbt_node * find(rbt_node *root, int64_t key)
   return n;
 }
 
-bool has_children(rbt_node *node)
-{
-  return (left(node) != NULL || right(node) != NULL);
-}
-
 bool is_red(rbt_node *node)
 {
   return (node && node->colour == RED);
@@ -88,7 +128,7 @@ void flip_colours(rbt_node *node)
 {
   rbt_node *_left = NULL;
   rbt_node *_right = NULL;
-  
+
   if (is_red(node))
     node->colour = BLACK;
   else
@@ -101,9 +141,8 @@ void flip_colours(rbt_node *node)
       _left->colour = BLACK;
     else
       _left->colour = RED;
-    node->left = _left;
   }
-  
+
   _right = right(node);
   if (_right)
   {
@@ -111,36 +150,30 @@ void flip_colours(rbt_node *node)
       _right->colour = BLACK;
     else
       _right->colour = RED;
-    node->right = _right;
   }
 }
 
+// The rotations only relink the subtree. The caller stores the returned node
+// in the slot the old one came from, its parent pointer is already correct.
 rbt_node * rotate_left(rbt_node *node)
 {
   rbt_node *n = node;
   if (right(node))
   {
-    rbt_node *_parent = parent(node);
     rbt_node *old = right(node); // old right
 
     node->right = old->left;
+    if (node->right)
+      node->right->parent = node;
     old->left = node;
 
-    if (is_red(left(old)))
-      old->colour = RED;
-    else
-      old->colour = BLACK;
+    old->parent = node->parent;
+    node->parent = old;
 
-    left(old)->colour = RED;
+    old->colour = node->colour;
+    node->colour = RED;
     old->size = node->size;
     node->size = size(left(node)) + size(right(node)) + 1;
-    
-    old->parent = _parent;
-    if (left(_parent) == node)
-      _parent->left = old;
-    else
-      _parent->right = old;
-    node->parent = old;
 
     n = old;
   }
@@ -152,27 +185,20 @@ rbt_node * rotate_right(rbt_node *node)
   rbt_node *n = node;
   if (left(node))
   {
-    rbt_node *_parent = parent(node);
     rbt_node *old = left(node); // old left
 
     node->left = old->right;
+    if (node->left)
+      node->left->parent = node;
     old->right = node;
 
-    if (is_red(right(old)))
-      old->colour = RED;
-    else
-      old->colour = BLACK;
+    old->parent = node->parent;
+    node->parent = old;
 
-    right(old)->colour = RED;
+    old->colour = node->colour;
+    node->colour = RED;
     old->size = node->size;
     node->size = size(right(node)) + size(left(node)) + 1;
-    
-    old->parent = _parent;
-    if (right(_parent) == node)
-      _parent->right = old;
-    else
-      _parent->left = old;
-    node->parent = old;
 
     n = old;
   }
@@ -182,7 +208,7 @@ rbt_node * rotate_right(rbt_node *node)
 rbt_node * move_red_left(rbt_node *node)
 {
   flip_colours(node);
-  if (right(node) && is_red(left(right(node))))
+  if (is_red(left(right(node))))
   {
     node->right = rotate_right(right(node));
     node = rotate_left(node);
@@ -194,7 +220,7 @@ rbt_node * move_red_left(rbt_node *node)
 rbt_node * move_red_right(rbt_node *node)
 {
   flip_colours(node);
-  if (left(node) && is_red(left(left(node))))
+  if (is_red(left(left(node))))
   {
     node = rotate_right(node);
     flip_colours(node);
@@ -205,9 +231,9 @@ rbt_node * move_red_right(rbt_node *node)
 rbt_node * balance(rbt_node *root)
 {
   rbt_node *node = root;
-  if (is_red(right(node)))
+  if (is_red(right(node)) && !is_red(left(node)))
     node = rotate_left(node);
-  if (left(node) && is_red(left(node)) && is_red(left(left(node))))
+  if (is_red(left(node)) && is_red(left(left(node))))
     node = rotate_right(node);
   if (is_red(left(node)) && is_red(right(node)))
     flip_colours(node);
@@ -219,133 +245,479 @@ rbt_node * balance(rbt_node *root)
 rbt_node * put_node(rbt_node *root, rbt_node *node, void **old_data)
 {
   rbt_node *r = root;
-  if (r)
+  if (!r)
   {
-    if (r->key < node->key)
-    {
-      r->right = put_node(right(r), node, old_data);
-    }
-    else if (node->key < r->key)
-    {
-      r->left = put_node(left(r), node, old_data);
-    }
-    else
-    {
-      if (!r->data || r->data_size != node->data_size ||
-          (r->data != node->data &&
-           memcmp(r->data,node->data,min(r->data_size, node->data_size)) != 0))
-      {
-        void *old = node->data;
-        r->data = node->data;
-        r->data_size = node->data_size;
-
-        if (old_data)
-          (*old_data) = old;
-      }
-
-      node->data = NULL;
-      node->data_size = 0;
-      node_free(node, NULL);
-    }
-
-    if (is_red(right(node)) && !is_red(left(node)))
-      node = rotate_left(node);
-    if (left(node) && is_red(left(node)) && is_red(left(left(node))))
-      node = rotate_right(node);
-    if (is_red(left(node)) && is_red(right(node)))
-      flip_colours(node);
+    node->colour = RED;
+    node->size = 1;
+    return node;
+  }
 
-    node->size = size(left(node)) + size(right(node)) + 1;
+  if (r->key < node->key)
+  {
+    r->right = put_node(right(r), node, old_data);
+    r->right->parent = r;
+  }
+  else if (node->key < r->key)
+  {
+    r->left = put_node(left(r), node, old_data);
+    r->left->parent = r;
   }
   else
   {
-    node->colour = RED;
-    r = node;
+    if (r->data != node->data)
+    {
+      if (old_data)
+        (*old_data) = r->data;
+      r->data = node->data;
+    }
+    r->data_size = node->data_size;
+
+    node->data = NULL;
+    node->data_size = 0;
+    node_free(node, NULL);
   }
 
-  return r;
+  return balance(r);
 }
 
+// Expects the key to be in the tree, rbt_remove checks that before calling.
 rbt_node * remove_node(rbt_node *root, int64_t key, void **data)
 {
-  rbt_node *old = NULL;
   rbt_node *node = root;
-  if (root->key == key && data)
-  {
-    (*data) = root->data;
-    root->data = NULL;
-  }
 
   if (key < node->key)
   {
-    rbt_node *_left = NULL;
-    
-    old = left(node); // old left
-    if (!old)
-      return NULL;
-
-    if (!is_red(old) && (!old || !is_red(left(old))))
-    {
+    if (!is_red(left(node)) && !is_red(left(left(node))))
       node = move_red_left(node);
-      old = left(node);
-    }
 
-    _left = remove_node(old, key, data);
-
-    _left->parent = node;
-    node->left = _left;
+    node->left = remove_node(left(node), key, data);
+    if (node->left)
+      node->left->parent = node;
   }
   else
   {
     if (is_red(left(node)))
       node = rotate_right(node);
-    if (key == node->key && right(node))
-      return NULL; // Should not happen
 
-    if (!is_red(right(node)) && (!right(node) || !is_red(left(right(node)))))
+    if (key == node->key && !right(node))
+    {
+      if (data)
+        (*data) = node->data;
+      node_free(node, NULL);
+      return NULL;
+    }
+
+    if (!is_red(right(node)) && !is_red(left(right(node))))
       node = move_red_right(node);
 
     if (key == node->key)
     {
-      rbt_node *smallest = remove_first(right(node));
-      old = node;
+      // Splice the smallest node of the right subtree in place of the removed
+      // one instead of copying its contents, so other node pointers held by
+      // the caller stay valid.
+      rbt_node *smallest = NULL;
+      rbt_node *_right = remove_first(right(node), &smallest);
+
+      smallest->left = left(node);
+      smallest->right = _right;
+      smallest->parent = parent(node);
+      smallest->colour = node->colour;
+      if (smallest->left)
+        smallest->left->parent = smallest;
+      if (smallest->right)
+        smallest->right->parent = smallest;
+
+      if (data)
+        (*data) = node->data;
+      node_free(node, NULL);
       node = smallest;
     }
     else
     {
-      rbt_node *_right = remove_node(right(node), key, data);
-      node->right = _right;
+      node->right = remove_node(right(node), key, data);
+      if (node->right)
+        node->right->parent = node;
     }
   }
 
-  node = balance(node);
+  return balance(node);
+}
 
-  if (old && key == old->key)
+rbt_node * remove_first(rbt_node *root, rbt_node **first)
+{
+  rbt_node *node = root;
+  if (!left(node))
   {
-    node_free(old, NULL);
-    old = NULL;
+    // A left-leaning node without a left child has no right child either.
+    node->parent = NULL;
+    (*first) = node;
+    return NULL;
   }
 
-  return node;
+  if (!is_red(left(node)) && !is_red(left(left(node))))
+    node = move_red_left(node);
+
+  node->left = remove_first(left(node), first);
+  if (node->left)
+    node->left->parent = node;
+  return balance(node);
 }
 
-rbt_node * remove_first(rbt_node *root)
+// Builds a valid left-leaning tree of the given black height out of a
+// sorted slice. Each level becomes a 2-node or, when the slice is too large
+// for two subtrees of the lower height, a 3-node whose smaller key is a red
+// left child. That keeps every path at the same black height without any
+// rotations, so the whole build is a single pass.
+rbt_node * build_node(const int64_t *keys, void **values, const size_t *sizes,
+                      size_t first, size_t count, uint32_t height)
 {
   rbt_node *node = NULL;
-  rbt_node *_left = NULL;
-  if (!left(root))
+  rbt_node *red = NULL;
+  size_t rest = 0, a = 0, b = 0, c = 0;
+  if (count == 0)
+    return NULL;
+
+  node = (rbt_node *)calloc(1,sizeof(rbt_node));
+  node->colour = BLACK;
+  node->size = count;
+
+  if (count - 1 <= 2 * max_keys(height - 1))
   {
-    root->parent = NULL;
-    return root;
+    a = count / 2;
+    b = count - 1 - a;
+    node->left = build_node(keys, values, sizes, first, a, height - 1);
+    node->right = build_node(keys, values, sizes, first + a + 1, b,
+                             height - 1);
+  }
+  else
+  {
+    rest = count - 2;
+    a = rest / 3 + (0 < rest % 3 ? 1 : 0);
+    b = rest / 3 + (1 < rest % 3 ? 1 : 0);
+    c = rest / 3;
+
+    red = (rbt_node *)calloc(1,sizeof(rbt_node));
+    red->colour = RED;
+    red->size = a + b + 1;
+    red->key = keys[first + a];
+    red->data = values ? values[first + a] : NULL;
+    red->data_size = sizes ? sizes[first + a] : 0;
+    red->left = build_node(keys, values, sizes, first, a, height - 1);
+    red->right = build_node(keys, values, sizes, first + a + 1, b,
+                            height - 1);
+    if (red->left)
+      red->left->parent = red;
+    if (red->right)
+      red->right->parent = red;
+
+    a += b + 1;
+    node->left = red;
+    node->right = build_node(keys, values, sizes, first + a + 1, c,
+                             height - 1);
   }
 
-  node = root;
-  if (left(node) && !is_red(left(node)) && !is_red(left(left(node))))
-    node = move_red_left(node);
+  node->key = keys[first + a];
+  node->data = values ? values[first + a] : NULL;
+  node->data_size = sizes ? sizes[first + a] : 0;
+  if (node->left)
+    node->left->parent = node;
+  if (node->right)
+    node->right->parent = node;
+  return node;
+}
+
+// Most keys a left-leaning tree of the given black height holds, 3^h - 1,
+// saturating instead of overflowing.
+size_t max_keys(uint32_t height)
+{
+  size_t cap = 1;
+  uint32_t i = 0;
+  for (i = 0; i < height; i++)
+  {
+    if (SIZE_MAX / 3 < cap)
+      return SIZE_MAX;
+    cap *= 3;
+  }
+  return cap - 1;
+}
+
+// Black nodes on any path from the node down to a leaf, the node included.
+uint32_t black_height(rbt_node *node)
+{
+  uint32_t height = 0;
+  rbt_node *n = node;
+  while (n)
+  {
+    if (!is_red(n))
+      height += 1;
+    n = left(n);
+  }
+  return height;
+}
 
-  _left = remove_first(left(node));
+// Detaches a subtree so it can be used as a tree of its own. A red root is
+// made black, which adds one to its black height.
+rbt_node * make_root(rbt_node *node, uint32_t *height)
+{
+  if (node)
+  {
+    node->parent = NULL;
+    if (is_red(node))
+    {
+      node->colour = BLACK;
+      if (height)
+        (*height) += 1;
+    }
+  }
+  return node;
+}
+
+rbt_node * join_node(rbt_node *_left, rbt_node *node, rbt_node *_right)
+{
   node->left = _left;
-  return balance(node);
+  node->right = _right;
+  node->colour = RED;
+  node->size = size(_left) + size(_right) + 1;
+  if (_left)
+    _left->parent = node;
+  if (_right)
+    _right->parent = node;
+  return node;
+}
+
+// Walks down the right spine of the taller left tree to the black node as
+// tall as the right tree and hangs the joined node there as a red link. From
+// there on up it is the same repair as after an insert.
+rbt_node * join_right(rbt_node *_left, uint32_t left_height, rbt_node *node,
+                      rbt_node *_right, uint32_t right_height)
+{
+  if (!is_red(_left) && left_height == right_height)
+    return join_node(_left, node, _right);
+
+  _left->right = join_right(right(_left), left_height - (is_red(_left) ? 0 : 1),
+                            node, _right, right_height);
+  _left->right->parent = _left;
+  return balance(_left);
+}
+
+rbt_node * join_left(rbt_node *_left, uint32_t left_height, rbt_node *node,
+                     rbt_node *_right, uint32_t right_height)
+{
+  if (!is_red(_right) && left_height == right_height)
+    return join_node(_left, node, _right);
+
+  _right->left = join_left(_left, left_height, node, left(_right),
+                           right_height - (is_red(_right) ? 0 : 1));
+  _right->left->parent = _right;
+  return balance(_right);
+}
+
+// Joins two trees with black roots and every key of the left one below the
+// node's key and every key of the right one above it. Costs the difference
+// of the black heights.
+rbt_node * join(rbt_node *_left, uint32_t left_height, rbt_node *node,
+                rbt_node *_right, uint32_t right_height, uint32_t *height)
+{
+  rbt_node *root = NULL;
+  uint32_t h = 0;
+
+  if (right_height < left_height)
+    root = join_right(_left, left_height, node, _right, right_height);
+  else if (left_height < right_height)
+    root = join_left(_left, left_height, node, _right, right_height);
+  else
+    root = join_node(_left, node, _right);
+
+  h = (left_height < right_height ? right_height : left_height);
+  make_root(root, &h);
+  if (height)
+    (*height) = h;
+  return root;
+}
+
+rbt_node * join_trees(rbt_node *_left, rbt_node *node, rbt_node *_right)
+{
+  make_root(_left, NULL);
+  make_root(_right, NULL);
+  return join(_left, black_height(_left), node, _right, black_height(_right),
+              NULL);
+}
+
+// Joins two trees without a node between them by taking the smallest node
+// of the right one.
+rbt_node * join_pair(rbt_node *_left, rbt_node *_right)
+{
+  rbt_node *r = make_root(_right, NULL);
+  rbt_node *first = NULL;
+  if (!_left)
+    return r;
+  if (!r)
+    return make_root(_left, NULL);
+
+  if (!is_red(left(r)) && !is_red(right(r)))
+    r->colour = RED;
+  r = remove_first(r, &first);
+  return join_trees(_left, first, r);
+}
+
+// Splits a tree with a black root into the keys below and above the given
+// one, and the node with that key if there is one. The pieces are joined
+// back up the search path, the black heights telescope so the whole split
+// costs O(log n).
+void split_node(rbt_node *root, uint32_t height, int64_t key,
+                rbt_node **_left, uint32_t *left_height, rbt_node **match,
+                rbt_node **_right, uint32_t *right_height)
+{
+  rbt_node *l = NULL, *r = NULL, *rest = NULL;
+  uint32_t lh = height - 1, rh = height - 1, rest_height = 0;
+
+  if (!root)
+  {
+    (*_left) = NULL;
+    (*left_height) = 0;
+    (*_right) = NULL;
+    (*right_height) = 0;
+    return;
+  }
+
+  l = make_root(left(root), &lh);
+  r = make_root(right(root), &rh);
+  root->left = NULL;
+  root->right = NULL;
+  root->parent = NULL;
+  root->size = 1;
+
+  if (key < root->key)
+  {
+    split_node(l, lh, key, _left, left_height, match, &rest, &rest_height);
+    (*_right) = join(rest, rest_height, root, r, rh, right_height);
+  }
+  else if (root->key < key)
+  {
+    split_node(r, rh, key, &rest, &rest_height, match, _right, right_height);
+    (*_left) = join(l, lh, root, rest, rest_height, left_height);
+  }
+  else
+  {
+    (*_left) = l;
+    (*left_height) = lh;
+    (*match) = root;
+    (*_right) = r;
+    (*right_height) = rh;
+  }
+}
+
+// Splits the second tree at the root of the first one and recurses into
+// both halves, which touch disjoint nodes and can run on their own threads.
+rbt_node * set_node(set_op op, rbt_node *a, rbt_node *b,
+                    void (*data_free)(void *), uint32_t forks)
+{
+  rbt_node *a_left = NULL, *a_right = NULL;
+  rbt_node *b_left = NULL, *b_right = NULL, *match = NULL;
+  rbt_node *_left = NULL, *_right = NULL;
+  uint32_t lh = 0, rh = 0;
+  set_task task;
+  pthread_t thread;
+  bool forked = false, keep = false;
+
+  if (!a || !b)
+  {
+    if (op == SET_UNION)
+      return make_root(a ? a : b, NULL);
+    if (op == SET_INTERSECTION)
+      rbt_free(make_root(a, NULL), data_free);
+    rbt_free(make_root(b, NULL), data_free);
+    return (op == SET_DIFFERENCE ? make_root(a, NULL) : NULL);
+  }
+
+  make_root(a, NULL);
+  make_root(b, NULL);
+  split_node(b, black_height(b), a->key, &b_left, &lh, &match, &b_right, &rh);
+  a_left = make_root(left(a), NULL);
+  a_right = make_root(right(a), NULL);
+  a->left = NULL;
+  a->right = NULL;
+
+  if (0 < forks && SET_FORK_SIZE <= size(a_left) + size(b_left))
+  {
+    memset(&task, 0, sizeof(set_task));
+    task.op = op;
+    task.a = a_left;
+    task.b = b_left;
+    task.data_free = data_free;
+    task.forks = forks - 1;
+    forked = (pthread_create(&thread, NULL, &set_thread, &task) == 0);
+  }
+  if (!forked)
+    _left = set_node(op, a_left, b_left, data_free, 0 < forks ? forks - 1 : 0);
+  _right = set_node(op, a_right, b_right, data_free,
+                    0 < forks ? forks - 1 : 0);
+  if (forked)
+  {
+    pthread_join(thread, NULL);
+    _left = task.result;
+  }
+
+  keep = (op == SET_UNION ||
+          (op == SET_INTERSECTION && match) ||
+          (op == SET_DIFFERENCE && !match));
+  if (match)
+    node_free(match, data_free);
+  if (keep)
+    return join_trees(_left, a, _right);
+
+  node_free(a, data_free);
+  return join_pair(_left, _right);
+}
+
+void * set_thread(void *arg)
+{
+  set_task *task = (set_task *)arg;
+  task->result = set_node(task->op, task->a, task->b, task->data_free,
+                          task->forks);
+  return NULL;
+}
+
+rbt_node * output(rbt_node *node, int64_t *key, void **data)
+{
+  if (node)
+  {
+    if (key)
+      (*key) = node->key;
+    if (data)
+      (*data) = node->data;
+  }
+  return node;
+}
+
+// Pushes the path towards the first key inside the cursor's range, in the
+// cursor's direction, starting from the given subtree.
+void cursor_push(rbt_cursor *cursor, rbt_node *node)
+{
+  rbt_node *n = node;
+  while (n)
+  {
+    if (cursor->reverse)
+    {
+      if (cursor->hi < n->key)
+      {
+        n = left(n);
+        continue;
+      }
+      cursor->stack[cursor->depth++] = n;
+      n = right(n);
+    }
+    else
+    {
+      if (n->key < cursor->lo)
+      {
+        n = right(n);
+        continue;
+      }
+      cursor->stack[cursor->depth++] = n;
+      n = left(n);
+    }
+  }
 }
 
 void node_free(rbt_node *node, void (*data_free)(void *))
@@ -377,24 +749,15 @@ void * rbt_get(rbt_node *root, int64_t key)
 size_t rbt_get_all(rbt_node *root, void ***data, int64_t **keys)
 {
   size_t count = 0;
-  rbt_node *node = NULL;
   void **data_array = NULL;
   int64_t *key_array = NULL;
   if (root)
   {
-    data_array = (void **)calloc(count,sizeof(void *));
-    key_array = (int64_t *)calloc(count,sizeof(int64_t));
-
-    node = rbt_get_first(root, NULL, NULL);
-    while (node)
-    {
-      data_array[count] = node->data;
-      key_array[count] = node->key;
-      count += 1;
-      node = rbt_get_next(node, NULL, NULL);
-    }
+    data_array = (void **)calloc(rbt_size(root),sizeof(void *));
+    key_array = (int64_t *)calloc(rbt_size(root),sizeof(int64_t));
+    count = rbt_export(root, key_array, data_array, NULL, rbt_size(root));
   }
-  
+
   if (data)
     (*data) = data_array;
   else
@@ -412,21 +775,7 @@ rbt_node * rbt_get_first(rbt_node *root, int64_t *key, void **data)
   rbt_node *n = root;
   while (n && left(n))
     n = left(n);
-  if (key)
-  {
-    if (n)
-      (*key) = n->key;
-    else
-      key = NULL;
-  }
-  if (data)
-  {
-    if (n)
-      (*data) = n->data;
-    else
-      key = NULL;
-  }
-  return n;
+  return output(n, key, data);
 }
 
 rbt_node * rbt_get_last(rbt_node *root, int64_t *key, void **data)
@@ -434,97 +783,43 @@ rbt_node * rbt_get_last(rbt_node *root, int64_t *key, void **data)
   rbt_node *n = root;
   while (n && right(n))
     n = right(n);
-  if (key)
-  {
-    if (n)
-      (*key) = n->key;
-    else
-      key = NULL;
-  }
-  if (data)
-  {
-    if (n)
-      (*data) = n->data;
-    else
-      key = NULL;
-  }
-  return n;
+  return output(n, key, data);
 }
 
 rbt_node * rbt_get_next(rbt_node *node, int64_t *key, void **data)
 {
   rbt_node *n = node;
-  rbt_node *p = NULL;
-  rbt_node *r = NULL;
-  while (n)
+  if (right(n))
   {
-    p = parent(n);
-    r = right(n);
-    if (r && node->key < r->key)
-    {
-      n = r;
-      while (left(n))
-        n = left(n);
-      break;
-    }
-    n = p;
-    if (node->key < p->key)
-      break;
-  }
-
-  if (key)
-  {
-    if (n)
-      (*key) = n->key;
-    else
-      key = NULL;
+    n = right(n);
+    while (left(n))
+      n = left(n);
   }
-  if (data)
+  else
   {
-    if (n)
-      (*data) = n->data;
-    else
-      key = NULL;
+    while (parent(n) && right(parent(n)) == n)
+      n = parent(n);
+    n = parent(n);
   }
-  return n;
+  return output(n, key, data);
 }
 
 rbt_node * rbt_get_previous(rbt_node *node, int64_t *key, void **data)
 {
   rbt_node *n = node;
-  rbt_node *p = NULL;
-  rbt_node *l = NULL;
-  while (n)
-  {
-    p = parent(n);
-    l = left(n);
-    if (l && node->key < l->key)
-    {
-      n = l;
-      while (right(n))
-        n = right(n);
-      break;
-    }
-    n = p;
-    if (node->key < p->key)
-      break;
-  }
-
-  if (key)
+  if (left(n))
   {
-    if (n)
-      (*key) = n->key;
-    else
-      key = NULL;
+    n = left(n);
+    while (right(n))
+      n = right(n);
   }
-  if (data)
+  else
   {
-    if (n)
-      (*data) = n->data;
-    else
-      key = NULL;
+    while (parent(n) && left(parent(n)) == n)
+      n = parent(n);
+    n = parent(n);
   }
-  return n;
+  return output(n, key, data);
 }
 
 rbt_node * rbt_put(rbt_node *root, int64_t key, void *data, size_t data_size,
@@ -542,25 +837,29 @@ rbt_node * rbt_put(rbt_node *root, int64_t key, void *data, size_t data_size,
     (*old_data) = NULL;
 
   r = put_node(root, new_node, old_data);
+  r->parent = NULL;
+  r->colour = BLACK;
 
-  if (0 < rbt_size(r))
-    r->colour = BLACK;
-    
   return r;
 }
 
 rbt_node * rbt_remove(rbt_node *root, int64_t key, void **data)
 {
-  rbt_node *r = NULL;
+  rbt_node *r = root;
+  if (data)
+    (*data) = NULL;
+
   if (find(root, key))
   {
-    r = root;
     if (!is_red(left(r)) && !is_red(right(r)))
       r->colour = RED;
 
     r = remove_node(r, key, data);
-    if (0 < size(r))
+    if (r)
+    {
+      r->parent = NULL;
       r->colour = BLACK;
+    }
   }
   return r;
 }
@@ -580,50 +879,217 @@ size_t rbt_data_size(rbt_node *root, int64_t key)
 
 void rbt_free(rbt_node *root, void (*data_free)(void *))
 {
-  rbt_node *_parent = root;
-  rbt_node *_left = NULL;
-  rbt_node *_right = NULL;
-  rbt_node *_tmp = NULL;
-  while (_parent)
+  rbt_node *node = root;
+  rbt_node *_parent = NULL;
+  while (node)
   {
-    if (has_children(_parent))
+    if (left(node))
     {
-      _left = left(_parent);
-      _right = right(_parent);
-      while (has_children(_left) || has_children(_right))
-      {
-	if (has_children(_left))
-	  _parent = _left;
-	else if (has_children(_right))
-	  _parent = _right;
-	
-        _left = left(_parent);
-        _right = right(_parent);
-      }
-
-      if (_left)
-      {
-	_parent->left = NULL;
-	_left->parent = NULL;
-	node_free(_left, data_free);
-	_left = NULL;
-      }
-      
-      if (_right)
-      {
-	_parent->right = NULL;
-	_right->parent = NULL;
-	node_free(_right, data_free);
-	_right = NULL;
-      }
+      node = left(node);
+    }
+    else if (right(node))
+    {
+      node = right(node);
     }
     else
     {
-      _tmp = _parent;
-      _parent = parent(_parent);
-
-      _tmp->parent = NULL;
-      node_free(_tmp, data_free);
+      _parent = (node == root ? NULL : parent(node));
+      if (_parent)
+      {
+        if (left(_parent) == node)
+          _parent->left = NULL;
+        else
+          _parent->right = NULL;
+      }
+      node_free(node, data_free);
+      node = _parent;
     }
   }
 }
+
+rbt_node * rbt_build_sorted(const int64_t *keys, void **values,
+                            const size_t *sizes, size_t count)
+{
+  rbt_node *root = NULL;
+  uint32_t height = 0;
+  size_t i = 0;
+  if (!keys || count == 0)
+    return NULL;
+
+  for (i = 1; i < count; i++)
+  {
+    if (keys[i] <= keys[i - 1])
+      return NULL;
+  }
+
+  // The smallest black height whose tree of 2-nodes, 2^h - 1 keys, is no
+  // larger than the count.
+  while (height < 63 && ((size_t)2 << height) - 1 <= count)
+    height += 1;
+
+  root = build_node(keys, values, sizes, 0, count, height);
+  root->parent = NULL;
+  return root;
+}
+
+size_t rbt_export(rbt_node *root, int64_t *keys, void **values, size_t *sizes,
+                  size_t capacity)
+{
+  size_t count = 0;
+  rbt_cursor cursor;
+  rbt_node *node = NULL;
+
+  rbt_cursor_init(&cursor, root, INT64_MIN, INT64_MAX);
+  while (count < capacity && (node = rbt_cursor_next(&cursor, NULL, NULL)))
+  {
+    if (keys)
+      keys[count] = node->key;
+    if (values)
+      values[count] = node->data;
+    if (sizes)
+      sizes[count] = node->data_size;
+    count += 1;
+  }
+  return count;
+}
+
+rbt_node * rbt_split(rbt_node *root, int64_t key, rbt_node **right)
+{
+  rbt_node *l = NULL, *r = NULL, *match = NULL;
+  uint32_t lh = 0, rh = 0;
+
+  make_root(root, NULL);
+  split_node(root, black_height(root), key, &l, &lh, &match, &r, &rh);
+  if (match)
+    r = join(NULL, 0, match, r, rh, NULL);
+
+  if (right)
+    (*right) = r;
+  return l;
+}
+
+rbt_node * rbt_join(rbt_node *_left, rbt_node *_right,
+                    void (*data_free)(void *))
+{
+  int64_t last = 0, first = 0;
+  if (!_left)
+    return _right;
+  if (!_right)
+    return _left;
+
+  rbt_get_last(_left, &last, NULL);
+  rbt_get_first(_right, &first, NULL);
+  if (first <= last)
+    return rbt_union(_left, _right, data_free);
+  return join_pair(_left, _right);
+}
+
+rbt_node * rbt_union(rbt_node *a, rbt_node *b, void (*data_free)(void *))
+{
+  return set_node(SET_UNION, a, b, data_free, SET_FORK_DEPTH);
+}
+
+rbt_node * rbt_intersection(rbt_node *a, rbt_node *b,
+                            void (*data_free)(void *))
+{
+  return set_node(SET_INTERSECTION, a, b, data_free, SET_FORK_DEPTH);
+}
+
+rbt_node * rbt_difference(rbt_node *a, rbt_node *b, void (*data_free)(void *))
+{
+  return set_node(SET_DIFFERENCE, a, b, data_free, SET_FORK_DEPTH);
+}
+
+rbt_node * rbt_remove_range(rbt_node *root, int64_t lo, int64_t hi,
+                            void (*data_free)(void *))
+{
+  rbt_node *l = NULL, *middle = NULL, *r = NULL;
+  rbt_node *first = NULL, *last = NULL;
+  uint32_t lh = 0, mh = 0, rh = 0;
+  if (!root || hi < lo)
+    return root;
+
+  make_root(root, NULL);
+  split_node(root, black_height(root), lo, &l, &lh, &first, &r, &rh);
+  split_node(r, rh, hi, &middle, &mh, &last, &r, &rh);
+
+  if (first)
+    node_free(first, data_free);
+  if (last)
+    node_free(last, data_free);
+  rbt_free(middle, data_free);
+  return join_pair(l, r);
+}
+
+size_t rbt_range(rbt_node *root, int64_t lo, int64_t hi,
+                 bool (*callback)(int64_t, void *, Pointer), Pointer ctx)
+{
+  size_t count = 0;
+  rbt_cursor cursor;
+  rbt_node *node = NULL;
+
+  rbt_cursor_init(&cursor, root, lo, hi);
+  while ((node = rbt_cursor_next(&cursor, NULL, NULL)))
+  {
+    count += 1;
+    if (callback && !callback(node->key, node->data, ctx))
+      break;
+  }
+  return count;
+}
+
+size_t rbt_range_reverse(rbt_node *root, int64_t lo, int64_t hi,
+                         bool (*callback)(int64_t, void *, Pointer),
+                         Pointer ctx)
+{
+  size_t count = 0;
+  rbt_cursor cursor;
+  rbt_node *node = NULL;
+
+  rbt_cursor_init_reverse(&cursor, root, lo, hi);
+  while ((node = rbt_cursor_next(&cursor, NULL, NULL)))
+  {
+    count += 1;
+    if (callback && !callback(node->key, node->data, ctx))
+      break;
+  }
+  return count;
+}
+
+void rbt_cursor_init(rbt_cursor *cursor, rbt_node *root, int64_t lo, int64_t hi)
+{
+  cursor->depth = 0;
+  cursor->reverse = false;
+  cursor->lo = lo;
+  cursor->hi = hi;
+  if (lo <= hi)
+    cursor_push(cursor, root);
+}
+
+void rbt_cursor_init_reverse(rbt_cursor *cursor, rbt_node *root,
+                             int64_t lo, int64_t hi)
+{
+  cursor->depth = 0;
+  cursor->reverse = true;
+  cursor->lo = lo;
+  cursor->hi = hi;
+  if (lo <= hi)
+    cursor_push(cursor, root);
+}
+
+rbt_node * rbt_cursor_next(rbt_cursor *cursor, int64_t *key, void **data)
+{
+  rbt_node *n = NULL;
+  if (cursor->depth == 0)
+    return NULL;
+
+  n = cursor->stack[--cursor->depth];
+  if (cursor->reverse ? n->key < cursor->lo : cursor->hi < n->key)
+  {
+    cursor->depth = 0;
+    return NULL;
+  }
+
+  cursor_push(cursor, cursor->reverse ? left(n) : right(n));
+  return output(n, key, data);
+}
@@ -0,0 +1,26 @@
+#include "rbtree_typed.h"
+
+static inline int compare_double(double, double);
+static inline int compare_pair(rbt_pair, rbt_pair);
+
+// --- Private ---
+
+int compare_double(double a, double b)
+{
+  return (a == b ? 0 : (a < b ? -1 : 1));
+}
+
+int compare_pair(rbt_pair a, rbt_pair b)
+{
+  if (a.first == b.first && a.second == b.second)
+    return 0;
+  if (a.first != b.first)
+    return (a.first < b.first ? -1 : 1);
+  return (a.second < b.second ? -1 : 1);
+}
+
+// --- Public ---
+
+RBTREE_GEN_DEFINE(rbs, const char *, void *, strcmp)
+RBTREE_GEN_DEFINE(rbd, double, void *, compare_double)
+RBTREE_GEN_DEFINE(rbp, rbt_pair, void *, compare_pair)
@@ -0,0 +1,175 @@
+#include "ring.h"
+
+#include <stdatomic.h>
+
+#define CACHE_LINE (64)
+
+// The producer and the consumer each own one cache line: the index they
+// write, the other side's index as they last saw it and their counters. A
+// side only reloads the other's index when the cached one says the ring is
+// full or empty, so in steady state the lines do not bounce.
+typedef struct ring_t
+{
+  _Alignas(CACHE_LINE) _Atomic uint32_t tail;
+  uint32_t head_cache;
+  _Atomic uint64_t pushed;
+  _Atomic uint64_t dropped;
+
+  _Alignas(CACHE_LINE) _Atomic uint32_t head;
+  uint32_t tail_cache;
+
+  _Alignas(CACHE_LINE) uint32_t mask;
+  size_t element_size;
+  uint8_t *elements;
+} ring;
+
+
+static uint32_t round_up(uint32_t);
+static void     copy_in(ring *, uint32_t, const uint8_t *, uint32_t);
+static void     copy_out(ring *, uint32_t, uint8_t *, uint32_t);
+
+// --- Private ---
+
+uint32_t round_up(uint32_t value)
+{
+  uint32_t result = 2;
+  while (result < value && result < (1U << 31))
+    result <<= 1;
+  return result;
+}
+
+// Copies count elements starting at the given index, in at most two runs
+// around the end of the buffer.
+void copy_in(ring *queue, uint32_t index, const uint8_t *from, uint32_t count)
+{
+  uint32_t start = index & queue->mask;
+  uint32_t first = min(count, queue->mask + 1 - start);
+  memcpy(queue->elements + start * queue->element_size, from,
+         first * queue->element_size);
+  if (first < count)
+    memcpy(queue->elements, from + first * queue->element_size,
+           (count - first) * queue->element_size);
+}
+
+void copy_out(ring *queue, uint32_t index, uint8_t *to, uint32_t count)
+{
+  uint32_t start = index & queue->mask;
+  uint32_t first = min(count, queue->mask + 1 - start);
+  memcpy(to, queue->elements + start * queue->element_size,
+         first * queue->element_size);
+  if (first < count)
+    memcpy(to + first * queue->element_size, queue->elements,
+           (count - first) * queue->element_size);
+}
+
+// --- Public ---
+
+ring * ring_create(uint32_t capacity, size_t element_size)
+{
+  size_t size = (sizeof(ring) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  ring *queue = NULL;
+
+  if (element_size == 0)
+    return NULL;
+  queue = (ring *)aligned_alloc(CACHE_LINE, size);
+  if (!queue)
+    return NULL;
+  memset(queue, 0, sizeof(ring));
+  queue->mask = round_up(capacity) - 1;
+  queue->element_size = element_size;
+  queue->elements = (uint8_t *)calloc(queue->mask + 1, element_size);
+  if (!queue->elements)
+  {
+    free(queue);
+    return NULL;
+  }
+  return queue;
+}
+
+void ring_destroy(ring *queue)
+{
+  if (!queue)
+    return;
+  free(queue->elements);
+  free(queue);
+}
+
+bool ring_push(ring *queue, const void *element)
+{
+  return (ring_push_all(queue, element, 1) == 1);
+}
+
+uint32_t ring_push_all(ring *queue, const void *elements, uint32_t count)
+{
+  uint32_t tail = atomic_load_explicit(&(queue->tail), memory_order_relaxed);
+  uint32_t space = queue->mask + 1 - (tail - queue->head_cache);
+  uint32_t fits = 0;
+
+  if (space < count)
+  {
+    queue->head_cache =
+      atomic_load_explicit(&(queue->head), memory_order_acquire);
+    space = queue->mask + 1 - (tail - queue->head_cache);
+  }
+
+  fits = min(space, count);
+  if (0 < fits)
+  {
+    copy_in(queue, tail, (const uint8_t *)elements, fits);
+    atomic_store_explicit(&(queue->tail), tail + fits, memory_order_release);
+    atomic_fetch_add_explicit(&(queue->pushed), fits, memory_order_relaxed);
+  }
+  if (fits < count)
+    atomic_fetch_add_explicit(&(queue->dropped), count - fits,
+                              memory_order_relaxed);
+  return fits;
+}
+
+bool ring_pop(ring *queue, void *element)
+{
+  return (ring_pop_all(queue, element, 1) == 1);
+}
+
+uint32_t ring_pop_all(ring *queue, void *elements, uint32_t count)
+{
+  uint32_t head = atomic_load_explicit(&(queue->head), memory_order_relaxed);
+  uint32_t ready = queue->tail_cache - head;
+  uint32_t taken = 0;
+
+  if (ready < count)
+  {
+    queue->tail_cache =
+      atomic_load_explicit(&(queue->tail), memory_order_acquire);
+    ready = queue->tail_cache - head;
+  }
+
+  taken = min(ready, count);
+  if (0 < taken)
+  {
+    copy_out(queue, head, (uint8_t *)elements, taken);
+    atomic_store_explicit(&(queue->head), head + taken, memory_order_release);
+  }
+  return taken;
+}
+
+// The head is read first, the tail can only have moved further since.
+uint32_t ring_count(ring *queue)
+{
+  uint32_t head = atomic_load(&(queue->head));
+  return (atomic_load(&(queue->tail)) - head);
+}
+
+uint32_t ring_capacity(ring *queue)
+{
+  return queue->mask + 1;
+}
+
+uint64_t ring_pushed(ring *queue)
+{
+  return atomic_load_explicit(&(queue->pushed), memory_order_relaxed);
+}
+
+uint64_t ring_dropped(ring *queue)
+{
+  return atomic_load_explicit(&(queue->dropped), memory_order_relaxed);
+}
@@ -1,27 +1,580 @@
 #include "ticket.h"
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif // __linux__
+
+#include <sched.h>
+
+// Rounds of spinning before parking. Only worth it when the holder can be
+// running on another CPU at the same time.
+#define LOCK_SPINS (200)
+
+// A queued node's state, the predecessor only has to wake it once it parked.
+#define MCS_FREE   (0U)
+#define MCS_WAIT   (1U)
+#define MCS_PARKED (2U)
+
+struct mcs_node_t
+{
+  _Alignas(64) _Atomic(mcs_node *) next;
+  _Atomic uint32_t state;
+  bool used;
+};
+
+// readers_in and readers_out count readers in their upper bits, the low
+// bits of readers_in are the waiting or active writer and its phase.
+#define RW_READER      (0x100U)
+#define RW_WRITER      (0x2U)
+#define RW_PHASE       (0x1U)
+#define RW_WRITER_BITS (0x3U)
+
+static _Thread_local mcs_node s_mcs_nodes[MCS_THREAD_NODES];
+
+#ifdef _SANDBOX_LOCK_STATS
+static _Atomic(lock_stats *) s_lock_stats = NULL;
+
+static uint64_t   stats_now(void);
+static uint32_t   stats_bucket(uint64_t);
+static uint64_t   stats_percentile(_Atomic uint64_t *, uint64_t, uint32_t);
+static void       stats_register(lock_stats *, const char *);
+static uint64_t   stats_enter(lock_stats *);
+static void       stats_acquired(lock_stats *, uint64_t, bool);
+static void       stats_release(lock_stats *);
+static void       stats_cancel(lock_stats *);
+static int        stats_compare(const void *, const void *);
+#else
+// Without statistics the hooks only keep their arguments from looking
+// unused.
+#define stats_enter(stats)                      (0UL)
+#define stats_acquired(stats, since, contended) \
+  ((void)(since), (void)(contended))
+#define stats_release(stats)
+#define stats_cancel(stats)
+#endif // _SANDBOX_LOCK_STATS
+
+static uint32_t   spin_limit(void);
+static void       cpu_relax(void);
+static void       park(_Atomic uint32_t *, uint32_t, const struct timespec *);
+static void       wake(_Atomic uint32_t *, int);
+#ifdef __linux__
+static bool       deadline_passed(const struct timespec *);
+static bool       wait_turn(ticket_mutex *, uint64_t, const struct timespec *);
+static bool       abandon_turn(ticket_mutex *, uint64_t);
+static bool       claim_abandoned(ticket_mutex *, uint64_t);
+#else
+static void       realtime_deadline(const struct timespec *, struct timespec *);
+#endif // __linux__
+static mcs_node * take_node(void);
+static bool       rw_reader_blocked(rw_ticket_mutex *, uint32_t);
+static bool       rw_readers_left(rw_ticket_mutex *, uint32_t);
+static void       rw_wait(rw_ticket_mutex *,
+                          bool (*)(rw_ticket_mutex *, uint32_t), uint32_t);
+static void       rw_wake(rw_ticket_mutex *);
+
+// --- Private ---
+
+uint32_t spin_limit()
+{
+  static _Atomic int32_t limit = -1;
+  int32_t value = atomic_load_explicit(&limit, memory_order_relaxed);
+  if (value < 0)
+  {
+    value = (1 < sysconf(_SC_NPROCESSORS_ONLN) ? LOCK_SPINS : 0);
+    atomic_store_explicit(&limit, value, memory_order_relaxed);
+  }
+  return (uint32_t)value;
+}
+
+void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// Sleeps while the word still holds the value, until the deadline if there
+// is one. May return early, callers check their condition again.
+void park(_Atomic uint32_t *word, uint32_t value,
+          const struct timespec *deadline)
+{
+#ifdef __linux__
+  if (deadline)
+    syscall(SYS_futex, word, FUTEX_WAIT_BITSET_PRIVATE, value, deadline, NULL,
+            FUTEX_BITSET_MATCH_ANY);
+  else
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+  (void)deadline;
+  if (atomic_load(word) == value)
+    sched_yield();
+#endif // __linux__
+}
+
+void wake(_Atomic uint32_t *word, int count)
+{
+#ifdef __linux__
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#else
+  (void)word;
+  (void)count;
+#endif // __linux__
+}
+
+#ifdef __linux__
+
+// Deadlines are CLOCK_MONOTONIC times, NULL never passes.
+bool deadline_passed(const struct timespec *deadline)
+{
+  struct timespec now = {0};
+  if (!deadline)
+    return false;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (deadline->tv_sec < now.tv_sec ||
+          (deadline->tv_sec == now.tv_sec && deadline->tv_nsec <= now.tv_nsec));
+}
+
+// Waits until the ticket comes up, or the deadline passes.
+bool wait_turn(ticket_mutex *ticket, uint64_t queue_cur,
+               const struct timespec *deadline)
+{
+  _Atomic uint32_t *slot = &(ticket->slots[queue_cur % TICKET_SLOTS]);
+  uint32_t spins = spin_limit();
+  uint32_t seen = 0;
+
+  while (atomic_load_explicit(&(ticket->queue_head), memory_order_acquire) !=
+         queue_cur)
+  {
+    if (0 < spins)
+    {
+      spins -= 1;
+      cpu_relax();
+      continue;
+    }
+    if (deadline_passed(deadline))
+      return false;
+
+    // Announce the wait before checking the head one last time, the
+    // unlocker bumps the slot after moving the head whenever it sees a
+    // parked waiter, so the wake-up cannot fall between the two.
+    seen = atomic_load(slot);
+    atomic_fetch_add(&(ticket->parked), 1);
+    if (atomic_load(&(ticket->queue_head)) != queue_cur)
+      park(slot, seen, deadline);
+    atomic_fetch_sub(&(ticket->parked), 1);
+  }
+  return true;
+}
+
+// Gives up a ticket whose deadline passed without breaking the queue. The
+// last ticket is simply taken back, any other is left in the abandoned
+// table for the unlocker to skip. Returns true if the turn came up in the
+// meantime and the lock is held after all.
+bool abandon_turn(ticket_mutex *ticket, uint64_t queue_cur)
+{
+  uint64_t queue_tail = queue_cur + 1;
+  uint64_t expected = 0;
+  uint32_t i = 0;
+
+  if (atomic_compare_exchange_strong(&(ticket->queue_tail), &queue_tail,
+                                     queue_cur))
+    return false;
+
+  // Counted before the entry is written, an unlocker that sees no count
+  // moved the head before this looks at it.
+  atomic_fetch_add(&(ticket->abandoned_count), 1);
+  for (i = 0; i < TICKET_ABANDONED; i++)
+  {
+    expected = 0;
+    if (atomic_compare_exchange_strong(ticket->abandoned + i, &expected,
+                                       queue_cur + 1))
+      break;
+  }
+  if (i == TICKET_ABANDONED)
+  {
+    // No room to leave, so stay in line after all.
+    atomic_fetch_sub(&(ticket->abandoned_count), 1);
+    return wait_turn(ticket, queue_cur, NULL);
+  }
+
+  // Whoever takes the entry back out owns the turn, this thread or the
+  // unlocker skipping it.
+  expected = queue_cur + 1;
+  if (atomic_load(&(ticket->queue_head)) == queue_cur &&
+      atomic_compare_exchange_strong(ticket->abandoned + i, &expected, 0UL))
+  {
+    atomic_fetch_sub(&(ticket->abandoned_count), 1);
+    return true;
+  }
+  return false;
+}
+
+// Takes the ticket out of the abandoned table if it is there.
+bool claim_abandoned(ticket_mutex *ticket, uint64_t queue_cur)
+{
+  uint64_t expected = 0;
+  uint32_t i = 0;
+  for (i = 0; i < TICKET_ABANDONED; i++)
+  {
+    expected = queue_cur + 1;
+    if (atomic_compare_exchange_strong(ticket->abandoned + i, &expected, 0UL))
+    {
+      atomic_fetch_sub(&(ticket->abandoned_count), 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+#else
+
+// pthread_cond_timedwait counts in CLOCK_REALTIME.
+void realtime_deadline(const struct timespec *deadline, struct timespec *until)
+{
+  struct timespec now = {0};
+  int64_t left = 0;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  left = (int64_t)(deadline->tv_sec - now.tv_sec) * 1000000000L +
+    (deadline->tv_nsec - now.tv_nsec);
+  clock_gettime(CLOCK_REALTIME, until);
+  if (0 < left)
+  {
+    left += until->tv_nsec;
+    until->tv_sec += (time_t)(left / 1000000000L);
+    until->tv_nsec = (long)(left % 1000000000L);
+  }
+}
+
+#endif // __linux__
+
+mcs_node * take_node()
+{
+  uint32_t i = 0;
+  for (i = 0; i < MCS_THREAD_NODES; i++)
+  {
+    if (!s_mcs_nodes[i].used)
+    {
+      s_mcs_nodes[i].used = true;
+      return s_mcs_nodes + i;
+    }
+  }
+  fprintf(stderr, "Thread holds more than %d MCS locks\n", MCS_THREAD_NODES);
+  abort();
+}
+
+bool rw_reader_blocked(rw_ticket_mutex *rw, uint32_t writer)
+{
+  return ((atomic_load(&(rw->readers_in)) & RW_WRITER_BITS) == writer);
+}
+
+bool rw_readers_left(rw_ticket_mutex *rw, uint32_t readers)
+{
+  return (atomic_load(&(rw->readers_out)) != readers);
+}
+
+// Waits for as long as the condition holds, spinning first and then
+// parking on the wake-up counter the other side bumps.
+void rw_wait(rw_ticket_mutex *rw, bool (*waiting)(rw_ticket_mutex *, uint32_t),
+             uint32_t value)
+{
+  uint32_t spins = spin_limit();
+  uint32_t seen = 0;
+
+  while (waiting(rw, value))
+  {
+    if (0 < spins)
+    {
+      spins -= 1;
+      cpu_relax();
+      continue;
+    }
+
+    seen = atomic_load(&(rw->wakeups));
+    atomic_fetch_add(&(rw->parked), 1);
+    if (waiting(rw, value))
+      park(&(rw->wakeups), seen, NULL);
+    atomic_fetch_sub(&(rw->parked), 1);
+  }
+}
+
+void rw_wake(rw_ticket_mutex *rw)
+{
+  if (0 < atomic_load(&(rw->parked)))
+  {
+    atomic_fetch_add(&(rw->wakeups), 1);
+    wake(&(rw->wakeups), INT_MAX);
+  }
+}
+
+#ifdef _SANDBOX_LOCK_STATS
+
+uint64_t stats_now()
+{
+  struct timespec now = {0};
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000UL + (uint64_t)now.tv_nsec;
+}
+
+uint32_t stats_bucket(uint64_t nanoseconds)
+{
+  uint32_t bucket = 0;
+  if (nanoseconds < 2)
+    return 0;
+  bucket = (uint32_t)(63 - __builtin_clzll(nanoseconds));
+  return min(bucket, LOCK_STATS_BUCKETS - 1);
+}
+
+// Upper bound of the bucket the given per mille of the samples fall in.
+uint64_t stats_percentile(_Atomic uint64_t *buckets, uint64_t total,
+                          uint32_t per_mille)
+{
+  uint64_t wanted = (total * per_mille + 999) / 1000;
+  uint64_t seen = 0;
+  uint32_t i = 0;
+  for (i = 0; i < LOCK_STATS_BUCKETS; i++)
+  {
+    seen += atomic_load_explicit(buckets + i, memory_order_relaxed);
+    if (wanted <= seen)
+      break;
+  }
+  return (2UL << min(i, LOCK_STATS_BUCKETS - 1));
+}
+
+// Lists the lock for lock_stats_dump, once.
+void stats_register(lock_stats *stats, const char *name)
+{
+  bool registered = false;
+  stats->name = name;
+  if (atomic_compare_exchange_strong(&(stats->registered), &registered, true))
+  {
+    stats->next = atomic_load(&s_lock_stats);
+    while (!atomic_compare_exchange_weak(&s_lock_stats, &(stats->next), stats))
+      ;
+  }
+}
+
+// Counts the thread into the queue and starts its wait.
+uint64_t stats_enter(lock_stats *stats)
+{
+  uint32_t depth = atomic_fetch_add(&(stats->depth), 1) + 1;
+  uint32_t depth_max =
+    atomic_load_explicit(&(stats->depth_max), memory_order_relaxed);
+  while (depth_max < depth &&
+         !atomic_compare_exchange_weak(&(stats->depth_max), &depth_max, depth))
+    ;
+  return stats_now();
+}
+
+void stats_acquired(lock_stats *stats, uint64_t since, bool contended)
+{
+  uint64_t now = stats_now();
+  atomic_fetch_sub(&(stats->depth), 1);
+  atomic_fetch_add_explicit(&(stats->acquired), 1, memory_order_relaxed);
+  if (contended)
+    atomic_fetch_add_explicit(&(stats->contended), 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&(stats->wait_total), now - since,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(stats->wait + stats_bucket(now - since), 1,
+                            memory_order_relaxed);
+  stats->held_since = now;
+}
+
+void stats_release(lock_stats *stats)
+{
+  uint64_t held = stats_now() - stats->held_since;
+  atomic_fetch_add_explicit(&(stats->hold_total), held, memory_order_relaxed);
+  atomic_fetch_add_explicit(stats->hold + stats_bucket(held), 1,
+                            memory_order_relaxed);
+}
+
+// A timed lock that gave up leaves the queue without being counted.
+void stats_cancel(lock_stats *stats)
+{
+  atomic_fetch_sub(&(stats->depth), 1);
+}
+
+int stats_compare(const void *a, const void *b)
+{
+  uint64_t wait_a = atomic_load(&((*(lock_stats * const *)a)->wait_total));
+  uint64_t wait_b = atomic_load(&((*(lock_stats * const *)b)->wait_total));
+  if (wait_a == wait_b)
+    return 0;
+  return (wait_a < wait_b ? 1 : -1);
+}
+
+#endif // _SANDBOX_LOCK_STATS
+
+// --- Public ---
+
+#ifdef __linux__
+
+uint64_t ticket_lock(ticket_mutex *ticket)
+{
+  ticket_lock_until(ticket, NULL);
+  return ticket_locked(ticket);
+}
+
+bool ticket_trylock(ticket_mutex *ticket)
+{
+  uint64_t queue_cur = atomic_load(&(ticket->queue_head));
+  uint64_t queue_tail = queue_cur;
+
+  if (!atomic_compare_exchange_strong(&(ticket->queue_tail), &queue_tail,
+                                      queue_cur + 1))
+    return false;
+  stats_acquired(&(ticket->stats), stats_enter(&(ticket->stats)), false);
+  return true;
+}
+
+bool ticket_lock_until(ticket_mutex *ticket, const struct timespec *deadline)
+{
+  uint64_t since = stats_enter(&(ticket->stats));
+  uint64_t queue_cur = atomic_fetch_add(&(ticket->queue_tail), 1);
+  bool contended = (atomic_load(&(ticket->queue_head)) != queue_cur);
+
+  if (!wait_turn(ticket, queue_cur, deadline) &&
+      !abandon_turn(ticket, queue_cur))
+  {
+    stats_cancel(&(ticket->stats));
+    return false;
+  }
+  stats_acquired(&(ticket->stats), since, contended);
+  return true;
+}
+
+uint64_t ticket_unlock(ticket_mutex *ticket)
+{
+  uint64_t queue_next = 0;
+  _Atomic uint32_t *slot = NULL;
+
+  if (0 < ticket_locked(ticket))
+  {
+    stats_release(&(ticket->stats));
+    queue_next = atomic_fetch_add(&(ticket->queue_head), 1) + 1;
+    while (0 < atomic_load(&(ticket->abandoned_count)) &&
+           claim_abandoned(ticket, queue_next))
+      queue_next = atomic_fetch_add(&(ticket->queue_head), 1) + 1;
+
+    if (0 < atomic_load(&(ticket->parked)))
+    {
+      slot = &(ticket->slots[queue_next % TICKET_SLOTS]);
+      atomic_fetch_add(slot, 1);
+      wake(slot, INT_MAX);
+    }
+  }
+  return ticket_locked(ticket);
+}
+
+uint64_t ticket_locked(ticket_mutex *ticket)
+{
+  if (ticket == NULL)
+    return 0UL;
+  return (atomic_load(&(ticket->queue_tail)) -
+          atomic_load(&(ticket->queue_head)));
+}
+
+#else
+
 uint64_t ticket_lock(ticket_mutex *ticket)
 {
+  ticket_lock_until(ticket, NULL);
+  return ticket_locked(ticket);
+}
+
+bool ticket_trylock(ticket_mutex *ticket)
+{
+  bool retval = false;
+  pthread_mutex_lock(&ticket->mutex);
+  if (ticket->queue_tail == ticket->queue_head)
+  {
+    ticket->queue_tail += 1;
+    ticket->queue_length += 1;
+    retval = true;
+  }
+  pthread_mutex_unlock(&ticket->mutex);
+  if (retval)
+    stats_acquired(&(ticket->stats), stats_enter(&(ticket->stats)), false);
+  return retval;
+}
+
+bool ticket_lock_until(ticket_mutex *ticket, const struct timespec *deadline)
+{
+  uint64_t since = stats_enter(&(ticket->stats));
   uint64_t queue_cur;
+  bool contended;
+  struct timespec until = {0};
+  uint32_t i = 0;
+
+  if (deadline)
+    realtime_deadline(deadline, &until);
   pthread_mutex_lock(&ticket->mutex);
   queue_cur = ticket->queue_tail;
   ticket->queue_tail += 1;
   ticket->queue_length += 1;
+  contended = (queue_cur != ticket->queue_head);
   while (queue_cur != ticket->queue_head)
-    pthread_cond_wait(&ticket->cond, &ticket->mutex);
+  {
+    if (!deadline)
+    {
+      pthread_cond_wait(&ticket->cond, &ticket->mutex);
+    }
+    else if (pthread_cond_timedwait(&ticket->cond, &ticket->mutex, &until) ==
+             ETIMEDOUT && queue_cur != ticket->queue_head)
+    {
+      // Last in line gives the ticket back, anyone else leaves it for the
+      // unlocker to skip. With no room to do that it waits its turn.
+      for (i = 0; i < TICKET_ABANDONED; i++)
+      {
+        if (ticket->queue_tail == queue_cur + 1 || !ticket->abandoned[i])
+          break;
+      }
+      if (i == TICKET_ABANDONED)
+      {
+        deadline = NULL;
+        continue;
+      }
+      if (ticket->queue_tail == queue_cur + 1)
+        ticket->queue_tail -= 1;
+      else
+        ticket->abandoned[i] = queue_cur + 1;
+      ticket->queue_length -= 1;
+      pthread_mutex_unlock(&ticket->mutex);
+      stats_cancel(&(ticket->stats));
+      return false;
+    }
+  }
   pthread_mutex_unlock(&ticket->mutex);
-  return ticket_locked(ticket);
+  stats_acquired(&(ticket->stats), since, contended);
+  return true;
 }
 
 uint64_t ticket_unlock(ticket_mutex *ticket)
 {
+  uint32_t i = 0;
   if (0 < ticket_locked(ticket))
   {
     pthread_mutex_lock(&ticket->mutex);
     if (0 < ticket_locked(ticket))
     {
+      stats_release(&(ticket->stats));
       ticket->queue_head += 1;
       ticket->queue_length -= 1;
+      do
+      {
+        for (i = 0; i < TICKET_ABANDONED; i++)
+        {
+          if (ticket->abandoned[i] == ticket->queue_head + 1)
+            break;
+        }
+        if (i < TICKET_ABANDONED)
+        {
+          ticket->abandoned[i] = 0UL;
+          ticket->queue_head += 1;
+        }
+      } while (i < TICKET_ABANDONED);
       pthread_cond_broadcast(&ticket->cond);
     }
     pthread_mutex_unlock(&ticket->mutex);
@@ -33,3 +586,215 @@ uint64_t ticket_locked(ticket_mutex *ticket)
 {
   return (ticket != NULL ? ticket->queue_length : 0UL);
 }
+
+#endif // __linux__
+
+void ticket_name(ticket_mutex *ticket, const char *name)
+{
+#ifdef _SANDBOX_LOCK_STATS
+  stats_register(&(ticket->stats), name);
+#else
+  (void)ticket;
+  (void)name;
+#endif // _SANDBOX_LOCK_STATS
+}
+
+// The queue length is not known without walking it, so this returns 1 while
+// the lock is held, as do mcs_locked and mcs_unlock.
+uint64_t mcs_lock(mcs_mutex *mcs)
+{
+  uint64_t since = stats_enter(&(mcs->stats));
+  mcs_node *node = take_node();
+  mcs_node *prev = NULL;
+  uint32_t spins = spin_limit();
+  uint32_t state = MCS_WAIT;
+
+  atomic_store_explicit(&(node->next), NULL, memory_order_relaxed);
+  atomic_store_explicit(&(node->state), MCS_WAIT, memory_order_relaxed);
+
+  prev = atomic_exchange(&(mcs->tail), node);
+  if (prev)
+  {
+    atomic_store(&(prev->next), node);
+    while (atomic_load_explicit(&(node->state), memory_order_acquire) !=
+           MCS_FREE)
+    {
+      if (0 < spins)
+      {
+        spins -= 1;
+        cpu_relax();
+        continue;
+      }
+      // The predecessor swaps the state to free and only wakes this node if
+      // it saw it parked, so the state has to be marked before sleeping.
+      state = MCS_WAIT;
+      if (atomic_compare_exchange_strong(&(node->state), &state, MCS_PARKED) ||
+          state == MCS_PARKED)
+        park(&(node->state), MCS_PARKED, NULL);
+    }
+  }
+  mcs->owner = node;
+  stats_acquired(&(mcs->stats), since, prev != NULL);
+  return 1UL;
+}
+
+bool mcs_trylock(mcs_mutex *mcs)
+{
+  mcs_node *node = take_node();
+  mcs_node *expected = NULL;
+
+  atomic_store_explicit(&(node->next), NULL, memory_order_relaxed);
+  atomic_store_explicit(&(node->state), MCS_WAIT, memory_order_relaxed);
+  if (!atomic_compare_exchange_strong(&(mcs->tail), &expected, node))
+  {
+    node->used = false;
+    return false;
+  }
+  mcs->owner = node;
+  stats_acquired(&(mcs->stats), stats_enter(&(mcs->stats)), false);
+  return true;
+}
+
+uint64_t mcs_unlock(mcs_mutex *mcs)
+{
+  mcs_node *node = mcs->owner;
+  mcs_node *next = NULL;
+  mcs_node *expected = node;
+  uint32_t spins = spin_limit();
+
+  if (node == NULL)
+    return mcs_locked(mcs);
+
+  stats_release(&(mcs->stats));
+  mcs->owner = NULL;
+  next = atomic_load(&(node->next));
+  if (!next)
+  {
+    if (atomic_compare_exchange_strong(&(mcs->tail), &expected, NULL))
+    {
+      node->used = false;
+      return mcs_locked(mcs);
+    }
+    // A waiter swapped itself in but has not linked to this node yet.
+    while (!(next = atomic_load(&(node->next))))
+    {
+      if (0 < spins)
+      {
+        spins -= 1;
+        cpu_relax();
+      }
+      else
+      {
+        sched_yield();
+      }
+    }
+  }
+
+  node->used = false;
+  if (atomic_exchange(&(next->state), MCS_FREE) == MCS_PARKED)
+    wake(&(next->state), 1);
+  return 1UL;
+}
+
+uint64_t mcs_locked(mcs_mutex *mcs)
+{
+  if (mcs == NULL)
+    return 0UL;
+  return (atomic_load(&(mcs->tail)) != NULL ? 1UL : 0UL);
+}
+
+void mcs_name(mcs_mutex *mcs, const char *name)
+{
+#ifdef _SANDBOX_LOCK_STATS
+  stats_register(&(mcs->stats), name);
+#else
+  (void)mcs;
+  (void)name;
+#endif // _SANDBOX_LOCK_STATS
+}
+
+void rw_ticket_read_lock(rw_ticket_mutex *rw)
+{
+  uint32_t writer = atomic_fetch_add(&(rw->readers_in), RW_READER);
+  writer &= RW_WRITER_BITS;
+  if (writer != 0)
+    rw_wait(rw, &rw_reader_blocked, writer);
+}
+
+void rw_ticket_read_unlock(rw_ticket_mutex *rw)
+{
+  atomic_fetch_add(&(rw->readers_out), RW_READER);
+  rw_wake(rw);
+}
+
+// Blocks the readers that come after, then waits out the ones before. The
+// phase bit flips with every writer so that a reader waiting on one writer
+// still sees it leave when the next one comes straight in.
+void rw_ticket_write_lock(rw_ticket_mutex *rw)
+{
+  uint32_t readers = 0;
+
+  sandbox_lock(&(rw->writers));
+  readers = atomic_fetch_add(&(rw->readers_in),
+                             RW_WRITER | (rw->phase & RW_PHASE));
+  rw->phase += 1;
+  rw_wait(rw, &rw_readers_left, readers);
+}
+
+void rw_ticket_write_unlock(rw_ticket_mutex *rw)
+{
+  atomic_fetch_and(&(rw->readers_in), ~RW_WRITER_BITS);
+  rw_wake(rw);
+  sandbox_unlock(&(rw->writers));
+}
+
+void rw_ticket_name(rw_ticket_mutex *rw, const char *name)
+{
+  sandbox_name(&(rw->writers), name);
+}
+
+void lock_stats_dump(FILE *out)
+{
+#ifdef _SANDBOX_LOCK_STATS
+  lock_stats **all = NULL;
+  lock_stats *stats = NULL;
+  uint64_t acquired = 0, held = 0;
+  size_t count = 0, i = 0;
+  uint32_t bucket = 0;
+
+  for (stats = atomic_load(&s_lock_stats); stats; stats = stats->next)
+    count += 1;
+  if (count == 0)
+    return;
+  all = (lock_stats **)calloc(count, sizeof(lock_stats *));
+  for (i = 0, stats = atomic_load(&s_lock_stats); i < count;
+       i++, stats = stats->next)
+    all[i] = stats;
+  qsort(all, count, sizeof(lock_stats *), &stats_compare);
+
+  fprintf(out, "%-24s %12s %12s %6s %14s %10s %10s %14s %10s\n",
+          "lock", "acquired", "contended", "depth", "wait ns",
+          "wait p50", "wait p99", "hold ns", "hold p99");
+  for (i = 0; i < count; i++)
+  {
+    stats = all[i];
+    acquired = atomic_load(&(stats->acquired));
+    held = 0;
+    for (bucket = 0; bucket < LOCK_STATS_BUCKETS; bucket++)
+      held += atomic_load(stats->hold + bucket);
+    fprintf(out,
+            "%-24s %12" PRIu64 " %12" PRIu64 " %6" PRIu32 " %14" PRIu64
+            " %10" PRIu64 " %10" PRIu64 " %14" PRIu64 " %10" PRIu64 "\n",
+            stats->name, acquired,
+            atomic_load(&(stats->contended)), atomic_load(&(stats->depth_max)),
+            atomic_load(&(stats->wait_total)),
+            stats_percentile(stats->wait, acquired, 500),
+            stats_percentile(stats->wait, acquired, 990),
+            atomic_load(&(stats->hold_total)),
+            stats_percentile(stats->hold, held, 990));
+  }
+  free(all);
+#else
+  (void)out;
+#endif // _SANDBOX_LOCK_STATS
+}